@@ -0,0 +1,237 @@
+#include "bulk_lookup.h"
+#include "tinymmdb_helper.h"
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+enum { LAT, LON, REGION, CITY, COUNTRY, NPATHS };
+static const char *const paths[NPATHS][5] = {
+    [LAT] = {"location", "latitude", NULL},
+    [LON] = {"location", "longitude", NULL},
+    [REGION] = {"subdivisions", "0", "names", "en", NULL},
+    [CITY] = {"city", "names", "en", NULL},
+    [COUNTRY] = {"country", "names", "en", NULL}
+};
+
+// the lines one thread looks up, and its output
+typedef struct {
+    TMMDB_s *mmdb;
+    TMMDB_query_s const *const *queries;
+    char **lines;
+    int *lens;
+    int count;
+    int invalid;
+    TMMDB_buffer_s out;
+} shard_s;
+
+struct bulk_s {
+    int threads;
+    FILE *out;
+    TMMDB_query_s *queries[NPATHS];
+    shard_s shards[BULK_MAX_THREADS];
+};
+
+// reads fh size bytes at a time and passes the complete lines to cb. The
+// last line needs no line end. A line longer than size is passed as its
+// first size bytes, the rest of it is skipped. Returns the sum of what cb
+// returned.
+long bulk_read_lines(FILE * fh, size_t size, bulk_lines_cb cb, void *ctx)
+{
+    char *buf = malloc(size);
+    int capacity = size / 8 + 1;
+    char **lines = malloc(capacity * sizeof(char *));
+    int *lens = malloc(capacity * sizeof(int));
+    size_t have = 0, got;
+    int skip = 0;               /* in the rest of a long line */
+    long invalid = 0;
+    if (!buf || !lines || !lens)
+        die("Out of memory\n");
+
+    do {
+        got = fread(buf + have, 1, size - have, fh);
+        have += got;
+        char *p = buf, *end = buf + have;
+        if (skip) {
+            char *eol = memchr(buf, '\n', have);
+            if (!eol) {
+                have = 0;
+                continue;
+            }
+            p = eol + 1;
+            skip = 0;
+        }
+
+        int count = 0;
+        while (p < end) {
+            char *eol = memchr(p, '\n', end - p);
+            if (!eol) {
+                // complete lines only, unless this is the end of the input
+                // or the line fills the buffer
+                if (got && (p > buf || have < size))
+                    break;
+                skip = got != 0;
+                eol = end;
+            }
+            if (count == capacity) {
+                capacity *= 2;
+                lines = realloc(lines, capacity * sizeof(char *));
+                lens = realloc(lens, capacity * sizeof(int));
+                if (!lines || !lens)
+                    die("Out of memory\n");
+            }
+            int len = eol - p;
+            while (len && (p[len - 1] == '\r' || p[len - 1] == ' '))
+                len--;
+            lines[count] = p;
+            lens[count++] = len;
+            p = eol < end ? eol + 1 : end;
+        }
+        if (count)
+            invalid += cb(ctx, lines, lens, count);
+
+        have = end - p;
+        memmove(buf, p, have);
+    } while (got || have);
+
+    free_list(buf, lines, lens);
+    return invalid;
+}
+
+// TAB, newline and backslash escaped, the columns stay intact
+void bulk_put_escaped(TMMDB_buffer_s * out, const char *p, int len)
+{
+    const char *end = p + len, *run = p;
+    for (; p < end; p++) {
+        const char *esc = *p == '\t' ? "\\t" : *p == '\n' ? "\\n"
+            : *p == '\r' ? "\\r" : *p == '\\' ? "\\\\" : NULL;
+        if (!esc)
+            continue;
+        TMMDB_buffer_append(out, run, p - run);
+        TMMDB_buffer_append(out, esc, 2);
+        run = p + 1;
+    }
+    TMMDB_buffer_append(out, run, end - run);
+}
+
+static void put_string(TMMDB_buffer_s * out, TMMDB_return_s * res)
+{
+    TMMDB_buffer_append(out, "\t", 1);
+    if (res->offset)
+        bulk_put_escaped(out, res->ptr, res->data_size);
+}
+
+static void *lookup_shard(void *arg)
+{
+    shard_s *shard = arg;
+    TMMDB_s *mmdb = shard->mmdb;
+    int n = shard->count;
+    struct in6_addr *ips = calloc(n, sizeof(struct in6_addr));
+    uint32_t *ipnums = calloc(n, sizeof(uint32_t));
+    int *valid = calloc(n, sizeof(int));
+    TMMDB_root_entry_s *res = calloc(n, sizeof(TMMDB_root_entry_s));
+    if (n && (!ips || !ipnums || !valid || !res))
+        die("Out of memory\n");
+
+    // numeric addresses only, never DNS. Invalid lines are looked up as
+    // 0.0.0.0 or :: and ignored below.
+    for (int i = 0; i < n; i++) {
+        void *ip = mmdb->depth == 32 ? (void *)&ipnums[i] : (void *)&ips[i];
+        valid[i] = TMMDB_parse_ip(mmdb, shard->lines[i], shard->lens[i],
+                                  ip) == TMMDB_SUCCESS;
+        if (!valid[i]) {
+            memset(&ips[i], 0, sizeof(ips[i]));
+            ipnums[i] = 0;
+            shard->invalid++;
+        }
+    }
+    if (mmdb->depth == 32)
+        TMMDB_lookup_many_ipnum(mmdb, ipnums, n, res);
+    else
+        TMMDB_lookup_many_ipnum_128(mmdb, ips, n, res);
+
+    for (int i = 0; i < n; i++) {
+        TMMDB_return_s values[NPATHS];
+        char num[64];
+        bulk_put_escaped(&shard->out, shard->lines[i], shard->lens[i]);
+        if (!valid[i] || !res[i].entry.offset) {
+            TMMDB_buffer_append(&shard->out, "\t\t\t\t\t\n", 6);
+            continue;
+        }
+        TMMDB_get_values(&res[i].entry, shard->queries, NPATHS, values);
+        int len = snprintf(num, sizeof(num), "\t%f\t%f",
+                           values[LAT].offset ? values[LAT].double_value : 0,
+                           values[LON].offset ? values[LON].double_value : 0);
+        TMMDB_buffer_append(&shard->out, num, len);
+        put_string(&shard->out, &values[REGION]);
+        put_string(&shard->out, &values[CITY]);
+        put_string(&shard->out, &values[COUNTRY]);
+        TMMDB_buffer_append(&shard->out, "\n", 1);
+    }
+    free_list(ips, ipnums, valid, res);
+    return NULL;
+}
+
+// look up count lines with the threads, write them in input order
+static long lookup_lines(void *ctx, char **lines, int *lens, int count)
+{
+    bulk_s *bulk = ctx;
+    shard_s *shards = bulk->shards;
+    int threads = bulk->threads;
+    pthread_t tid[BULK_MAX_THREADS];
+    int started[BULK_MAX_THREADS];
+    int per_thread = (count + threads - 1) / threads;
+    long invalid = 0;
+    for (int t = 0; t < threads; t++) {
+        int first = t * per_thread;
+        shards[t].lines = lines + first;
+        shards[t].lens = lens + first;
+        shards[t].count = first >= count ? 0
+            : first + per_thread > count ? count - first : per_thread;
+        shards[t].out.len = 0;
+        shards[t].invalid = 0;
+        started[t] = threads > 1
+            && !pthread_create(&tid[t], NULL, lookup_shard, &shards[t]);
+        if (!started[t])
+            lookup_shard(&shards[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        if (started[t])
+            pthread_join(tid[t], NULL);
+        fwrite(shards[t].out.data, 1, shards[t].out.len, bulk->out);
+        invalid += shards[t].invalid;
+    }
+    return invalid;
+}
+
+// writes addr TAB latitude TAB longitude TAB region TAB city TAB country
+// lines to out, 1 - BULK_MAX_THREADS threads
+bulk_s *bulk_new(TMMDB_s * mmdb, int threads, FILE * out)
+{
+    bulk_s *bulk = calloc(1, sizeof(bulk_s));
+    if (!bulk)
+        die("Out of memory\n");
+    bulk->threads = threads;
+    bulk->out = out;
+    for (int i = 0; i < NPATHS; i++)
+        TMMDB_compile_query(&bulk->queries[i], paths[i]);
+    for (int t = 0; t < threads; t++)
+        bulk->shards[t] = (shard_s) {.mmdb = mmdb,.queries =
+                (TMMDB_query_s const *const *)bulk->queries };
+    return bulk;
+}
+
+// addresses from fh, one per line, read size bytes at a time. Returns the
+// number of invalid lines.
+long bulk_lookup(bulk_s * bulk, FILE * fh, size_t size)
+{
+    return bulk_read_lines(fh, size, lookup_lines, bulk);
+}
+
+void bulk_free(bulk_s * bulk)
+{
+    for (int t = 0; t < bulk->threads; t++)
+        TMMDB_free_buffer(&bulk->shards[t].out);
+    for (int i = 0; i < NPATHS; i++)
+        TMMDB_free_query(bulk->queries[i]);
+    free(bulk);
+}
@@ -0,0 +1,21 @@
+#ifndef BULK_LOOKUP_H
+#define BULK_LOOKUP_H (1)
+#include "tinymmdb.h"
+#include <stdio.h>
+
+#define BULK_READ_SIZE (4 << 20)
+#define BULK_MAX_THREADS (64)
+
+// gets count lines without the line end and trailing blanks, they are
+// valid during the call. Returns the number of invalid lines.
+typedef long (*bulk_lines_cb) (void *ctx, char **lines, int *lens,
+                               int count);
+
+typedef struct bulk_s bulk_s;
+
+long bulk_read_lines(FILE * fh, size_t size, bulk_lines_cb cb, void *ctx);
+void bulk_put_escaped(TMMDB_buffer_s * out, const char *p, int len);
+bulk_s *bulk_new(TMMDB_s * mmdb, int threads, FILE * out);
+long bulk_lookup(bulk_s * bulk, FILE * fh, size_t size);
+void bulk_free(bulk_s * bulk);
+#endif
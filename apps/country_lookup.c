@@ -32,11 +32,11 @@ int main(int argc, char *const argv[])
     argv += optind;
 
     TMMDB_s *mmdb;
-    int status = TMMDB_open(&mmdb, fname ? fname : TMMDB_DEFAULT_DATABASE,
-                            TMMDB_MODE_MEMORY_CACHE);
+    char *db = fname ? fname : TMMDB_DEFAULT_DATABASE;
+    int status = TMMDB_open(&mmdb, db, TMMDB_MODE_MEMORY_CACHE);
 
-    if (status == TMMDB_SUCCESS) {
-        fprintf(stderr, "Can't open %s ( %d )\n", fname, status);
+    if (status != TMMDB_SUCCESS) {
+        fprintf(stderr, "Can't open %s ( %d )\n", db, status);
         exit(1);
     }
 
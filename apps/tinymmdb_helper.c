@@ -54,36 +54,36 @@ static const char *na(char const *string)
 
 void dump_ipinfo(const char *ipstr, TMMDB_root_entry_s * ipinfo)
 {
+    enum { LAT, LON, CITY, COUNTRY, REGION, NPATHS };
+    static const char *const paths[NPATHS][5] = {
+        [LAT] = {"location", "latitude", NULL},
+        [LON] = {"location", "longitude", NULL},
+        [CITY] = {"city", "names", "en", NULL},
+        [COUNTRY] = {"country", "names", "en", NULL},
+        [REGION] = {"subdivisions", "0", "names", "en", NULL}
+    };
+    TMMDB_query_s *queries[NPATHS];
+    TMMDB_return_s res[NPATHS];
 
     char *city, *country, *region;
     double dlat, dlon;
     dlat = dlon = 0;
     if (ipinfo->entry.offset > 0) {
-        TMMDB_return_s res_location;
-        TMMDB_get_value(&ipinfo->entry, &res_location, "location", NULL);
-        // TODO handle failed search somehow.
-        TMMDB_return_s lat, lon;
-        TMMDB_entry_s location = {.mmdb = ipinfo->entry.mmdb,.offset =
-                res_location.offset
-        };
-        if (res_location.offset) {
-            TMMDB_get_value(&location, &lat, "latitude", NULL);
-            TMMDB_get_value(&location, &lon, "longitude", NULL);
-            if (lat.offset)
-                dlat = lat.double_value;
-            if (lon.offset)
-                dlon = lon.double_value;
-        }
+        for (int i = 0; i < NPATHS; i++)
+            TMMDB_compile_query(&queries[i], paths[i]);
+        // all values in one pass over the record
+        TMMDB_get_values(&ipinfo->entry,
+                         (TMMDB_query_s const *const *)queries, NPATHS, res);
+        for (int i = 0; i < NPATHS; i++)
+            TMMDB_free_query(queries[i]);
 
-        TMMDB_return_s res;
-        TMMDB_get_value(&ipinfo->entry, &res, "city", "names", "en", NULL);
-        city = bytesdup(ipinfo->entry.mmdb, &res);
-        TMMDB_get_value(&ipinfo->entry, &res, "country", "names", "en", NULL);
-        country = bytesdup(ipinfo->entry.mmdb, &res);
-
-        TMMDB_get_value(&ipinfo->entry, &res, "subdivisions", "0", "names", "en",
-                       NULL);
-        region = bytesdup(ipinfo->entry.mmdb, &res);
+        if (res[LAT].offset)
+            dlat = res[LAT].double_value;
+        if (res[LON].offset)
+            dlon = res[LON].double_value;
+        city = bytesdup(ipinfo->entry.mmdb, &res[CITY]);
+        country = bytesdup(ipinfo->entry.mmdb, &res[COUNTRY]);
+        region = bytesdup(ipinfo->entry.mmdb, &res[REGION]);
 
         printf("%s %f %f %s %s %s\n", ipstr, dlat, dlon,
                na(region), na(city), na(country));
@@ -0,0 +1,450 @@
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include "tinymmdb.h"
+#include "tinymmdb_helper.h"
+#include "getopt.h"
+#include <netdb.h>
+
+// lookup and decode micro benchmarks. Every thread runs ops operations on its
+// own addresses and times them in batches of BATCH, the percentiles are
+// the ns/op of the batches. A clock per operation would cost more than a
+// lookup.
+
+#define BATCH (16)
+#define HOT_ADDRESSES (1 << 16)
+#define MAX_THREADS (64)
+
+enum { UNIFORM, ZIPF, REPLAY, NINPUTS };
+static const char *input_names[NINPUTS] = { "uniform", "zipf", "replay" };
+
+enum { LOOKUP, VALUE, TREE, PARSE, HOT, NWORKLOADS };
+static const char *workload_names[NWORKLOADS] =
+    { "lookup", "get_value", "get_tree", "parse", "hot_field" };
+
+// one address as text and in the form the lookups take
+typedef struct {
+    char text[INET6_ADDRSTRLEN];
+    uint8_t len;
+    union {
+        uint32_t v4;
+        struct in6_addr v6;
+    } ip;
+} address_s;
+
+typedef struct {
+    address_s *addresses;
+    int count;
+} address_list_s;
+
+typedef struct {
+    TMMDB_s *mmdb;
+    int workload;
+    address_s *addresses;
+    int ops;
+    pthread_barrier_t *start;
+    double *batch_ns;
+    double total_ns;
+    uint64_t found;
+} worker_s;
+
+static uint64_t xorshift64(uint64_t * state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void set_address(TMMDB_s * mmdb, address_s * a, int family,
+                        const uint8_t * ip)
+{
+    inet_ntop(family, ip, a->text, sizeof(a->text));
+    a->len = strlen(a->text);
+    if (TMMDB_parse_ip(mmdb, a->text, a->len, &a->ip) != TMMDB_SUCCESS)
+        memset(&a->ip, 0, sizeof(a->ip));
+}
+
+// IPv4 addresses for IPv4 databases, IPv4 or IPv6 addresses for IPv6 ones
+static void random_address(TMMDB_s * mmdb, address_s * a, uint64_t * seed)
+{
+    uint8_t ip[16];
+    uint64_t hi = xorshift64(seed), lo = xorshift64(seed);
+    memcpy(ip, &hi, 8);
+    memcpy(ip + 8, &lo, 8);
+    if (is_ipv4(mmdb) || hi & 1)
+        set_address(mmdb, a, AF_INET, ip);
+    else
+        set_address(mmdb, a, AF_INET6, ip);
+}
+
+typedef struct {
+    TMMDB_network_s *networks;
+    int count, capacity;
+} networks_s;
+
+static int collect_network(void *ctx, TMMDB_network_s const *network)
+{
+    networks_s *n = ctx;
+    if (n->count == n->capacity) {
+        n->capacity = n->capacity ? n->capacity * 2 : 1024;
+        n->networks = realloc(n->networks, n->capacity * sizeof(*n->networks));
+        if (!n->networks)
+            die("Out of memory\n");
+    }
+    n->networks[n->count++] = *network;
+    return TMMDB_SUCCESS;
+}
+
+// the hot addresses are random addresses inside networks with data, the
+// first is the most popular one
+static void hot_addresses(TMMDB_s * mmdb, address_s * hot, uint64_t seed)
+{
+    networks_s n = { 0 };
+    TMMDB_foreach_network(mmdb, collect_network, &n);
+    for (int i = 0; i < HOT_ADDRESSES; i++) {
+        if (!n.count) {
+            random_address(mmdb, &hot[i], &seed);
+            continue;
+        }
+        TMMDB_network_s *net = &n.networks[xorshift64(&seed) % n.count];
+        int bytes = is_ipv4(mmdb) ? 4 : 16;
+        uint8_t ip[16];
+        for (int b = 0; b < bytes; b++) {
+            int host_bits = (b + 1) * 8 - net->netmask;
+            uint8_t mask = host_bits <= 0 ? 0 : host_bits >= 8 ? 0xff
+                : (1 << host_bits) - 1;
+            ip[b] = (net->ip[b] & ~mask) | (xorshift64(&seed) & mask);
+        }
+        set_address(mmdb, &hot[i], bytes == 4 ? AF_INET : AF_INET6, ip);
+    }
+    free(n.networks);
+}
+
+// Zipf distribution with exponent s over the hot addresses, sampled with
+// the inverse of the cumulative distribution
+static void zipf_addresses(address_s * out, int count, address_s * hot,
+                           double s, uint64_t seed)
+{
+    double *cdf = malloc(HOT_ADDRESSES * sizeof(double)), sum = 0;
+    if (!cdf)
+        die("Out of memory\n");
+    for (int i = 0; i < HOT_ADDRESSES; i++)
+        cdf[i] = sum += 1 / pow(i + 1, s);
+    for (int i = 0; i < count; i++) {
+        double u = (xorshift64(&seed) >> 11) * 0x1.0p-53 * sum;
+        int lo = 0, hi = HOT_ADDRESSES - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] < u)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        out[i] = hot[lo];
+    }
+    free(cdf);
+}
+
+static address_list_s read_addresses(TMMDB_s * mmdb, const char *fname)
+{
+    address_list_s list = { 0 };
+    char line[256];
+    int capacity = 0;
+    FILE *fh = fopen(fname, "r");
+    if (!fh)
+        die("Can't open %s\n", fname);
+    while (fgets(line, sizeof(line), fh)) {
+        int len = strcspn(line, " \t\r\n");
+        if (!len || len >= INET6_ADDRSTRLEN)
+            continue;
+        if (list.count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            list.addresses = realloc(list.addresses,
+                                     capacity * sizeof(address_s));
+            if (!list.addresses)
+                die("Out of memory\n");
+        }
+        address_s *a = &list.addresses[list.count];
+        memcpy(a->text, line, len);
+        a->text[len] = '\0';
+        a->len = len;
+        if (TMMDB_parse_ip(mmdb, a->text, len, &a->ip) == TMMDB_SUCCESS)
+            list.count++;
+    }
+    fclose(fh);
+    return list;
+}
+
+static uint64_t run_one(TMMDB_s * mmdb, int workload, address_s * a)
+{
+    TMMDB_root_entry_s root = {.entry.mmdb = mmdb };
+    if (workload == PARSE
+        && TMMDB_parse_ip(mmdb, a->text, a->len, &a->ip) != TMMDB_SUCCESS)
+        return 0;
+    if (is_ipv4(mmdb))
+        TMMDB_lookup_by_ipnum(a->ip.v4, &root);
+    else
+        TMMDB_lookup_by_ipnum_128(a->ip.v6, &root);
+    if (!root.entry.offset)
+        return 0;
+
+    if (workload == VALUE) {
+        TMMDB_return_s res;
+        TMMDB_get_value(&root.entry, &res, "country", "names", "en", NULL);
+        return res.offset ? 2 : 1;
+    }
+    if (workload == HOT) {
+        // the same value as get_value from the TMMDB_build_hot_fields table
+        const TMMDB_return_s *row = TMMDB_hot_fields(&root.entry);
+        return row && row[0].offset ? 2 : 1;
+    }
+    if (workload == TREE) {
+        TMMDB_decode_all_s *decode_all;
+        TMMDB_get_tree(&root.entry, &decode_all);
+        TMMDB_free_decode_all(decode_all);
+    }
+    return 1;
+}
+
+static void *worker(void *arg)
+{
+    worker_s *w = arg;
+    pthread_barrier_wait(w->start);
+    double start = now_ns();
+    for (int i = 0; i < w->ops; i += BATCH) {
+        double t = now_ns();
+        for (int k = i; k < i + BATCH; k++)
+            w->found += run_one(w->mmdb, w->workload, &w->addresses[k]);
+        w->batch_ns[i / BATCH] = (now_ns() - t) / BATCH;
+    }
+    w->total_ns = now_ns() - start;
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// returns the ops/s per thread. scale is the throughput in threads of the
+// first -t run, base is their ops/s per thread or 0 in the first run. Lookups
+// share nothing writable, they should scale with the thread count up to the
+// number of cores.
+static double bench(const char *fname, TMMDB_s * mmdb, const char *input,
+                    int workload, address_s * addresses, int ops, int threads,
+                    double base)
+{
+    worker_s w[MAX_THREADS];
+    pthread_t tid[MAX_THREADS];
+    pthread_barrier_t start;
+    int batches = ops / BATCH;
+    double *batch_ns = malloc((size_t)batches * threads * sizeof(double));
+    if (!batch_ns)
+        die("Out of memory\n");
+
+    pthread_barrier_init(&start, NULL, threads);
+    for (int t = 0; t < threads; t++) {
+        w[t] = (worker_s) {.mmdb = mmdb,.workload = workload,
+            .addresses = addresses + (size_t)t * ops,.ops = ops,
+            .start = &start,.batch_ns = batch_ns + (size_t)t * batches
+        };
+        if (pthread_create(&tid[t], NULL, worker, &w[t]))
+            die("Can't start thread %d\n", t);
+    }
+    double wall = 0, ns = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tid[t], NULL);
+        ns += w[t].total_ns;
+        if (w[t].total_ns > wall)
+            wall = w[t].total_ns;
+    }
+    pthread_barrier_destroy(&start);
+
+    int n = batches * threads;
+    qsort(batch_ns, n, sizeof(double), cmp_double);
+    double total_ops = (double)ops * threads;
+    double per_thread = total_ops / wall * 1e9 / threads;
+    printf("%-24s %-8s %-9s %3d %8.1f %8.1f %8.1f %8.1f %12.0f %12.0f"
+           " %6.2f\n", fname, input, workload_names[workload], threads,
+           ns / total_ops, batch_ns[n / 2], batch_ns[n * 9 / 10],
+           batch_ns[n * 99 / 100], total_ops / wall * 1e9, per_thread,
+           per_thread * threads / (base ? base : per_thread));
+    fflush(stdout);
+    free(batch_ns);
+    return per_thread;
+}
+
+// TMMDB_OPT_* or'ed to the mode, -o
+static int open_flags = TMMDB_MODE_STANDARD;
+// a bit for every workload to run, -w
+static int workloads = (1 << NWORKLOADS) - 1;
+
+static void build_hot_fields(TMMDB_s * mmdb, const char *fname)
+{
+    const char *country_name[] = { "country", "names", "en", NULL };
+    TMMDB_query_s *query;
+    TMMDB_compile_query(&query, country_name);
+    int status = TMMDB_build_hot_fields(mmdb,
+                                        (TMMDB_query_s const *const *)&query,
+                                        1);
+    TMMDB_free_query(query);
+    if (status != TMMDB_SUCCESS)
+        die("Can't build the hot fields of %s ( %d )\n", fname, status);
+}
+
+static void bench_db(const char *fname, int ops, int *thread_counts,
+                     int nthreads, double zipf, const char *replay,
+                     uint64_t seed)
+{
+    TMMDB_s *mmdb;
+    int status = TMMDB_open(&mmdb, fname, open_flags);
+    if (status != TMMDB_SUCCESS)
+        die("Can't open %s ( %d )\n", fname, status);
+
+    int max_threads = 0;
+    for (int i = 0; i < nthreads; i++)
+        if (thread_counts[i] > max_threads)
+            max_threads = thread_counts[i];
+    size_t count = (size_t)ops * max_threads;
+    address_s *addresses = malloc(count * sizeof(address_s));
+    address_s *hot = malloc(HOT_ADDRESSES * sizeof(address_s));
+    if (!addresses || !hot)
+        die("Out of memory\n");
+    hot_addresses(mmdb, hot, seed);
+
+    address_list_s replayed = { 0 };
+    if (replay) {
+        replayed = read_addresses(mmdb, replay);
+        if (!replayed.count)
+            die("No addresses in %s\n", replay);
+    }
+
+    // hot_field runs last, once the table is built. The other workloads run
+    // without its build time and memory.
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            if (!(workloads & 1 << HOT))
+                break;
+            build_hot_fields(mmdb, fname);
+        }
+        for (int input = 0; input < NINPUTS; input++) {
+            uint64_t state = seed;
+            if (input == REPLAY && !replay)
+                continue;
+            // the same addresses for every workload and thread count
+            if (input == UNIFORM) {
+                for (size_t i = 0; i < count; i++)
+                    random_address(mmdb, &addresses[i], &state);
+            } else if (input == ZIPF) {
+                zipf_addresses(addresses, count, hot, zipf, seed);
+            } else {
+                for (size_t i = 0; i < count; i++)
+                    addresses[i] = replayed.addresses[i % replayed.count];
+            }
+            for (int workload = 0; workload < NWORKLOADS; workload++) {
+                if (!(workloads & 1 << workload) || (workload == HOT) != pass)
+                    continue;
+                double base = 0;
+                for (int i = 0; i < nthreads; i++) {
+                    double per_thread = bench(fname, mmdb, input_names[input],
+                                              workload, addresses, ops,
+                                              thread_counts[i], base);
+                    if (!i)
+                        base = per_thread;
+                }
+            }
+        }
+    }
+    free_list(addresses, hot, replayed.addresses);
+    TMMDB_close(mmdb);
+}
+
+int main(int argc, char *const argv[])
+{
+    int ops = 1000000;
+    int thread_counts[MAX_THREADS] = { 1 };
+    int nthreads = 1;
+    double zipf = 1.0;
+    uint64_t seed = 42;
+    char *replay = NULL;
+    int character;
+
+    while ((character = getopt(argc, argv, "n:t:z:s:r:o:w:")) != -1) {
+        switch (character) {
+        case 'n':
+            ops = atoi(optarg);
+            break;
+        case 't':
+            nthreads = 0;
+            for (char *p = optarg; *p && nthreads < MAX_THREADS;
+                 p += strspn(p, ","))
+                thread_counts[nthreads++] = strtol(p, &p, 10);
+            break;
+        case 'z':
+            zipf = atof(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'r':
+            replay = optarg;
+            break;
+        case 'o':
+            open_flags = strtol(optarg, NULL, 0);
+            break;
+        case 'w':
+            workloads = 0;
+            for (char *p = optarg; *p; p += strspn(p, ",")) {
+                size_t len = strcspn(p, ",");
+                int w = 0;
+                while (w < NWORKLOADS && (strlen(workload_names[w]) != len
+                                          || strncmp(p, workload_names[w],
+                                                     len)))
+                    w++;
+                if (w == NWORKLOADS)
+                    die("Unknown workload %.*s\n", (int)len, p);
+                workloads |= 1 << w;
+                p += len;
+            }
+            break;
+        default:
+        case '?':
+            die("Usage: %s [-n ops] [-t 1,2,4] [-z zipf] [-s seed] "
+                "[-r addresses] [-o open flags] [-w lookup,get_value,...] "
+                "database ...\n", argv[0]);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    ops = (ops + BATCH - 1) / BATCH * BATCH;
+    if (ops <= 0 || !seed)
+        die("-n and -s must be positive\n");
+    for (int i = 0; i < nthreads; i++)
+        if (thread_counts[i] < 1 || thread_counts[i] > MAX_THREADS)
+            die("-t must be 1 - %d\n", MAX_THREADS);
+
+    printf("%-24s %-8s %-9s %3s %8s %8s %8s %8s %12s %12s %6s\n",
+           "database", "input", "workload", "thr", "ns/op", "p50", "p90", "p99",
+           "ops/s", "ops/s/thread", "scale");
+    for (int i = 0; i < argc; i++)
+        bench_db(argv[i], ops, thread_counts, nthreads, zipf, replay, seed);
+    if (!argc)
+        bench_db(TMMDB_DEFAULT_DATABASE, ops, thread_counts, nthreads, zipf,
+                 replay, seed);
+    return (0);
+}
@@ -8,23 +8,69 @@
 #include <assert.h>
 #include <netdb.h>
 
+#define DUMP_MAX_THREADS (64)
+
+static void dump_usage(char *prg)
+{
+    die("Usage: %s [-v] [-j] -f database addr\n"
+        "       %s -f database -a [-t threads]\n", prg, prg);
+}
+
+// one line per network: network/netmask TAB record as JSON
+static int format_network(void *ctx, TMMDB_network_s const *network,
+                          TMMDB_buffer_s * out)
+{
+    TMMDB_s *mmdb = ctx;
+    char line[INET6_ADDRSTRLEN + 8];
+    inet_ntop(is_ipv4(mmdb) ? AF_INET : AF_INET6, network->ip, line,
+              sizeof(line));
+    int len = strlen(line);
+    len += snprintf(line + len, sizeof(line) - len, "/%d\t", network->netmask);
+    TMMDB_buffer_append(out, line, len);
+
+    TMMDB_entry_s entry = {.mmdb = mmdb,.offset = network->offset };
+    int err = TMMDB_record_to_json(&entry, out);
+    TMMDB_buffer_append(out, "\n", 1);
+    return err;
+}
+
+static int flush_networks(void *ctx, TMMDB_buffer_s * out)
+{
+    return fwrite(out->data, 1, out->len, stdout) == out->len
+        ? TMMDB_SUCCESS : TMMDB_IOERROR;
+}
+
 int main(int argc, char *const argv[])
 {
     int verbose = 0;
+    int json = 0;
+    int all = 0;
+    int threads = 4;
     int character;
     char *fname = NULL;
 
-    while ((character = getopt(argc, argv, "vf:")) != -1) {
+    while ((character = getopt(argc, argv, "vjat:f:")) != -1) {
         switch (character) {
         case 'v':
             verbose = 1;
             break;
+        case 'j':
+            json = 1;
+            break;
+        case 'a':
+            all = 1;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 1 || threads > DUMP_MAX_THREADS)
+                die("-t must be 1 - %d\n", DUMP_MAX_THREADS);
+            break;
         case 'f':
             fname = strdup(optarg);
             break;
         default:
         case '?':
-            usage(argv[0]);
+            dump_usage(argv[0]);
         }
     }
     argc -= optind;
@@ -47,6 +93,19 @@ int main(int argc, char *const argv[])
 
     free(fname);
 
+    if (all) {
+        // every network of the database, split into 2^16 parts
+        err = TMMDB_foreach_network_parallel(mmdb, threads, 16,
+                                             format_network, flush_networks,
+                                             mmdb);
+        if (err != TMMDB_SUCCESS) {
+            fprintf(stderr, "Export failed ( %d )\n", err);
+            exit(1);
+        }
+        TMMDB_close(mmdb);
+        return (0);
+    }
+
     char *ipstr = argv[0];
     union {
         struct in_addr v4;
@@ -73,14 +132,18 @@ int main(int argc, char *const argv[])
         : TMMDB_lookup_by_ipnum_128(ip.v6, &root);
 
     if (status == TMMDB_SUCCESS) {
-        if (root.entry.offset > 0) {
+        if (root.entry.offset > 0 && json) {
+            TMMDB_buffer_s buf = { 0 };
+            if (TMMDB_record_to_json(&root.entry, &buf) == TMMDB_SUCCESS)
+                puts(buf.data);
+            TMMDB_free_buffer(&buf);
+        } else if (root.entry.offset > 0) {
+            TMMDB_arena_s arena = { 0 };
             TMMDB_decode_all_s *decode_all;
-            int err = TMMDB_get_tree(&root.entry, &decode_all);
-            if (err == TMMDB_SUCCESS) {
-                if (decode_all != NULL)
-                    TMMDB_dump(mmdb, decode_all, 0);
-                TMMDB_free_decode_all(decode_all);
-            }
+            int err = TMMDB_get_tree_arena(&root.entry, &arena, &decode_all);
+            if (err == TMMDB_SUCCESS)
+                TMMDB_dump(mmdb, decode_all, 0);
+            TMMDB_free_arena(&arena);
 
         } else {
             puts("Sorry, nothing found");       // not found
@@ -0,0 +1,260 @@
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "tinymmdb.h"
+#include "tinymmdb_writer.h"
+#include "tinymmdb_helper.h"
+#include "getopt.h"
+
+// synthetic City like databases for scale tests. Every network points to
+// one of the city records, the city records point to the shared continent
+// and country records, the keys are written once and pointed to.
+
+#define CONTINENTS (7)
+#define COUNTRIES (250)
+
+static const char *languages[] =
+    { "de", "en", "es", "fr", "ja", "pt-BR", "ru", "zh-CN" };
+#define LANGUAGES ((int)(sizeof(languages) / sizeof(languages[0])))
+
+static const char *syllables[] = {
+    "ka", "lo", "mi", "ra", "ten", "bu", "ri", "sa", "no", "vel", "dor",
+    "an", "is", "ter", "burg", "ville", "ham", "ton", "sk", "grad"
+};
+#define SYLLABLES ((int)(sizeof(syllables) / sizeof(syllables[0])))
+
+static uint64_t seed = 42;
+
+static uint64_t next_random(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static void random_name(char *name, int size)
+{
+    int n = 2 + next_random() % 3, len = 0;
+    name[0] = '\0';
+    for (int i = 0; i < n; i++)
+        len += snprintf(name + len, size - len, "%s",
+                        syllables[next_random() % SYLLABLES]);
+    if (name[0] >= 'a' && name[0] <= 'z')
+        name[0] -= 'a' - 'A';
+}
+
+// names in every language, most of them the same like in the real thing
+static void write_names(TMMDB_writer_s * w, const char *name)
+{
+    char other[64];
+    TMMDB_writer_key(w, "names");
+    TMMDB_writer_map(w, LANGUAGES);
+    for (int i = 0; i < LANGUAGES; i++) {
+        TMMDB_writer_key(w, languages[i]);
+        if (next_random() % 4) {
+            TMMDB_writer_string(w, name);
+        } else {
+            random_name(other, sizeof(other));
+            TMMDB_writer_string(w, other);
+        }
+    }
+}
+
+static uint32_t write_place(TMMDB_writer_s * w, uint32_t geoname_id,
+                            const char *code)
+{
+    char name[64];
+    uint32_t offset = TMMDB_writer_map(w, code ? 3 : 2);
+    if (code) {
+        TMMDB_writer_key(w, "code");
+        TMMDB_writer_string(w, code);
+    }
+    TMMDB_writer_key(w, "geoname_id");
+    TMMDB_writer_uint(w, TMMDB_DTYPE_UINT32, geoname_id);
+    random_name(name, sizeof(name));
+    write_names(w, name);
+    return offset;
+}
+
+static uint32_t write_city(TMMDB_writer_s * w, uint32_t * continents,
+                           uint32_t * countries)
+{
+    char code[16];
+    int country = next_random() % COUNTRIES;
+    uint32_t offset = TMMDB_writer_map(w, 7);
+
+    TMMDB_writer_key(w, "city");
+    write_place(w, 1000000 + next_random() % 9000000, NULL);
+    TMMDB_writer_key(w, "continent");
+    TMMDB_writer_pointer(w, continents[country % CONTINENTS]);
+    TMMDB_writer_key(w, "country");
+    TMMDB_writer_pointer(w, countries[country]);
+
+    TMMDB_writer_key(w, "location");
+    TMMDB_writer_map(w, 4);
+    TMMDB_writer_key(w, "accuracy_radius");
+    TMMDB_writer_uint(w, TMMDB_DTYPE_UINT16, 1 + next_random() % 1000);
+    TMMDB_writer_key(w, "latitude");
+    TMMDB_writer_double(w, (next_random() % 18000000) / 100000.0 - 90);
+    TMMDB_writer_key(w, "longitude");
+    TMMDB_writer_double(w, (next_random() % 36000000) / 100000.0 - 180);
+    TMMDB_writer_key(w, "time_zone");
+    TMMDB_writer_key(w, next_random() % 2 ? "America/New_York"
+                     : "Europe/Berlin");
+
+    TMMDB_writer_key(w, "postal");
+    TMMDB_writer_map(w, 1);
+    TMMDB_writer_key(w, "code");
+    snprintf(code, sizeof(code), "%05u", (unsigned)(next_random() % 100000));
+    TMMDB_writer_string(w, code);
+
+    TMMDB_writer_key(w, "registered_country");
+    TMMDB_writer_pointer(w, countries[country]);
+
+    TMMDB_writer_key(w, "subdivisions");
+    TMMDB_writer_array(w, 1);
+    snprintf(code, sizeof(code), "%c%c", 'A' + (int)(next_random() % 26),
+             'A' + (int)(next_random() % 26));
+    TMMDB_writer_map(w, 3);
+    TMMDB_writer_key(w, "geoname_id");
+    TMMDB_writer_uint(w, TMMDB_DTYPE_UINT32, next_random() % 10000000);
+    TMMDB_writer_key(w, "iso_code");
+    TMMDB_writer_string(w, code);
+    random_name(code, sizeof(code));
+    write_names(w, code);
+    return offset;
+}
+
+static uint64_t pow2_floor(uint64_t v)
+{
+    uint64_t p = 1;
+    while (p <= v / 2)
+        p *= 2;
+    return p;
+}
+
+// count networks spread over bits of address space, starting at ip with
+// prefix bits already set. Only the first 64 bits are used.
+static void insert_networks(TMMDB_writer_s * w, uint8_t * ip, int prefix,
+                            int bits, uint64_t count, uint32_t * cities,
+                            int ncities)
+{
+    uint64_t space = bits == 64 ? UINT64_MAX : (1ULL << bits) - 1;
+    uint64_t span = space / count;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t block = pow2_floor(span / 2 ? span / 2 : 1)
+            >> (next_random() % 3);
+        if (!block)
+            block = 1;
+        uint64_t base = (i * span + block - 1) & ~(block - 1);
+        int host_bits = 0;
+        while ((1ULL << host_bits) < block)
+            host_bits++;
+        // base goes to the bits after prefix
+        for (int b = 0; b < bits; b++) {
+            int bit = prefix + b;
+            int v = base >> (bits - 1 - b) & 1;
+            ip[bit / 8] = (ip[bit / 8] & ~(0x80 >> bit % 8)) | v << (7 - bit % 8);
+        }
+        int err = TMMDB_writer_insert(w, ip, prefix + bits - host_bits,
+                                      cities[next_random() % ncities]);
+        if (err != TMMDB_SUCCESS)
+            die("Can't insert network %llu ( %d )\n", (unsigned long long)i,
+                err);
+    }
+}
+
+int main(int argc, char *const argv[])
+{
+    char *fname = NULL;
+    int ip_version = 4;
+    int record_size = 28;
+    long networks = 1000000;
+    int ncities = 100000;
+    int character;
+
+    while ((character = getopt(argc, argv, "6r:n:c:s:o:")) != -1) {
+        switch (character) {
+        case '6':
+            ip_version = 6;
+            break;
+        case 'r':
+            record_size = atoi(optarg);
+            break;
+        case 'n':
+            networks = atol(optarg);
+            break;
+        case 'c':
+            ncities = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            fname = optarg;
+            break;
+        default:
+        case '?':
+            die("Usage: %s -o database [-6] [-r 24|28|32] [-n networks] "
+                "[-c cities] [-s seed]\n", argv[0]);
+        }
+    }
+    if (!fname || networks < 1 || ncities < 1 || !seed)
+        die("Usage: %s -o database [-6] [-r 24|28|32] [-n networks] "
+            "[-c cities] [-s seed]\n", argv[0]);
+
+    TMMDB_writer_s *w;
+    if (TMMDB_writer_new(&w, ip_version, record_size) != TMMDB_SUCCESS)
+        die("-r must be 24, 28 or 32\n");
+
+    uint32_t continents[CONTINENTS], countries[COUNTRIES];
+    uint32_t *cities = malloc(ncities * sizeof(uint32_t));
+    if (!cities)
+        die("Out of memory\n");
+    static const char *continent_codes[CONTINENTS] =
+        { "AF", "AN", "AS", "EU", "NA", "OC", "SA" };
+    for (int i = 0; i < CONTINENTS; i++)
+        continents[i] = write_place(w, 6255146 + i, continent_codes[i]);
+    for (int i = 0; i < COUNTRIES; i++) {
+        char iso_code[3] = { 'A' + i / 26 % 26, 'A' + i % 26, 0 };
+        countries[i] = TMMDB_writer_map(w, 3);
+        TMMDB_writer_key(w, "geoname_id");
+        TMMDB_writer_uint(w, TMMDB_DTYPE_UINT32, 100000 + i);
+        TMMDB_writer_key(w, "iso_code");
+        TMMDB_writer_string(w, iso_code);
+        char name[64];
+        random_name(name, sizeof(name));
+        write_names(w, name);
+    }
+    for (int i = 0; i < ncities; i++)
+        cities[i] = write_city(w, continents, countries);
+
+    uint8_t ip[16] = { 0 };
+    if (ip_version == 4) {
+        insert_networks(w, ip, 0, 32, networks, cities, ncities);
+    } else {
+        // half of them IPv4 in ::/96, half in 2000::/3. The networks in
+        // 2002::/16 are replaced by the alias.
+        insert_networks(w, ip, 96, 32, (networks + 1) / 2, cities, ncities);
+        if (networks / 2) {
+            memset(ip, 0, sizeof(ip));
+            ip[0] = 0x20;
+            insert_networks(w, ip, 3, 61, networks / 2, cities, ncities);
+        }
+        if (TMMDB_writer_alias_ipv4(w) != TMMDB_SUCCESS)
+            die("Can't alias the IPv4 networks\n");
+    }
+
+    int err = TMMDB_writer_write(w, fname, ip_version == 4
+                                 ? "tinymmdb-City-v4" : "tinymmdb-City",
+                                 "synthetic City database");
+    if (err != TMMDB_SUCCESS)
+        die("Can't write %s ( %d )\n", fname, err);
+    fprintf(stderr, "%s: %ld networks, %u nodes\n", fname, networks,
+            TMMDB_writer_node_count(w));
+    TMMDB_writer_free(w);
+    free(cities);
+    return (0);
+}
@@ -7,24 +7,66 @@
 #include "getopt.h"
 #include <assert.h>
 #include <netdb.h>
+#include "bulk_lookup.h"
+
+static void lookup_usage(char *prg)
+{
+    die("Usage: %s [-v] -f database addr\n"
+        "       %s -f database -b [-t threads] [file ...]\n", prg, prg);
+}
+
+static int bulk_main(TMMDB_s * mmdb, int threads, int argc,
+                     char *const argv[])
+{
+    static char outbuf[1 << 20];
+    long invalid = 0;
+
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+    bulk_s *bulk = bulk_new(mmdb, threads, stdout);
+    if (argc == 0)
+        invalid += bulk_lookup(bulk, stdin, BULK_READ_SIZE);
+    for (int i = 0; i < argc; i++) {
+        FILE *fh = strcmp(argv[i], "-") ? fopen(argv[i], "r") : stdin;
+        if (!fh)
+            die("Can't open %s\n", argv[i]);
+        invalid += bulk_lookup(bulk, fh, BULK_READ_SIZE);
+        if (fh != stdin)
+            fclose(fh);
+    }
+    fflush(stdout);
+    bulk_free(bulk);
+    if (invalid)
+        fprintf(stderr, "%ld invalid addresses\n", invalid);
+    return 0;
+}
 
 int main(int argc, char *const argv[])
 {
     int verbose = 0;
+    int bulk = 0;
+    int threads = 1;
     int character;
     char *fname = NULL;
 
-    while ((character = getopt(argc, argv, "vf:")) != -1) {
+    while ((character = getopt(argc, argv, "vbt:f:")) != -1) {
         switch (character) {
         case 'v':
             verbose = 1;
             break;
+        case 'b':
+            bulk = 1;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 1 || threads > BULK_MAX_THREADS)
+                die("-t must be 1 - %d\n", BULK_MAX_THREADS);
+            break;
         case 'f':
             fname = strdup(optarg);
             break;
         default:
         case '?':
-            usage(argv[0]);
+            lookup_usage(argv[0]);
         }
     }
     argc -= optind;
@@ -43,6 +85,10 @@ int main(int argc, char *const argv[])
 
     free(fname);
 
+    // tab separated lines for the addresses in the files or stdin
+    if (bulk)
+        return bulk_main(mmdb, threads, argc, argv);
+
     char *ipstr = argv[0];
     union {
         struct in_addr v4;
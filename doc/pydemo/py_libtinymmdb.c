@@ -12,6 +12,7 @@ static PyObject *PyMMDBError;
 typedef struct {
     PyObject_HEAD               /* no semicolon */
     TMMDB_s * mmdb;
+    TMMDB_arena_s arena;        /* reused for every lookup */
 } TMMDB_MMDBObject;
 // Create a new Python MMDB object
 static PyObject *TMMDB_new_Py(PyObject * self, PyObject * args)
@@ -28,6 +29,7 @@ static PyObject *TMMDB_new_Py(PyObject * self, PyObject * args)
     if (!obj)
         return NULL;
 
+    memset(&obj->arena, 0, sizeof(obj->arena));
     int status = TMMDB_open(&obj->mmdb, filename, flags);
     if (status == TMMDB_SUCCESS && !obj->mmdb) {
         PyErr_SetString(PyMMDBError, "Can't create obj->mmdb object");
@@ -42,6 +44,7 @@ static void TMMDB_MMDB_dealloc(PyObject * self)
 {
     TMMDB_MMDBObject *obj = (TMMDB_MMDBObject *) self;
     TMMDB_close(obj->mmdb);
+    TMMDB_free_arena(&obj->arena);
     PyObject_Del(self);
 }
 
@@ -78,11 +81,9 @@ static PyObject *TMMDB_lookup_Py(PyObject * self, PyObject * args)
         status = TMMDB_lookup_by_ipnum_128(ip, &root);
         if (status == TMMDB_SUCCESS && root.entry.offset > 0) {
             TMMDB_decode_all_s *decode_all;
-            if (TMMDB_get_tree(&root.entry, &decode_all) == TMMDB_SUCCESS) {
-                PyObject *retval = mkobj(obj->mmdb, &decode_all);
-                TMMDB_free_decode_all(decode_all);
-                return retval;
-            }
+            if (TMMDB_get_tree_arena(&root.entry, &obj->arena, &decode_all)
+                == TMMDB_SUCCESS)
+                return mkobj(obj->mmdb, &decode_all);
         }
     }
     Py_RETURN_NONE;
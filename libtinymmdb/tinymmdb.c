@@ -2,14 +2,19 @@
 #include <sys/stat.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <stdint.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <errno.h>
 #include <assert.h>
+#include <limits.h>
 #include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
 #if HAVE_CONFIG_H
 # include <config.h>
 #endif
@@ -31,11 +36,17 @@ LOCAL void skip_hash_array(TMMDB_s * mmdb, TMMDB_decode_s * decode);
 
 LOCAL int get_tree(TMMDB_s * mmdb, uint32_t offset,
                    TMMDB_decode_all_s * decode);
-int TMMDB_vget_value(TMMDB_entry_s * start, TMMDB_return_s * result,
-                     va_list params);
-
 LOCAL TMMDB_decode_all_s *dump(TMMDB_s * mmdb, TMMDB_decode_all_s * decode_all,
                                int indent);
+LOCAL void free_record_cache(struct TMMDB_record_cache_s *cache);
+LOCAL void free_prefix_cache(TMMDB_s * mmdb);
+LOCAL void free_stats(TMMDB_s * mmdb);
+LOCAL void free_hot_fields(TMMDB_s * mmdb);
+LOCAL void free_range_table(TMMDB_s * mmdb);
+LOCAL void free_stride_trie(TMMDB_s * mmdb);
+LOCAL uint64_t get_uint64(const uint8_t * p);
+LOCAL int format_uint64(char *out, uint64_t v);
+LOCAL int format_uint128(char *out, const uint8_t * p);
 
 #if !defined HAVE_MEMMEM
 LOCAL void *memmem(const void *big, size_t big_len, const void *little,
@@ -72,6 +83,22 @@ LOCAL inline void *xmalloc(size_t size)
     return p;
 }
 
+LOCAL inline char *xstrdup(const char *str)
+{
+    char *p = strdup(str);
+    if (!p)
+        abort();
+    return p;
+}
+
+LOCAL inline void *xrealloc(void *ptr, size_t size)
+{
+    void *p = realloc(ptr, size);
+    if (!p)
+        abort();
+    return p;
+}
+
 int TMMDB_resolve_address(const char *host, int ai_family, int ai_flags,
                           void *ip)
 {
@@ -99,6 +126,117 @@ int TMMDB_resolve_address(const char *host, int ai_family, int ai_flags,
     return gaierr;
 }
 
+// dotted quad, every part 0 - 255 without leading zeros like inet_pton
+int TMMDB_parse_ipv4(const char *str, size_t len, uint32_t * ipnum)
+{
+    const char *end = str + len;
+    uint32_t ip = 0;
+    for (int part = 0; part < 4; part++) {
+        if (part && (str == end || *str++ != '.'))
+            return TMMDB_INVALIDARGUMENT;
+        const char *first = str;
+        uint32_t v = 0;
+        while (str < end && str - first < 3 && (unsigned)(*str - '0') < 10)
+            v = v * 10 + *str++ - '0';
+        if (str == first || v > 255 || (*first == '0' && str - first > 1))
+            return TMMDB_INVALIDARGUMENT;
+        ip = ip << 8 | v;
+    }
+    if (str != end)
+        return TMMDB_INVALIDARGUMENT;
+    *ipnum = ip;
+    return TMMDB_SUCCESS;
+}
+
+LOCAL int hex_digit(char c)
+{
+    if ((unsigned)(c - '0') < 10)
+        return c - '0';
+    c |= 0x20;
+    return (unsigned)(c - 'a') < 6 ? c - 'a' + 10 : -1;
+}
+
+// RFC 4291 text form, with one :: and an optional dotted quad at the end
+int TMMDB_parse_ipv6(const char *str, size_t len, struct in6_addr *ip)
+{
+    uint8_t out[16] = { 0 };
+    int words = 0, gap = -1;
+    size_t i = 0;
+    if (len >= 2 && str[0] == ':' && str[1] == ':') {
+        gap = 0;
+        i = 2;
+    }
+    while (i < len) {
+        size_t first = i;
+        uint32_t v = 0;
+        int d;
+        if (words == 8)
+            return TMMDB_INVALIDARGUMENT;
+        while (i < len && i - first < 5 && (d = hex_digit(str[i])) >= 0) {
+            v = v << 4 | d;
+            i++;
+        }
+        if (i < len && str[i] == '.') {
+            if (words > 6 || TMMDB_parse_ipv4(str + first, len - first, &v))
+                return TMMDB_INVALIDARGUMENT;
+            out[words * 2] = v >> 24;
+            out[words * 2 + 1] = v >> 16;
+            out[words * 2 + 2] = v >> 8;
+            out[words * 2 + 3] = v;
+            words += 2;
+            break;
+        }
+        if (i == first || i - first > 4)
+            return TMMDB_INVALIDARGUMENT;
+        out[words * 2] = v >> 8;
+        out[words * 2 + 1] = v;
+        words++;
+        if (i == len)
+            break;
+        if (str[i++] != ':' || i == len)
+            return TMMDB_INVALIDARGUMENT;
+        if (str[i] == ':') {
+            if (gap >= 0)
+                return TMMDB_INVALIDARGUMENT;
+            gap = words;
+            i++;
+        }
+    }
+    if (gap >= 0) {
+        if (words == 8)
+            return TMMDB_INVALIDARGUMENT;
+        int tail = (words - gap) * 2;
+        memmove(out + 16 - tail, out + gap * 2, tail);
+        memset(out + gap * 2, 0, 16 - tail - gap * 2);
+    } else if (words != 8) {
+        return TMMDB_INVALIDARGUMENT;
+    }
+    memcpy(ip->s6_addr, out, 16);
+    return TMMDB_SUCCESS;
+}
+
+// ip is a host order uint32_t for IPv4 databases and a struct in6_addr for
+// IPv6 databases. IPv4 addresses are mapped to ::ffff:a.b.c.d there.
+int TMMDB_parse_ip(TMMDB_s * mmdb, const char *str, size_t len, void *ip)
+{
+    if (mmdb->depth == 32)
+        return TMMDB_parse_ipv4(str, len, ip);
+    if (memchr(str, ':', len))
+        return TMMDB_parse_ipv6(str, len, ip);
+
+    uint32_t v4;
+    if (TMMDB_parse_ipv4(str, len, &v4) != TMMDB_SUCCESS)
+        return TMMDB_INVALIDARGUMENT;
+    uint8_t *p = ((struct in6_addr *)ip)->s6_addr;
+    memset(p, 0, 10);
+    p[10] = p[11] = 0xff;
+    p[12] = v4 >> 24;
+    p[13] = v4 >> 16;
+    p[14] = v4 >> 8;
+    p[15] = v4;
+    return TMMDB_SUCCESS;
+}
+
 LOCAL float get_ieee754_float(const uint8_t * restrict p)
 {
     volatile float f;
@@ -243,11 +381,19 @@ LOCAL void free_all(TMMDB_s * mmdb)
     if (mmdb) {
         if (mmdb->fname)
             free(mmdb->fname);
-        if (mmdb->file_in_mem_ptr)
-            munmap((void *)mmdb->file_in_mem_ptr, mmdb->size);
+        if (mmdb->mapped_size)
+            munmap((void *)mmdb->file_in_mem_ptr, mmdb->mapped_size);
         if (mmdb->fake_metadata_db) {
             free(mmdb->fake_metadata_db);
         }
+        if (mmdb->jump_table)
+            free(mmdb->jump_table);
+        free_record_cache(mmdb->record_cache);
+        free_prefix_cache(mmdb);
+        free_stats(mmdb);
+        free_hot_fields(mmdb);
+        free_range_table(mmdb);
+        free_stride_trie(mmdb);
         free((void *)mmdb);
     }
 }
@@ -266,261 +412,1527 @@ LOCAL void free_all(TMMDB_s * mmdb)
 #define RETURN_ON_END_OF_SEARCH128(offset,segments,depth, res) \
 	    RETURN_ON_END_OF_SEARCHX(offset,segments,depth,128, res)
 
-int TMMDB_lookup_by_ipnum_128(struct in6_addr ipnum,
-                              TMMDB_root_entry_s * result)
-{
-    TMMDB_s *mmdb = result->entry.mmdb;
+#if defined __GNUC__
+#define TMMDB_INLINE inline __attribute__ ((always_inline))
+#define TMMDB_PREFETCH(ptr) __builtin_prefetch((ptr), 0, 0)
+#else
+#define TMMDB_INLINE inline
+#define TMMDB_PREFETCH(ptr)
+#endif
 
-    int segments = mmdb->node_count;
-    uint32_t offset = 0;
-    int rl = mmdb->full_record_size_bytes;
-    const uint8_t *mem = mmdb->file_in_mem_ptr;
-    const uint8_t *p;
-    int depth;
-    if (rl == 6) {
-
-        for (depth = mmdb->depth - 1; depth >= 0; depth--) {
-            p = &mem[offset * rl];
-            if (TMMDB_CHKBIT_128(depth, (uint8_t *) & ipnum))
-                p += 3;
-            offset = get_uint24(p);
-            RETURN_ON_END_OF_SEARCH128(offset, segments, depth, result);
-        }
-    } else if (rl == 7) {
-        for (depth = mmdb->depth - 1; depth >= 0; depth--) {
-            p = &mem[offset * rl];
-            if (TMMDB_CHKBIT_128(depth, (uint8_t *) & ipnum)) {
-                p += 3;
-                offset = get_uint32(p);
-                offset &= 0xfffffff;
-            } else {
+// one unaligned big endian load
+LOCAL TMMDB_INLINE uint32_t load_uint32(const uint8_t * p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && defined __GNUC__
+    return __builtin_bswap32(v);
+#else
+    return ntohl(v);
+#endif
+}
 
-                offset =
-                    p[0] * 65536 + p[1] * 256 + p[2] + ((p[3] & 0xf0) << 20);
-            }
-            RETURN_ON_END_OF_SEARCH128(offset, segments, depth, result);
-        }
-    } else if (rl == 8) {
-        for (depth = mmdb->depth - 1; depth >= 0; depth--) {
-            p = &mem[offset * rl];
-            if (TMMDB_CHKBIT_128(depth, (uint8_t *) & ipnum))
-                p += 4;
-            offset = get_uint32(p);
-            RETURN_ON_END_OF_SEARCH128(offset, segments, depth, result);
+// read the left ( bit == 0 ) or right record of the node at p. Every caller
+// passes a constant record_bits, so only one case survives.
+// The 24 bit right record reads one byte past the node, there is always the
+// next node or the data section behind it.
+LOCAL TMMDB_INLINE uint32_t read_record(const uint8_t * p, int bit,
+                                        const int record_bits)
+{
+    switch (record_bits) {
+    case 24:
+        return load_uint32(p + 3 * bit) >> 8;
+    case 28:
+        {
+            if (bit)
+                return load_uint32(p + 3) & 0xfffffff;
+            uint32_t v = load_uint32(p);
+            return (v >> 8) | ((v & 0xf0) << 20);
         }
+    default:
+        return load_uint32(p + 4 * bit);
+    }
+}
+
+// read a record for the record size rl. For the slow paths only.
+LOCAL uint32_t get_record(const uint8_t * p, int rl, int bit)
+{
+    return rl == 6 ? read_record(p, bit, 24)
+        : rl == 7 ? read_record(p, bit, 28) : read_record(p, bit, 32);
+}
+
+// bit depth of ip. IPv4 addresses ( width 32 ) are uint32_t in host order,
+// IPv6 addresses are 16 bytes in network order.
+LOCAL TMMDB_INLINE int addr_bit(const void *ip, int depth, const int width)
+{
+    if (width == 32)
+        return (*(const uint32_t *)ip >> depth) & 1;
+    return (((const uint8_t *)ip)[(127 - depth) >> 3] >> (depth & 7)) & 1;
+}
+
+// the jump table maps the first jump_bits bits of the search to the node
+// reached at that depth or to the record where the search ends earlier.
+struct TMMDB_jump_s {
+    uint32_t record;
+    uint32_t bits;              /* bits consumed to reach record */
+};
+
+// returns the number of bits consumed, *offset is the node to continue with
+// or the final record. top contains the next 32 bits of the search.
+LOCAL TMMDB_INLINE int jump(TMMDB_s * mmdb, uint32_t top, uint32_t * offset)
+{
+    const struct TMMDB_jump_s *j =
+        &mmdb->jump_table[top >> (32 - mmdb->jump_bits)];
+    *offset = j->record;
+    return j->bits;
+}
+
+// first 32 bits of the search starting at the bit depth - 1
+LOCAL TMMDB_INLINE uint32_t top_bits_128(TMMDB_s * mmdb, const uint8_t * ip)
+{
+    return load_uint32(ip + ((128 - mmdb->depth) >> 3));
+}
+
+// ::/96 and for most databases ::ffff:0:0/96 too
+LOCAL TMMDB_INLINE int is_ipv4_part(TMMDB_s * mmdb, const uint8_t * ip)
+{
+    if (load_uint32(ip) || load_uint32(ip + 4))
+        return 0;
+    uint32_t w = load_uint32(ip + 8);
+    return w == 0 || (w == 0xffff && mmdb->ipv4_mapped_alias);
+}
+
+// find the start for the search of ip. Returns the number of bits consumed,
+// *offset is the node to continue with or the final record.
+LOCAL TMMDB_INLINE int start_128(TMMDB_s * mmdb, const uint8_t * ip,
+                                 uint32_t * offset)
+{
+    if (mmdb->ipv4_start_bits && is_ipv4_part(mmdb, ip)) {
+        *offset = mmdb->ipv4_start_node;
+        return mmdb->ipv4_start_bits;
+    }
+    if (mmdb->jump_table)
+        return jump(mmdb, top_bits_128(mmdb, ip), offset);
+    *offset = 0;
+    return 0;
+}
+
+// continue the search for ip at node offset with bit depth
+LOCAL TMMDB_INLINE int walk(TMMDB_s * mmdb, uint32_t offset, int depth,
+                            const void *ip, TMMDB_root_entry_s * res,
+                            const int record_bits, const int width)
+{
+    const int rl = record_bits / 4;
+    const uint8_t *mem = mmdb->file_in_mem_ptr;
+    uint32_t segments = mmdb->node_count;
+    for (; depth >= 0; depth--) {
+        offset = read_record(&mem[offset * rl], addr_bit(ip, depth, width),
+                             record_bits);
+        RETURN_ON_END_OF_SEARCHX(offset, segments, depth, width, res);
     }
     //uhhh should never happen !
     return TMMDB_CORRUPTDATABASE;
 }
 
-int TMMDB_lookup_by_ipnum(uint32_t ipnum, TMMDB_root_entry_s * res)
-{
-    TMMDB_s *mmdb = res->entry.mmdb;
+// number of tree walks interleaved by the batch lookups. Each step of a walk
+// is a dependent load, so we advance all lanes by one node and prefetch the
+// next node of every lane before we come back to it.
+#define TMMDB_LOOKUP_LANES (8)
 
-    TMMDB_DBG_CARP("TMMDB_lookup_by_ipnum{mmdb} depth:%d node_count:%d\n",
-                   mmdb->depth, mmdb->node_count);
-    TMMDB_DBG_CARP("TMMDB_lookup_by_ipnum ip:%u\n", ipnum);
+typedef struct {
+    int idx;                    /* index into the input/result array */
+    int depth;                  /* next bit to test */
+    uint32_t offset;            /* current node */
+} lookup_lane_s;
 
-    int segments = mmdb->node_count;
-    uint32_t offset = 0;
-    int rl = mmdb->full_record_size_bytes;
+// start the search for the address idx in lane l
+LOCAL TMMDB_INLINE void lane_start(TMMDB_s * mmdb, lookup_lane_s * l, int idx,
+                                   const uint8_t * ips, const int width)
+{
+    l->idx = idx;
+    l->offset = 0;
+    if (width == 32) {
+        l->depth = 32 - 1;
+        if (mmdb->jump_table)
+            l->depth -= jump(mmdb, ((const uint32_t *)ips)[idx], &l->offset);
+    } else {
+        l->depth = mmdb->depth - 1;
+        l->depth -= start_128(mmdb, ips + idx * 16, &l->offset);
+    }
+}
+
+LOCAL TMMDB_INLINE int walk_many(TMMDB_s * mmdb, const uint8_t * ips,
+                                 int count, TMMDB_root_entry_s * res,
+                                 const int record_bits, const int width)
+{
+    lookup_lane_s lane[TMMDB_LOOKUP_LANES];
+    const int rl = record_bits / 4;
+    uint32_t segments = mmdb->node_count;
     const uint8_t *mem = mmdb->file_in_mem_ptr;
-    const uint8_t *p;
-    uint32_t mask = 0x80000000U;
-    int depth;
-    if (rl == 6) {
-        for (depth = 32 - 1; depth >= 0; depth--, mask >>= 1) {
-            p = &mem[offset * rl];
-            if (ipnum & mask)
-                p += 3;
-            offset = get_uint24(p);
-            RETURN_ON_END_OF_SEARCH32(offset, segments, depth, res);
-        }
-    } else if (rl == 7) {
-        for (depth = 32 - 1; depth >= 0; depth--, mask >>= 1) {
-            p = &mem[offset * rl];
-            if (ipnum & mask) {
-                p += 3;
-                offset = get_uint32(p);
-                offset &= 0xfffffff;
+    int err = TMMDB_SUCCESS;
+    int next = 0, active = 0;
+
+    for (; active < TMMDB_LOOKUP_LANES && next < count; active++)
+        lane_start(mmdb, &lane[active], next++, ips, width);
+
+    while (active > 0) {
+        for (int i = 0; i < active;) {
+            lookup_lane_s *l = &lane[i];
+            if (l->offset >= segments || l->depth < 0) {
+                TMMDB_root_entry_s *r = &res[l->idx];
+                r->entry.mmdb = mmdb;
+                if (l->offset >= segments) {
+                    r->netmask = width - (l->depth + 1);
+                    r->entry.offset = l->offset - segments;
+                } else {
+                    //uhhh should never happen !
+                    r->netmask = 0;
+                    r->entry.offset = 0;
+                    err = TMMDB_CORRUPTDATABASE;
+                }
+                // refill the lane or drop it
+                if (next < count) {
+                    lane_start(mmdb, l, next++, ips, width);
+                } else {
+                    *l = lane[--active];
+                    continue;
+                }
             } else {
-                offset =
-                    p[0] * 65536 + p[1] * 256 + p[2] + ((p[3] & 0xf0) << 20);
+                int bit = addr_bit(ips + l->idx * (width / 8), l->depth, width);
+                l->offset = read_record(&mem[l->offset * rl], bit, record_bits);
+                l->depth--;
+                if (l->offset < segments)
+                    TMMDB_PREFETCH(&mem[l->offset * rl]);
             }
-            RETURN_ON_END_OF_SEARCH32(offset, segments, depth, res);
-        }
-    } else if (rl == 8) {
-        for (depth = 32 - 1; depth >= 0; depth--, mask >>= 1) {
-            p = &mem[offset * rl];
-            if (ipnum & mask)
-                p += 4;
-            offset = get_uint32(p);
-            RETURN_ON_END_OF_SEARCH32(offset, segments, depth, res);
+            i++;
         }
     }
-    //uhhh should never happen !
-    return TMMDB_CORRUPTDATABASE;
+    return err;
 }
 
-LOCAL int init(TMMDB_s * mmdb, const char *fname, uint32_t flags)
+// the lookup functions for one record size, bound to the database in init()
+struct TMMDB_walker_s {
+    int (*walk32) (TMMDB_s * mmdb, uint32_t offset, int depth, uint32_t ipnum,
+                   TMMDB_root_entry_s * res);
+    int (*walk128) (TMMDB_s * mmdb, uint32_t offset, int depth,
+                    const uint8_t * ip, TMMDB_root_entry_s * res);
+    int (*many) (TMMDB_s * mmdb, const uint8_t * ips, int count,
+                 TMMDB_root_entry_s * res, int width);
+};
+
+#define DEFINE_WALKERS(bits)                                                  \
+LOCAL int walk32_##bits(TMMDB_s * mmdb, uint32_t offset, int depth,           \
+                        uint32_t ipnum, TMMDB_root_entry_s * res)             \
+{                                                                             \
+    return walk(mmdb, offset, depth, &ipnum, res, bits, 32);                  \
+}                                                                             \
+LOCAL int walk128_##bits(TMMDB_s * mmdb, uint32_t offset, int depth,          \
+                         const uint8_t * ip, TMMDB_root_entry_s * res)        \
+{                                                                             \
+    return walk(mmdb, offset, depth, ip, res, bits, 128);                     \
+}                                                                             \
+LOCAL int many_##bits(TMMDB_s * mmdb, const uint8_t * ips, int count,         \
+                      TMMDB_root_entry_s * res, int width)                    \
+{                                                                             \
+    return width == 32 ? walk_many(mmdb, ips, count, res, bits, 32)           \
+        : walk_many(mmdb, ips, count, res, bits, 128);                        \
+}
+
+DEFINE_WALKERS(24)
+DEFINE_WALKERS(28)
+DEFINE_WALKERS(32)
+
+LOCAL const struct TMMDB_walker_s walkers[] = {
+    {walk32_24, walk128_24, many_24},
+    {walk32_28, walk128_28, many_28},
+    {walk32_32, walk128_32, many_32}
+};
+
+LOCAL int lookup_128(TMMDB_s * mmdb, const uint8_t * ip,
+                     TMMDB_root_entry_s * result)
 {
-    struct stat s;
-    uint8_t *ptr;
-    ssize_t size;
-    off_t offset;
-    mmdb->fname = strdup(fname);
-    if (mmdb->fname == NULL)
-        return TMMDB_OUTOFMEMORY;
-    int fd = open(fname, O_RDONLY);
+    uint32_t offset;
+    int depth = mmdb->depth - 1;
+    depth -= start_128(mmdb, ip, &offset);
+    RETURN_ON_END_OF_SEARCH128(offset, mmdb->node_count, depth + 1, result);
+    return mmdb->walker->walk128(mmdb, offset, depth, ip, result);
+}
 
-    if (fd < 0)
-        return TMMDB_OPENFILEERROR;
-    fstat(fd, &s);
-    mmdb->flags = flags;
-    mmdb->size = size = s.st_size;
-    offset = 0;
-    ptr = mmdb->meta_data_content =
-        mmap(NULL, size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
-    close(fd);
-    if (ptr == MAP_FAILED)
-        return TMMDB_INVALIDDATABASE;
+LOCAL int lookup_32(TMMDB_s * mmdb, uint32_t ipnum, TMMDB_root_entry_s * res)
+{
+    TMMDB_DBG_CARP("TMMDB_lookup_by_ipnum{mmdb} depth:%d node_count:%d\n",
+                   mmdb->depth, mmdb->node_count);
+    TMMDB_DBG_CARP("TMMDB_lookup_by_ipnum ip:%u\n", ipnum);
 
-    int max_metasize = size > 4096 ? 4096 : size;
-    const uint8_t *metadata = memmem(ptr + size - max_metasize, max_metasize,
-                                     "\xab\xcd\xefMaxMind.com", 14);
-    if (metadata == NULL) {
-        mmdb->meta_data_content = NULL;
-        return TMMDB_INVALIDDATABASE;
+    uint32_t offset = 0;
+    int depth = 32 - 1;
+    if (mmdb->jump_table) {
+        depth -= jump(mmdb, ipnum, &offset);
+        RETURN_ON_END_OF_SEARCH32(offset, mmdb->node_count, depth + 1, res);
     }
+    return mmdb->walker->walk32(mmdb, offset, depth, ipnum, res);
+}
 
-    mmdb->fake_metadata_db = xcalloc(1, sizeof(struct TMMDB_s));
-    mmdb->fake_metadata_db->dataptr = metadata + 14;
-    mmdb->meta.mmdb = mmdb->fake_metadata_db;
+// IPv4 search in the IPv4 subtree of an IPv6 database
+LOCAL int lookup_v4(TMMDB_s * mmdb, uint32_t ipnum, TMMDB_root_entry_s * res)
+{
+    uint32_t offset = mmdb->ipv4_start_node;
+    // the whole IPv4 space is in one network
+    RETURN_ON_END_OF_SEARCH32(offset, mmdb->node_count, 32, res);
+    return mmdb->walker->walk32(mmdb, offset, 32 - 1, ipnum, res);
+}
 
-    // we can't fail with ioerror's here. It is a memory operation
-    mmdb->major_file_format =
-        get_uint_value(&mmdb->meta, KEYS("binary_format_major_version"));
+#if defined __GNUC__
+#define ATOMIC_LOAD(p, order) __atomic_load_n((p), __ATOMIC_##order)
+#define ATOMIC_STORE(p, v, order) __atomic_store_n((p), (v), __ATOMIC_##order)
+#define ATOMIC_CAS(p, expect, v) \
+    __atomic_compare_exchange_n((p), (expect), (v), 0, __ATOMIC_ACQ_REL, \
+                                __ATOMIC_RELAXED)
+#else
+/* single threaded only */
+#define ATOMIC_LOAD(p, order) (*(p))
+#define ATOMIC_STORE(p, v, order) (*(p) = (v))
+#define ATOMIC_CAS(p, expect, v) (*(p) == *(expect) ? (*(p) = (v), 1) : 0)
+#endif
 
-    mmdb->minor_file_format =
-        get_uint_value(&mmdb->meta, KEYS("binary_format_minor_version"));
+// counters for TMMDB_enable_stats. Every thread counts in its own slot,
+// TMMDB_stats_snapshot adds them up. Without --enable-stats the STATS_
+// macros are empty and nothing is counted.
+struct TMMDB_stats_slot_s {
+    TMMDB_stats_s counters;
+    pthread_t owner;
+    struct TMMDB_stats_slot_s *next;
+};
 
-    // looks like the dataabase_type is the info string.
-    // mmdb->database_type = get_uint_value(&meta, KEYS("database_type"));
-    mmdb->full_record_size_bytes =
-        get_uint_value(&mmdb->meta, KEYS("record_size")) * 2 / 8U;
-    mmdb->node_count = get_uint_value(&mmdb->meta, KEYS("node_count"));
+struct TMMDB_stats_head_s {
+    uint64_t id;                /* tells the thread local cache apart */
+    struct TMMDB_stats_slot_s *slots;
+};
 
-    // unfortunately we must guess the depth of the database
-    mmdb->depth =
-        get_uint_value(&mmdb->meta, KEYS("ip_version")) == 4 ? 32 : 128;
+#if TMMDB_STATS
+static uint64_t stats_next_id;
+static __thread struct {
+    uint64_t id;
+    struct TMMDB_stats_slot_s *slot;
+} stats_tls;
 
-    mmdb->file_in_mem_ptr = ptr;
-    mmdb->dataptr =
-        mmdb->file_in_mem_ptr + mmdb->node_count * mmdb->full_record_size_bytes;
+// the slot of the calling thread, the first call of a thread adds it
+LOCAL struct TMMDB_stats_slot_s *stats_slot(struct TMMDB_stats_head_s *head)
+{
+    if (stats_tls.id == head->id)
+        return stats_tls.slot;
+    pthread_t self = pthread_self();
+    struct TMMDB_stats_slot_s *slot = ATOMIC_LOAD(&head->slots, ACQUIRE);
+    while (slot && !pthread_equal(slot->owner, self))
+        slot = slot->next;
+    if (!slot) {
+        slot = xcalloc(1, sizeof(struct TMMDB_stats_slot_s));
+        slot->owner = self;
+        slot->next = ATOMIC_LOAD(&head->slots, RELAXED);
+        while (!ATOMIC_CAS(&head->slots, &slot->next, slot)) ;
+    }
+    stats_tls.id = head->id;
+    stats_tls.slot = slot;
+    return slot;
+}
 
-    // Success - but can we handle the data?
-    if (mmdb->major_file_format != 2) {
-        return TMMDB_UNKNOWNDATABASEFMT;
+// only the owner writes a slot, the snapshot reads them while they change
+#define STATS_ADD(mmdb, field, n) do { \
+    if ((mmdb)->stats) { \
+        uint64_t *c_ = &stats_slot((mmdb)->stats)->counters.field; \
+        ATOMIC_STORE(c_, ATOMIC_LOAD(c_, RELAXED) + (n), RELAXED); \
+    } } while (0)
+
+LOCAL uint64_t stats_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+LOCAL void stats_lookups(TMMDB_s * mmdb, uint64_t start,
+                         TMMDB_root_entry_s const *res, int count)
+{
+    TMMDB_stats_s *c = &stats_slot(mmdb->stats)->counters;
+    uint64_t ns = count ? (stats_clock() - start) / count : 0;
+    int bucket = 0;
+    while (ns > 1 && bucket < TMMDB_STATS_LATENCY_BUCKETS - 1)
+        ns >>= 1, bucket++;
+    ATOMIC_STORE(&c->lookups, c->lookups + count, RELAXED);
+    ATOMIC_STORE(&c->latency[bucket], c->latency[bucket] + count, RELAXED);
+    for (int i = 0; i < count; i++) {
+        int depth = res[i].netmask > 128 ? 128 : res[i].netmask;
+        ATOMIC_STORE(&c->depth[depth], c->depth[depth] + 1, RELAXED);
     }
+}
+
+#define STATS_LOOKUP_BEGIN(mmdb) \
+    uint64_t stats_start_ = (mmdb)->stats ? stats_clock() : 0
+#define STATS_LOOKUP_END(mmdb, res, count) do { \
+    if ((mmdb)->stats) \
+        stats_lookups((mmdb), stats_start_, (res), (count)); \
+    } while (0)
+#else
+#define STATS_ADD(mmdb, field, n) do { } while (0)
+#define STATS_LOOKUP_BEGIN(mmdb) do { } while (0)
+#define STATS_LOOKUP_END(mmdb, res, count) do { } while (0)
+#endif
 
+// TMMDB_INVALIDARGUMENT unless built with --enable-stats
+int TMMDB_enable_stats(TMMDB_s * mmdb)
+{
+#if TMMDB_STATS
+    if (!mmdb->stats) {
+        mmdb->stats = xcalloc(1, sizeof(struct TMMDB_stats_head_s));
+        mmdb->stats->id = __atomic_add_fetch(&stats_next_id, 1,
+                                             __ATOMIC_RELAXED);
+    }
     return TMMDB_SUCCESS;
+#else
+    return TMMDB_INVALIDARGUMENT;
+#endif
 }
 
-int TMMDB_open(TMMDB_s ** mmdbptr, const char *fname, uint32_t flags)
+// the sum over all threads, TMMDB_INVALIDARGUMENT if stats are not enabled
+int TMMDB_stats_snapshot(TMMDB_s * mmdb, TMMDB_stats_s * stats)
 {
-    TMMDB_DBG_CARP("TMMDB_open %s %d\n", fname, flags);
-    TMMDB_s *mmdb = *mmdbptr = xcalloc(1, sizeof(TMMDB_s));
-    int err = init(mmdb, fname, flags);
-    if (err != TMMDB_SUCCESS) {
-        free_all(mmdb);
-        *mmdbptr = NULL;
+    memset(stats, 0, sizeof(TMMDB_stats_s));
+    if (!mmdb->stats)
+        return TMMDB_INVALIDARGUMENT;
+    struct TMMDB_stats_slot_s *slot = ATOMIC_LOAD(&mmdb->stats->slots, ACQUIRE);
+    for (; slot; slot = slot->next) {
+        const uint64_t *from = (const uint64_t *)&slot->counters;
+        uint64_t *to = (uint64_t *) stats;
+        for (size_t i = 0; i < sizeof(TMMDB_stats_s) / sizeof(uint64_t); i++)
+            to[i] += ATOMIC_LOAD(&from[i], RELAXED);
     }
-    return err;
+    return TMMDB_SUCCESS;
 }
 
-void TMMDB_close(TMMDB_s * mmdb)
+LOCAL void free_stats(TMMDB_s * mmdb)
 {
-    if (mmdb) {
-        free_all(mmdb);
+    if (!mmdb->stats)
+        return;
+    struct TMMDB_stats_slot_s *slot = mmdb->stats->slots;
+    while (slot) {
+        struct TMMDB_stats_slot_s *next = slot->next;
+        free(slot);
+        slot = next;
     }
+    free(mmdb->stats);
+    mmdb->stats = NULL;
 }
 
-/* return the result of any uint type with 32 bit's or less as uint32 */
-uint32_t TMMDB_get_uint(TMMDB_return_s const *const result)
+// the IPv4 networks of the tree as sorted ranges, for TMMDB_build_range_table.
+// The starts are in Eytzinger order, starts[1] is the median, the children
+// of k are 2k and 2k + 1. The first levels of the search share a few cache
+// lines and the search has no unpredictable branches.
+struct TMMDB_range_table_s {
+    uint32_t count;
+    uint32_t *starts;           /* 1 based, 64 byte aligned */
+    uint32_t *offsets;          /* entry.offset of starts[k] */
+    uint8_t *netmasks;          /* netmask of starts[k] */
+};
+
+#if defined __GNUC__
+#define PREFETCH(p) __builtin_prefetch(p)
+#define CTZ64(v) __builtin_ctzll(v)
+#define POPCOUNT64(v) __builtin_popcountll(v)
+#else
+#define PREFETCH(p)
+LOCAL int CTZ64(uint64_t v)
 {
-    return result->uinteger;
+    int n = 0;
+    while (!(v & 1))
+        v >>= 1, n++;
+    return n;
 }
 
-int TMMDB_get_value(TMMDB_entry_s * start, TMMDB_return_s * result, ...)
+LOCAL int POPCOUNT64(uint64_t v)
 {
-    va_list keys;
-    va_start(keys, result);
-    int ioerror = TMMDB_vget_value(start, result, keys);
-    va_end(keys);
-    return ioerror;
+    int n = 0;
+    for (; v; v &= v - 1)
+        n++;
+    return n;
 }
+#endif
 
-LOCAL uint32_t get_uint_value(TMMDB_entry_s * start, ...)
+LOCAL TMMDB_INLINE void range_lookup(const struct TMMDB_range_table_s *t,
+                                     uint32_t ipnum, TMMDB_root_entry_s * res)
 {
-    TMMDB_return_s result;
-    va_list params;
-    va_start(params, start);
-    TMMDB_vget_value(start, &result, params);
-    va_end(params);
-    return TMMDB_get_uint(&result);
+    const uint32_t *starts = t->starts;
+    uint64_t k = 1;
+    while (k <= t->count) {
+        // the 16 grandchildren 4 levels down are one cache line
+        PREFETCH(starts + 16 * k);
+        k = 2 * k + (starts[k] <= ipnum);
+    }
+    // the last node the search went right at has the greatest start
+    // <= ipnum. There is one, the first range starts at 0.
+    k >>= CTZ64(k) + 1;
+    res->entry.offset = t->offsets[k];
+    res->netmask = t->netmasks[k];
 }
 
-LOCAL void decode_one(TMMDB_s * mmdb, uint32_t offset, TMMDB_decode_s * decode)
-{
+// the tree as a multibit trie, for TMMDB_build_stride_trie. A table for the
+// first top_bits bits, then nodes of STRIDE bits compressed like Poptrie:
+// one bit per entry for the entries with a child node, one for the entries
+// that start a new run of equal leaves. The children of a node and its
+// leaves are consecutive, a popcount finds them.
+#define STRIDE (6)
+#define STRIDE_LEAF (0x80000000U)   /* in top entries */
+#define STRIDE_IPV4 (0xffffffffU)   /* leaf offset, continue in the v4 trie */
 
-    const uint8_t *mem = mmdb->dataptr;
-    uint8_t ctrl;
-    int type;
-    decode->data.offset = offset;
-    ctrl = mem[offset++];
-    type = (ctrl >> 5) & 7;
-    if (type == TMMDB_DTYPE_EXT)
-        type = get_ext_type(mem[offset++]);
+struct stride_node_s {
+    uint64_t children;          /* bit i: entry i is a child node */
+    uint64_t leaves;            /* bit i: entry i starts a run of leaves */
+    uint32_t child_base;
+    uint32_t leaf_base;
+};
 
-    // TMMDB_DBG_CARP("decode_one type:%d\n", type);
+struct stride_leaf_s {
+    uint32_t offset;            /* entry.offset or STRIDE_IPV4 */
+    uint32_t netmask;           /* or the depth of the IPv4 subtree */
+};
 
-    decode->data.type = type;
+struct stride_trie_s {
+    uint32_t *top;              /* node index or STRIDE_LEAF | leaf index */
+    struct stride_node_s *nodes;
+    uint32_t node_count, node_capacity;
+    struct stride_leaf_s *leaves;
+    uint32_t leaf_count, leaf_capacity;
+};
 
-    if (type == TMMDB_DTYPE_PTR) {
-        int psize = (ctrl >> 3) & 3;
-        decode->data.uinteger = get_ptr_from(ctrl, &mem[offset], psize);
-        decode->data.data_size = psize + 1;
-        decode->offset_to_next = offset + psize + 1;
-        TMMDB_DBG_CARP
-            ("decode_one{ptr} ctrl:%d, offset:%d psize:%d point_to:%d\n", ctrl,
-             offset, psize, decode->data.uinteger);
-        return;
-    }
+// IPv6 databases have a second trie for the IPv4 subtree, that ::/96,
+// ::ffff:0:0/96 and 2002::/16 share.
+struct TMMDB_stride_s {
+    int top_bits;
+    struct stride_trie_s main;
+    struct stride_trie_s v4;
+};
 
-    int size = ctrl & 31;
-    switch (size) {
-    case 29:
-        size = 29 + mem[offset++];
-        break;
-    case 30:
-        size = 285 + get_uint16(&mem[offset]);
-        offset += 2;
-        break;
-    case 31:
-        size = 65821 + get_uint24(&mem[offset]);
-        offset += 3;
-    default:
-        break;
-    }
+// STRIDE bits of the address w at bit depth, zero behind the address
+LOCAL TMMDB_INLINE uint32_t stride_bits(const uint64_t * w, int depth)
+{
+    if (depth >= 128)
+        return 0;
+    int i = depth >> 6, o = depth & 63;
+    uint64_t v = w[i] << o;
+    if (o > 64 - STRIDE && i == 0)
+        v |= w[1] >> (64 - o);
+    return v >> (64 - STRIDE);
+}
 
-    if (type == TMMDB_DTYPE_MAP || type == TMMDB_DTYPE_ARRAY) {
-        decode->data.data_size = size;
-        decode->offset_to_next = offset;
-        TMMDB_DBG_CARP("decode_one type:%d size:%d\n", type, size);
-        return;
+LOCAL TMMDB_INLINE const struct stride_leaf_s *stride_find(const struct
+                                                           stride_trie_s *t,
+                                                           int top_bits,
+                                                           const uint64_t * w)
+{
+    uint32_t e = t->top[w[0] >> (64 - top_bits)];
+    int depth = top_bits;
+    while (!(e & STRIDE_LEAF)) {
+        const struct stride_node_s *n = &t->nodes[e];
+        uint64_t upto = (2ULL << stride_bits(w, depth)) - 1;
+        if (n->children & upto & ~(upto >> 1))
+            e = n->child_base + POPCOUNT64(n->children & upto) - 1;
+        else
+            e = STRIDE_LEAF | (n->leaf_base + POPCOUNT64(n->leaves & upto)
+                               - 1);
+        depth += STRIDE;
     }
+    return &t->leaves[e & ~STRIDE_LEAF];
+}
 
-    if (type == TMMDB_DTYPE_BOOLEAN) {
+LOCAL TMMDB_INLINE void stride_lookup_v4(const struct TMMDB_stride_s *st,
+                                         const struct stride_trie_s *t,
+                                         uint32_t ipnum, int depth,
+                                         TMMDB_root_entry_s * res)
+{
+    uint64_t w[2] = { (uint64_t) ipnum << 32, 0 };
+    const struct stride_leaf_s *leaf = stride_find(t, st->top_bits, w);
+    res->entry.offset = leaf->offset;
+    res->netmask = depth + leaf->netmask;
+}
+
+LOCAL TMMDB_INLINE void stride_lookup_128(const struct TMMDB_stride_s *st,
+                                          const uint8_t * ip,
+                                          TMMDB_root_entry_s * res)
+{
+    uint64_t w[2] = {
+        (uint64_t) load_uint32(ip) << 32 | load_uint32(ip + 4),
+        (uint64_t) load_uint32(ip + 8) << 32 | load_uint32(ip + 12)
+    };
+    const struct stride_leaf_s *leaf = stride_find(&st->main, st->top_bits, w);
+    if (leaf->offset != STRIDE_IPV4) {
+        res->entry.offset = leaf->offset;
+        res->netmask = leaf->netmask;
+        return;
+    }
+    // the 32 bits behind the IPv4 subtree's depth, at most 96
+    int depth = leaf->netmask;
+    uint64_t v = depth >= 64 ? w[1] << (depth - 64)
+        : depth ? w[0] << depth | w[1] >> (64 - depth) : w[0];
+    stride_lookup_v4(st, &st->v4, v >> 32, depth, res);
+}
+
+// one cached network, two per cache line. A seqlock, readers never wait
+// and writers give up if the slot is busy.
+struct prefix_slot_s {
+    uint32_t seq;               /* odd while written, 0 for never used */
+    uint32_t offset;            /* entry.offset of the result */
+    uint32_t netmask;
+    uint32_t unused;
+    uint32_t net[4];            /* the network, host order words */
+};
+
+struct TMMDB_prefix_cache_s {
+    struct prefix_slot_s *v4;   /* TMMDB_lookup_by_ipnum(_v4) results */
+    struct prefix_slot_s *v6;   /* TMMDB_lookup_by_ipnum_128 results */
+    int shift;                  /* 32 - bits */
+};
+
+// the slot for the /24 of an IPv4 address
+LOCAL TMMDB_INLINE struct prefix_slot_s *prefix_slot_32(struct
+                                                        TMMDB_prefix_cache_s
+                                                        *cache, uint32_t ipnum)
+{
+    return &cache->v4[((ipnum >> 8) * 2654435761U) >> cache->shift];
+}
+
+// the slot for the /48 of an IPv6 address or the /24 of an embedded IPv4
+LOCAL TMMDB_INLINE struct prefix_slot_s *prefix_slot_128(struct
+                                                         TMMDB_prefix_cache_s
+                                                         *cache,
+                                                         const uint32_t * w)
+{
+    uint32_t key = w[0] || w[1] || (w[2] && w[2] != 0xffff)
+        ? w[0] * 0x9e3779b1U ^ w[1] >> 16 : w[2] ^ w[3] >> 8;
+    return &cache->v6[(key * 2654435761U) >> cache->shift];
+}
+
+// first bits of w ( words host order )
+LOCAL TMMDB_INLINE void mask_words(uint32_t * net, const uint32_t * w,
+                                   int words, int bits)
+{
+    for (int i = 0; i < words; i++, bits -= 32)
+        net[i] = bits >= 32 ? w[i] : bits <= 0 ? 0 : w[i] & ~0U << (32 - bits);
+}
+
+LOCAL int prefix_get(struct prefix_slot_s *slot, const uint32_t * w,
+                     int words, TMMDB_root_entry_s * res)
+{
+    uint32_t net[4], have[4];
+    uint32_t seq = ATOMIC_LOAD(&slot->seq, ACQUIRE);
+    if (seq == 0 || seq & 1)
+        return TMMDB_FALSE;
+    // acquire loads instead of a fence, ThreadSanitizer does not know fences
+    uint32_t offset = ATOMIC_LOAD(&slot->offset, ACQUIRE);
+    uint32_t netmask = ATOMIC_LOAD(&slot->netmask, ACQUIRE);
+    for (int i = 0; i < words; i++)
+        have[i] = ATOMIC_LOAD(&slot->net[i], ACQUIRE);
+    if (ATOMIC_LOAD(&slot->seq, RELAXED) != seq)
+        return TMMDB_FALSE;
+
+    mask_words(net, w, words, netmask);
+    if (memcmp(net, have, words * sizeof(uint32_t)))
+        return TMMDB_FALSE;
+    res->entry.offset = offset;
+    res->netmask = netmask;
+    return TMMDB_TRUE;
+}
+
+LOCAL void prefix_put(struct prefix_slot_s *slot, const uint32_t * w,
+                      int words, TMMDB_root_entry_s * res)
+{
+    uint32_t net[4];
+    uint32_t seq = ATOMIC_LOAD(&slot->seq, RELAXED);
+    if (seq & 1 || !ATOMIC_CAS(&slot->seq, &seq, seq + 1))
+        return;                 // somebody else updates the slot
+    // a reader that sees one of the stores sees the odd seq as well
+    mask_words(net, w, words, res->netmask);
+    ATOMIC_STORE(&slot->offset, res->entry.offset, RELEASE);
+    ATOMIC_STORE(&slot->netmask, res->netmask, RELEASE);
+    for (int i = 0; i < words; i++)
+        ATOMIC_STORE(&slot->net[i], net[i], RELEASE);
+    ATOMIC_STORE(&slot->seq, seq + 2, RELEASE);
+}
+
+LOCAL int cached_lookup_32(TMMDB_s * mmdb, uint32_t ipnum,
+                           TMMDB_root_entry_s * res,
+                           int (*lookup) (TMMDB_s *, uint32_t,
+                                          TMMDB_root_entry_s *))
+{
+    struct prefix_slot_s *slot = prefix_slot_32(mmdb->prefix_cache, ipnum);
+    if (prefix_get(slot, &ipnum, 1, res))
+        return TMMDB_SUCCESS;
+    int err = lookup(mmdb, ipnum, res);
+    if (err == TMMDB_SUCCESS)
+        prefix_put(slot, &ipnum, 1, res);
+    return err;
+}
+
+LOCAL int cached_lookup_128(TMMDB_s * mmdb, const uint8_t * ip,
+                            TMMDB_root_entry_s * res)
+{
+    uint32_t w[4];
+    for (int i = 0; i < 4; i++)
+        w[i] = load_uint32(ip + 4 * i);
+    struct prefix_slot_s *slot = prefix_slot_128(mmdb->prefix_cache, w);
+    if (prefix_get(slot, w, 4, res))
+        return TMMDB_SUCCESS;
+    int err = lookup_128(mmdb, ip, res);
+    if (err == TMMDB_SUCCESS)
+        prefix_put(slot, w, 4, res);
+    return err;
+}
+
+int TMMDB_lookup_by_ipnum_128(struct in6_addr ipnum,
+                              TMMDB_root_entry_s * result)
+{
+    TMMDB_s *mmdb = result->entry.mmdb;
+    STATS_LOOKUP_BEGIN(mmdb);
+    int err = TMMDB_SUCCESS;
+    if (mmdb->stride_trie && mmdb->depth == 128)
+        stride_lookup_128(mmdb->stride_trie, ipnum.s6_addr, result);
+    else
+        err = mmdb->prefix_cache
+            ? cached_lookup_128(mmdb, ipnum.s6_addr, result)
+            : lookup_128(mmdb, ipnum.s6_addr, result);
+    STATS_LOOKUP_END(mmdb, result, 1);
+    return err;
+}
+
+int TMMDB_lookup_by_ipnum(uint32_t ipnum, TMMDB_root_entry_s * res)
+{
+    TMMDB_s *mmdb = res->entry.mmdb;
+    STATS_LOOKUP_BEGIN(mmdb);
+    int err = TMMDB_SUCCESS;
+    if (mmdb->range_table && mmdb->depth == 32)
+        range_lookup(mmdb->range_table, ipnum, res);
+    else if (mmdb->stride_trie && mmdb->depth == 32)
+        stride_lookup_v4(mmdb->stride_trie, &mmdb->stride_trie->main, ipnum,
+                         0, res);
+    else
+        err = mmdb->prefix_cache && mmdb->depth == 32
+            ? cached_lookup_32(mmdb, ipnum, res, lookup_32)
+            : lookup_32(mmdb, ipnum, res);
+    STATS_LOOKUP_END(mmdb, res, 1);
+    return err;
+}
+
+int TMMDB_lookup_by_ipnum_v4(uint32_t ipnum, TMMDB_root_entry_s * res)
+{
+    TMMDB_s *mmdb = res->entry.mmdb;
+    if (mmdb->depth == 32)
+        return TMMDB_lookup_by_ipnum(ipnum, res);
+    STATS_LOOKUP_BEGIN(mmdb);
+    int err = TMMDB_SUCCESS;
+    if (mmdb->range_table)
+        range_lookup(mmdb->range_table, ipnum, res);
+    else if (mmdb->stride_trie && mmdb->stride_trie->v4.top)
+        stride_lookup_v4(mmdb->stride_trie, &mmdb->stride_trie->v4, ipnum, 0,
+                         res);
+    else
+        err = mmdb->prefix_cache
+            ? cached_lookup_32(mmdb, ipnum, res, lookup_v4)
+            : lookup_v4(mmdb, ipnum, res);
+    STATS_LOOKUP_END(mmdb, res, 1);
+    return err;
+}
+
+int TMMDB_lookup_many_ipnum(TMMDB_s * mmdb, const uint32_t * ipnums, int count,
+                            TMMDB_root_entry_s * res)
+{
+    STATS_LOOKUP_BEGIN(mmdb);
+    int err = TMMDB_SUCCESS;
+    if (mmdb->range_table && mmdb->depth == 32) {
+        for (int i = 0; i < count; i++) {
+            res[i].entry.mmdb = mmdb;
+            range_lookup(mmdb->range_table, ipnums[i], &res[i]);
+        }
+    } else if (mmdb->stride_trie && mmdb->depth == 32) {
+        for (int i = 0; i < count; i++) {
+            res[i].entry.mmdb = mmdb;
+            stride_lookup_v4(mmdb->stride_trie, &mmdb->stride_trie->main,
+                             ipnums[i], 0, &res[i]);
+        }
+    } else {
+        err = mmdb->walker->many(mmdb, (const uint8_t *)ipnums, count, res,
+                                 32);
+    }
+    STATS_LOOKUP_END(mmdb, res, count);
+    return err;
+}
+
+int TMMDB_lookup_many_ipnum_128(TMMDB_s * mmdb,
+                                const struct in6_addr *ipnums, int count,
+                                TMMDB_root_entry_s * res)
+{
+    STATS_LOOKUP_BEGIN(mmdb);
+    int err = TMMDB_SUCCESS;
+    if (mmdb->stride_trie && mmdb->depth == 128) {
+        for (int i = 0; i < count; i++) {
+            res[i].entry.mmdb = mmdb;
+            stride_lookup_128(mmdb->stride_trie, ipnums[i].s6_addr, &res[i]);
+        }
+    } else {
+        err = mmdb->walker->many(mmdb, (const uint8_t *)ipnums, count, res,
+                                 128);
+    }
+    STATS_LOOKUP_END(mmdb, res, count);
+    return err;
+}
+
+// fill the jump table entries below node with the first depth bits prefix
+LOCAL void fill_jump_table(TMMDB_s * mmdb, struct TMMDB_jump_s *table,
+                           uint32_t node, int depth, uint32_t prefix)
+{
+    int bits = mmdb->jump_bits;
+    if (depth == bits) {
+        table[prefix] = (struct TMMDB_jump_s) {
+        .record = node,.bits = bits};
+        return;
+    }
+    const uint8_t *p = &mmdb->file_in_mem_ptr[node * mmdb->full_record_size_bytes];
+    for (int bit = 0; bit <= 1; bit++) {
+        uint32_t record = get_record(p, mmdb->full_record_size_bytes, bit);
+        uint32_t next_prefix = prefix << 1 | bit;
+        if (record >= mmdb->node_count) {
+            // the search ends here, every longer prefix gets the same result
+            uint32_t n = 1U << (bits - depth - 1);
+            struct TMMDB_jump_s *j = &table[next_prefix << (bits - depth - 1)];
+            while (n--)
+                *j++ = (struct TMMDB_jump_s) {
+                .record = record,.bits = depth + 1};
+        } else {
+            fill_jump_table(mmdb, table, record, depth + 1, next_prefix);
+        }
+    }
+}
+
+int TMMDB_build_jump_table(TMMDB_s * mmdb, int bits)
+{
+    if (bits < 0 || bits > TMMDB_JUMP_TABLE_MAX_BITS || bits > mmdb->depth)
+        return TMMDB_INVALIDARGUMENT;
+
+    struct TMMDB_jump_s *table = NULL;
+    if (bits > 0) {
+        table = xcalloc((size_t)1 << bits, sizeof(struct TMMDB_jump_s));
+        mmdb->jump_bits = bits;
+        fill_jump_table(mmdb, table, 0, 0, 0);
+    }
+    free(mmdb->jump_table);
+    mmdb->jump_table = table;
+    mmdb->jump_bits = bits;
+    mmdb->jump_table_size = bits ? sizeof(struct TMMDB_jump_s) << bits : 0;
+    return TMMDB_SUCCESS;
+}
+
+LOCAL void free_range_table(TMMDB_s * mmdb)
+{
+    if (mmdb->range_table) {
+        free(mmdb->range_table->starts);
+        free(mmdb->range_table->offsets);
+        free(mmdb->range_table->netmasks);
+        free(mmdb->range_table);
+        mmdb->range_table = NULL;
+        mmdb->range_table_size = 0;
+    }
+}
+
+// the ranges in address order, collected by collect_ranges
+typedef struct {
+    TMMDB_s *mmdb;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t max_ranges;
+    uint32_t *starts;
+    uint32_t *offsets;
+    uint8_t *netmasks;
+} ranges_s;
+
+LOCAL int collect_ranges(ranges_s * r, uint32_t record, int depth,
+                         uint32_t start)
+{
+    TMMDB_s *mmdb = r->mmdb;
+    if (record >= mmdb->node_count) {
+        uint32_t offset = record - mmdb->node_count;
+        // the neighbour has the same result, one range for both
+        if (r->count && r->offsets[r->count - 1] == offset
+            && r->netmasks[r->count - 1] == depth)
+            return TMMDB_SUCCESS;
+        if (r->count == r->max_ranges)
+            return TMMDB_OUTOFMEMORY;
+        if (r->count == r->capacity) {
+            r->capacity = r->capacity ? r->capacity * 2 : 1024;
+            r->starts = xrealloc(r->starts, r->capacity * sizeof(uint32_t));
+            r->offsets = xrealloc(r->offsets, r->capacity * sizeof(uint32_t));
+            r->netmasks = xrealloc(r->netmasks, r->capacity);
+        }
+        r->starts[r->count] = start;
+        r->offsets[r->count] = offset;
+        r->netmasks[r->count++] = depth;
+        return TMMDB_SUCCESS;
+    }
+    if (depth >= 32)
+        return TMMDB_CORRUPTDATABASE;
+    int rl = mmdb->full_record_size_bytes;
+    const uint8_t *p = &mmdb->file_in_mem_ptr[record * rl];
+    FD_RET_ON_ERR(collect_ranges(r, get_record(p, rl, 0), depth + 1, start));
+    return collect_ranges(r, get_record(p, rl, 1), depth + 1,
+                          start | 1U << (31 - depth));
+}
+
+// sorted index i to Eytzinger position k, returns the next i
+LOCAL uint32_t eytzinger(ranges_s * r, struct TMMDB_range_table_s *t,
+                         uint32_t i, uint64_t k)
+{
+    if (k <= t->count) {
+        i = eytzinger(r, t, i, 2 * k);
+        t->starts[k] = r->starts[i];
+        t->offsets[k] = r->offsets[i];
+        t->netmasks[k] = r->netmasks[i];
+        i = eytzinger(r, t, i + 1, 2 * k + 1);
+    }
+    return i;
+}
+
+int TMMDB_build_range_table(TMMDB_s * mmdb, uint32_t max_ranges)
+{
+    free_range_table(mmdb);
+    if (max_ranges == 0)
+        return TMMDB_SUCCESS;
+
+    // IPv4 databases from the root, IPv6 databases from ::/96
+    uint32_t record = mmdb->depth == 32 ? 0 : mmdb->ipv4_start_node;
+    ranges_s r = {.mmdb = mmdb,.max_ranges = max_ranges };
+    int err = collect_ranges(&r, record, 0, 0);
+    if (err == TMMDB_SUCCESS) {
+        struct TMMDB_range_table_s *t = xcalloc(1, sizeof(*t));
+        void *mem;
+        if (posix_memalign(&mem, 64, (r.count + 1) * sizeof(uint32_t)))
+            abort();
+        t->count = r.count;
+        t->starts = mem;
+        t->offsets = xmalloc((r.count + 1) * sizeof(uint32_t));
+        t->netmasks = xmalloc(r.count + 1);
+        t->starts[0] = t->offsets[0] = t->netmasks[0] = 0;
+        eytzinger(&r, t, 0, 1);
+        mmdb->range_table = t;
+        mmdb->range_table_size = sizeof(*t)
+            + (size_t)(r.count + 1) * (2 * sizeof(uint32_t) + 1);
+    }
+    free(r.starts);
+    free(r.offsets);
+    free(r.netmasks);
+    return err;
+}
+
+LOCAL void free_stride_trie(TMMDB_s * mmdb)
+{
+    struct TMMDB_stride_s *st = mmdb->stride_trie;
+    if (st) {
+        struct stride_trie_s *tries[2] = { &st->main, &st->v4 };
+        for (int i = 0; i < 2; i++) {
+            free(tries[i]->top);
+            free(tries[i]->nodes);
+            free(tries[i]->leaves);
+        }
+        free(st);
+        mmdb->stride_trie = NULL;
+        mmdb->stride_trie_size = 0;
+    }
+}
+
+// building one trie, depth counts from its root
+typedef struct {
+    TMMDB_s *mmdb;
+    struct stride_trie_s *t;
+    int max_depth;              /* 32 or 128 */
+    uint32_t ipv4_node;         /* becomes a STRIDE_IPV4 leaf, or UINT32_MAX */
+    int err;
+} stride_build_s;
+
+// one entry of a node or the top table while it is built
+typedef struct {
+    uint32_t child;             /* node of the tree, or UINT32_MAX */
+    struct stride_leaf_s leaf;
+} stride_entry_s;
+
+LOCAL uint32_t stride_add_leaf(stride_build_s * b, struct stride_leaf_s leaf)
+{
+    struct stride_trie_s *t = b->t;
+    if (t->leaf_count == t->leaf_capacity) {
+        t->leaf_capacity = t->leaf_capacity ? t->leaf_capacity * 2 : 1024;
+        t->leaves = xrealloc(t->leaves,
+                             t->leaf_capacity * sizeof(struct stride_leaf_s));
+    }
+    t->leaves[t->leaf_count] = leaf;
+    return t->leaf_count++;
+}
+
+LOCAL uint32_t stride_add_nodes(stride_build_s * b, uint32_t count)
+{
+    struct stride_trie_s *t = b->t;
+    while (t->node_count + count > t->node_capacity) {
+        t->node_capacity = t->node_capacity ? t->node_capacity * 2 : 1024;
+        t->nodes = xrealloc(t->nodes,
+                            t->node_capacity * sizeof(struct stride_node_s));
+    }
+    if (t->node_count + count >= STRIDE_LEAF)
+        b->err = TMMDB_OUTOFMEMORY;
+    t->node_count += count;
+    return t->node_count - count;
+}
+
+// the entries of bits bits below record, leaves are pushed down to them
+LOCAL void stride_fill(stride_build_s * b, stride_entry_s * entries,
+                       uint32_t record, int depth, int bits, int used,
+                       uint32_t i)
+{
+    TMMDB_s *mmdb = b->mmdb;
+    int is_leaf = record >= mmdb->node_count || record == b->ipv4_node;
+    if (is_leaf || used == bits) {
+        stride_entry_s e = {.child = UINT32_MAX };
+        if (record == b->ipv4_node)
+            e.leaf = (struct stride_leaf_s) {
+            .offset = STRIDE_IPV4,.netmask = depth};
+        else if (is_leaf)
+            e.leaf = (struct stride_leaf_s) {
+            .offset = record - mmdb->node_count,.netmask = depth};
+        else
+            e.child = record;
+        uint32_t n = 1U << (bits - used);
+        for (uint32_t k = i << (bits - used); n--; k++)
+            entries[k] = e;
+        return;
+    }
+    if (depth >= b->max_depth) {
+        b->err = TMMDB_CORRUPTDATABASE;
+        return;
+    }
+    int rl = mmdb->full_record_size_bytes;
+    const uint8_t *p = &mmdb->file_in_mem_ptr[record * rl];
+    stride_fill(b, entries, get_record(p, rl, 0), depth + 1, bits, used + 1,
+                i << 1);
+    stride_fill(b, entries, get_record(p, rl, 1), depth + 1, bits, used + 1,
+                i << 1 | 1);
+}
+
+LOCAL int same_leaf(const stride_entry_s * a, const stride_entry_s * b)
+{
+    return a->leaf.offset == b->leaf.offset
+        && a->leaf.netmask == b->leaf.netmask;
+}
+
+// node idx for the subtree of record at depth
+LOCAL void stride_build_node(stride_build_s * b, uint32_t idx,
+                             uint32_t record, int depth)
+{
+    stride_entry_s entries[1 << STRIDE];
+    stride_fill(b, entries, record, depth, STRIDE, 0, 0);
+    if (b->err != TMMDB_SUCCESS)
+        return;
+
+    struct stride_node_s n = { 0 };
+    uint32_t children = 0;
+    n.leaf_base = b->t->leaf_count;
+    for (int i = 0; i < 1 << STRIDE; i++) {
+        if (entries[i].child != UINT32_MAX) {
+            n.children |= 1ULL << i;
+            children++;
+        } else if (i == 0 || entries[i - 1].child != UINT32_MAX
+                   || !same_leaf(&entries[i - 1], &entries[i])) {
+            n.leaves |= 1ULL << i;
+            stride_add_leaf(b, entries[i].leaf);
+        }
+    }
+    n.child_base = stride_add_nodes(b, children);
+    b->t->nodes[idx] = n;
+    for (int i = 0, c = 0; i < 1 << STRIDE && b->err == TMMDB_SUCCESS; i++)
+        if (entries[i].child != UINT32_MAX)
+            stride_build_node(b, n.child_base + c++, entries[i].child,
+                              depth + STRIDE);
+}
+
+LOCAL int stride_build(TMMDB_s * mmdb, struct stride_trie_s *t, int top_bits,
+                       uint32_t root, int max_depth, uint32_t ipv4_node)
+{
+    stride_build_s b = {.mmdb = mmdb,.t = t,.max_depth = max_depth,
+        .ipv4_node = ipv4_node
+    };
+    stride_entry_s *entries = xmalloc(sizeof(stride_entry_s) << top_bits);
+    stride_fill(&b, entries, root, 0, top_bits, 0, 0);
+    t->top = xmalloc(sizeof(uint32_t) << top_bits);
+    for (uint32_t i = 0; i < 1U << top_bits && b.err == TMMDB_SUCCESS; i++) {
+        if (entries[i].child != UINT32_MAX) {
+            t->top[i] = stride_add_nodes(&b, 1);
+            stride_build_node(&b, t->top[i], entries[i].child, top_bits);
+        } else if (i && entries[i - 1].child == UINT32_MAX
+                   && same_leaf(&entries[i - 1], &entries[i])) {
+            t->top[i] = t->top[i - 1];
+        } else {
+            t->top[i] = STRIDE_LEAF | stride_add_leaf(&b, entries[i].leaf);
+        }
+    }
+    free(entries);
+    return b.err;
+}
+
+int TMMDB_build_stride_trie(TMMDB_s * mmdb, int top_bits)
+{
+    if (top_bits < 0 || top_bits > TMMDB_STRIDE_TRIE_MAX_TOP_BITS
+        || (top_bits && top_bits < STRIDE))
+        return TMMDB_INVALIDARGUMENT;
+    free_stride_trie(mmdb);
+    if (top_bits == 0)
+        return TMMDB_SUCCESS;
+
+    struct TMMDB_stride_s *st = xcalloc(1, sizeof(*st));
+    st->top_bits = top_bits;
+    mmdb->stride_trie = st;
+    int v6 = mmdb->depth == 128 && mmdb->ipv4_start_bits == 96
+        && mmdb->ipv4_start_node < mmdb->node_count;
+    int err = stride_build(mmdb, &st->main, top_bits, 0, mmdb->depth,
+                           v6 ? mmdb->ipv4_start_node : UINT32_MAX);
+    if (err == TMMDB_SUCCESS && v6)
+        err = stride_build(mmdb, &st->v4, top_bits, mmdb->ipv4_start_node, 32,
+                           UINT32_MAX);
+    if (err != TMMDB_SUCCESS) {
+        free_stride_trie(mmdb);
+        return err;
+    }
+    struct stride_trie_s *tries[2] = { &st->main, &st->v4 };
+    mmdb->stride_trie_size = sizeof(*st);
+    for (int i = 0; i < 2; i++)
+        if (tries[i]->top)
+            mmdb->stride_trie_size += (sizeof(uint32_t) << top_bits)
+                + tries[i]->node_count * sizeof(struct stride_node_s)
+                + tries[i]->leaf_count * sizeof(struct stride_leaf_s);
+    return TMMDB_SUCCESS;
+}
+
+size_t TMMDB_index_memory(TMMDB_s * mmdb)
+{
+    return mmdb->jump_table_size + mmdb->prefix_cache_size
+        + mmdb->hot_fields_size + mmdb->range_table_size
+        + mmdb->stride_trie_size;
+}
+
+LOCAL void free_prefix_cache(TMMDB_s * mmdb)
+{
+    if (mmdb->prefix_cache) {
+        free(mmdb->prefix_cache->v4);
+        free(mmdb->prefix_cache);
+        mmdb->prefix_cache = NULL;
+        mmdb->prefix_cache_size = 0;
+    }
+}
+
+int TMMDB_enable_prefix_cache(TMMDB_s * mmdb, int bits)
+{
+    if (bits < 0 || bits > TMMDB_PREFIX_CACHE_MAX_BITS)
+        return TMMDB_INVALIDARGUMENT;
+    free_prefix_cache(mmdb);
+    if (bits == 0)
+        return TMMDB_SUCCESS;
+
+    // one block for both tables, cache line aligned
+    size_t slots = (size_t)1 << bits;
+    size_t size = 2 * slots * sizeof(struct prefix_slot_s);
+    void *mem;
+    if (posix_memalign(&mem, 64, size))
+        abort();
+    memset(mem, 0, size);
+
+    struct TMMDB_prefix_cache_s *cache = xcalloc(1, sizeof(*cache));
+    cache->v4 = mem;
+    cache->v6 = cache->v4 + slots;
+    cache->shift = 32 - bits;
+    mmdb->prefix_cache = cache;
+    mmdb->prefix_cache_size = size;
+    return TMMDB_SUCCESS;
+}
+
+// follow the first bits of ip from the root. Returns the number of bits
+// consumed, *record is the node reached or the record where the search ended
+LOCAL int walk_prefix(TMMDB_s * mmdb, const uint8_t * ip, int bits,
+                      uint32_t * record)
+{
+    int rl = mmdb->full_record_size_bytes;
+    uint32_t node = 0;
+    for (int i = 0; i < bits; i++) {
+        int bit = (ip[i >> 3] >> (7 - (i & 7))) & 1;
+        node = get_record(&mmdb->file_in_mem_ptr[node * rl], rl, bit);
+        if (node >= mmdb->node_count) {
+            *record = node;
+            return i + 1;
+        }
+    }
+    *record = node;
+    return bits;
+}
+
+// IPv4 addresses live in ::/96 of IPv6 databases. Remember where the IPv4
+// part starts and whether ::ffff:0:0/96 points to the same subtree.
+LOCAL int find_ipv4_start(TMMDB_s * mmdb)
+{
+    static const uint8_t v4[12] = { 0 };
+    static const uint8_t v4_mapped[12] =
+        { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+    mmdb->ipv4_start_node = 0;
+    mmdb->ipv4_start_bits = 0;
+    mmdb->ipv4_mapped_alias = 0;
+    if (mmdb->depth != 128)
+        return TMMDB_SUCCESS;
+
+    mmdb->ipv4_start_bits = walk_prefix(mmdb, v4, 96, &mmdb->ipv4_start_node);
+    if (mmdb->ipv4_start_node < mmdb->node_count) {
+        uint32_t mapped;
+        mmdb->ipv4_mapped_alias = walk_prefix(mmdb, v4_mapped, 96, &mapped)
+            == 96 && mapped == mmdb->ipv4_start_node;
+    }
+    return TMMDB_SUCCESS;
+}
+
+#define HUGE_PAGE_SIZE (2 << 20)
+#define READ_CHUNK (16 << 20)
+
+// private anonymous memory for a copy of the database. With huge it is
+// aligned to and backed by transparent huge pages if the kernel has them,
+// the random node accesses of the lookups need far fewer TLB entries then.
+// The pages are placed on the NUMA node of the thread that writes them
+// first, the thread that opens the database.
+LOCAL uint8_t *alloc_db_memory(size_t size, size_t * mapped, int huge)
+{
+    size_t align = huge ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    size_t extra = huge ? HUGE_PAGE_SIZE : 0;
+    size = (size + align - 1) & ~(align - 1);
+    uint8_t *mem = mmap(NULL, size + extra, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+    if (huge) {
+        // keep the aligned part only
+        size_t head = -(uintptr_t) mem & (HUGE_PAGE_SIZE - 1);
+        if (head)
+            munmap(mem, head);
+        munmap(mem + head + size, HUGE_PAGE_SIZE - head);
+        mem += head;
+#ifdef MADV_HUGEPAGE
+        madvise(mem, size, MADV_HUGEPAGE);
+#endif
+    }
+    *mapped = size;
+    return mem;
+}
+
+// mem replaces the file mapping, it is read only from now on
+LOCAL void use_db_memory(TMMDB_s * mmdb, uint8_t * mem, size_t mapped)
+{
+    mprotect(mem, mapped, PROT_READ);
+    if (mmdb->mapped_size)
+        munmap((void *)mmdb->file_in_mem_ptr, mmdb->mapped_size);
+    mmdb->file_in_mem_ptr = mmdb->meta_data_content = mem;
+    mmdb->mapped_size = mapped;
+}
+
+LOCAL int copy_db(TMMDB_s * mmdb, uint32_t flags)
+{
+    size_t mapped;
+    uint8_t *mem = alloc_db_memory(mmdb->size, &mapped,
+                                   flags & TMMDB_OPT_HUGE_PAGES);
+    if (!mem)
+        return TMMDB_OUTOFMEMORY;
+    memcpy(mem, mmdb->file_in_mem_ptr, mmdb->size);
+    use_db_memory(mmdb, mem, mapped);
+    return TMMDB_SUCCESS;
+}
+
+// TMMDB_MODE_MEMORY_CACHE, the whole file with large sequential reads.
+// The lookups never wait for the file system after that.
+LOCAL int read_db(TMMDB_s * mmdb, int fd, uint32_t flags)
+{
+    size_t mapped, size = mmdb->size;
+    uint8_t *mem = alloc_db_memory(size, &mapped,
+                                   flags & TMMDB_OPT_HUGE_PAGES);
+    if (!mem)
+        return TMMDB_OUTOFMEMORY;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+#endif
+    for (size_t done = 0; done < size;) {
+        size_t chunk = size - done > READ_CHUNK ? READ_CHUNK : size - done;
+        ssize_t n = pread(fd, mem + done, chunk, done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            munmap(mem, mapped);
+            return TMMDB_IOERROR;
+        }
+        done += n;
+    }
+    use_db_memory(mmdb, mem, mapped);
+    return TMMDB_SUCCESS;
+}
+
+LOCAL int map_db(TMMDB_s * mmdb, int fd, uint32_t flags)
+{
+    int mmap_flags = MAP_FILE | MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (flags & TMMDB_OPT_POPULATE)
+        mmap_flags |= MAP_POPULATE;
+#endif
+    uint8_t *ptr = mmap(NULL, mmdb->size, PROT_READ, mmap_flags, fd, 0);
+    if (ptr == MAP_FAILED)
+        return TMMDB_INVALIDDATABASE;
+    mmdb->file_in_mem_ptr = mmdb->meta_data_content = ptr;
+    mmdb->mapped_size = mmdb->size;
+    // file backed memory gets no transparent huge pages
+    if (flags & TMMDB_OPT_HUGE_PAGES)
+        return copy_db(mmdb, flags);
+    return TMMDB_SUCCESS;
+}
+
+// the tree is read soon and everywhere, the data section on demand
+LOCAL void advise(TMMDB_s * mmdb)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t tree = (size_t)mmdb->node_count * mmdb->full_record_size_bytes;
+    if (tree > (size_t)mmdb->size)
+        return;
+    madvise((void *)mmdb->file_in_mem_ptr, tree, MADV_WILLNEED);
+    size_t data = tree & ~(page - 1);
+    madvise((void *)(mmdb->file_in_mem_ptr + data), mmdb->size - data,
+            MADV_RANDOM);
+}
+
+// everything after the database is in memory
+LOCAL int init_db(TMMDB_s * mmdb, uint32_t flags)
+{
+    const uint8_t *ptr = mmdb->file_in_mem_ptr;
+    int size = mmdb->size;
+    int max_metasize = size > 4096 ? 4096 : size;
+    const uint8_t *metadata = memmem(ptr + size - max_metasize, max_metasize,
+                                     "\xab\xcd\xefMaxMind.com", 14);
+    if (metadata == NULL)
+        return TMMDB_INVALIDDATABASE;
+
+    mmdb->fake_metadata_db = xcalloc(1, sizeof(struct TMMDB_s));
+    mmdb->fake_metadata_db->dataptr = metadata + 14;
+    mmdb->meta.mmdb = mmdb->fake_metadata_db;
+
+    // we can't fail with ioerror's here. It is a memory operation
+    mmdb->major_file_format =
+        get_uint_value(&mmdb->meta, KEYS("binary_format_major_version"));
+
+    mmdb->minor_file_format =
+        get_uint_value(&mmdb->meta, KEYS("binary_format_minor_version"));
+
+    // looks like the dataabase_type is the info string.
+    // mmdb->database_type = get_uint_value(&meta, KEYS("database_type"));
+    mmdb->full_record_size_bytes =
+        get_uint_value(&mmdb->meta, KEYS("record_size")) * 2 / 8U;
+    mmdb->node_count = get_uint_value(&mmdb->meta, KEYS("node_count"));
+
+    // unfortunately we must guess the depth of the database
+    mmdb->depth =
+        get_uint_value(&mmdb->meta, KEYS("ip_version")) == 4 ? 32 : 128;
+
+    mmdb->dataptr =
+        mmdb->file_in_mem_ptr + mmdb->node_count * mmdb->full_record_size_bytes;
+
+    // Success - but can we handle the data?
+    if (mmdb->major_file_format != 2) {
+        return TMMDB_UNKNOWNDATABASEFMT;
+    }
+
+    int rl = mmdb->full_record_size_bytes;
+    if (rl != 6 && rl != 7 && rl != 8)
+        return TMMDB_INVALIDDATABASE;
+    mmdb->walker = &walkers[rl - 6];
+    if ((uint64_t) mmdb->node_count * rl + TMMDB_DATASECTION_NOOP_SIZE
+        > (uint64_t) size)
+        return TMMDB_INVALIDDATABASE;
+
+    if (flags & TMMDB_OPT_ADVISE)
+        advise(mmdb);
+
+    FD_RET_ON_ERR(find_ipv4_start(mmdb));
+
+    if (flags & TMMDB_OPT_JUMP_TABLE) {
+        int bits = mmdb->depth < TMMDB_JUMP_TABLE_DEFAULT_BITS
+            ? mmdb->depth : TMMDB_JUMP_TABLE_DEFAULT_BITS;
+        FD_RET_ON_ERR(TMMDB_build_jump_table(mmdb, bits));
+    }
+    if (flags & TMMDB_OPT_PREFIX_CACHE)
+        FD_RET_ON_ERR(TMMDB_enable_prefix_cache
+                      (mmdb, TMMDB_PREFIX_CACHE_DEFAULT_BITS));
+    if (flags & TMMDB_OPT_RANGE_TABLE)
+        FD_RET_ON_ERR(TMMDB_build_range_table
+                      (mmdb, TMMDB_RANGE_TABLE_DEFAULT_MAX));
+    if (flags & TMMDB_OPT_STRIDE_TRIE)
+        FD_RET_ON_ERR(TMMDB_build_stride_trie
+                      (mmdb, TMMDB_STRIDE_TRIE_DEFAULT_TOP_BITS));
+
+    return TMMDB_SUCCESS;
+}
+
+// s is the fstat of the file that was opened
+LOCAL int init(TMMDB_s * mmdb, const char *fname, uint32_t flags,
+               struct stat *s)
+{
+    mmdb->fname = strdup(fname);
+    if (mmdb->fname == NULL)
+        return TMMDB_OUTOFMEMORY;
+    int fd = open(fname, O_RDONLY);
+
+    if (fd < 0)
+        return TMMDB_OPENFILEERROR;
+    fstat(fd, s);
+    mmdb->flags = flags;
+    mmdb->size = s->st_size;
+    int err = TMMDB_INVALIDDATABASE;
+    if (s->st_size > 0 && s->st_size <= INT_MAX)
+        err = (flags & TMMDB_MODE_MASK) == TMMDB_MODE_MEMORY_CACHE
+            ? read_db(mmdb, fd, flags) : map_db(mmdb, fd, flags);
+    close(fd);
+    if (err != TMMDB_SUCCESS)
+        return err;
+    return init_db(mmdb, flags);
+}
+
+LOCAL int init_from_buffer(TMMDB_s * mmdb, const void *buffer, size_t size,
+                           uint32_t flags)
+{
+    if (!buffer || size == 0 || size > INT_MAX)
+        return TMMDB_INVALIDDATABASE;
+    mmdb->flags = flags;
+    mmdb->size = size;
+    // mapped_size 0, the buffer is the caller's
+    mmdb->file_in_mem_ptr = mmdb->meta_data_content = (uint8_t *) buffer;
+    if ((flags & TMMDB_MODE_MASK) == TMMDB_MODE_MEMORY_CACHE
+        || flags & TMMDB_OPT_HUGE_PAGES)
+        FD_RET_ON_ERR(copy_db(mmdb, flags));
+    return init_db(mmdb, flags);
+}
+
+int TMMDB_open_from_buffer(TMMDB_s ** mmdbptr, const void *buffer,
+                           size_t size, uint32_t flags)
+{
+    TMMDB_s *mmdb = *mmdbptr = xcalloc(1, sizeof(TMMDB_s));
+    int err = init_from_buffer(mmdb, buffer, size, flags);
+    if (err != TMMDB_SUCCESS) {
+        free_all(mmdb);
+        *mmdbptr = NULL;
+    }
+    return err;
+}
+
+LOCAL int open_file(TMMDB_s ** mmdbptr, const char *fname, uint32_t flags,
+                    struct stat *s)
+{
+    TMMDB_DBG_CARP("TMMDB_open %s %d\n", fname, flags);
+    TMMDB_s *mmdb = *mmdbptr = xcalloc(1, sizeof(TMMDB_s));
+    int err = init(mmdb, fname, flags, s);
+    if (err != TMMDB_SUCCESS) {
+        free_all(mmdb);
+        *mmdbptr = NULL;
+    }
+    return err;
+}
+
+int TMMDB_open(TMMDB_s ** mmdbptr, const char *fname, uint32_t flags)
+{
+    struct stat s;
+    return open_file(mmdbptr, fname, flags, &s);
+}
+
+void TMMDB_close(TMMDB_s * mmdb)
+{
+    if (mmdb) {
+        free_all(mmdb);
+    }
+}
+
+/* return the result of any uint type with 32 bit's or less as uint32 */
+uint32_t TMMDB_get_uint(TMMDB_return_s const *const result)
+{
+    return result->uinteger;
+}
+
+int TMMDB_get_value(TMMDB_entry_s * start, TMMDB_return_s * result, ...)
+{
+    va_list keys;
+    va_start(keys, result);
+    int ioerror = TMMDB_vget_value(start, result, keys);
+    va_end(keys);
+    return ioerror;
+}
+
+LOCAL uint32_t get_uint_value(TMMDB_entry_s * start, ...)
+{
+    TMMDB_return_s result;
+    va_list params;
+    va_start(params, start);
+    TMMDB_vget_value(start, &result, params);
+    va_end(params);
+    return TMMDB_get_uint(&result);
+}
+
+LOCAL void decode_one(TMMDB_s * mmdb, uint32_t offset, TMMDB_decode_s * decode)
+{
+
+    const uint8_t *mem = mmdb->dataptr;
+    uint8_t ctrl;
+    int type;
+    decode->data.offset = offset;
+    ctrl = mem[offset++];
+    type = (ctrl >> 5) & 7;
+    if (type == TMMDB_DTYPE_EXT)
+        type = get_ext_type(mem[offset++]);
+
+    // TMMDB_DBG_CARP("decode_one type:%d\n", type);
+
+    decode->data.type = type;
+
+    if (type == TMMDB_DTYPE_PTR) {
+        int psize = (ctrl >> 3) & 3;
+        STATS_ADD(mmdb, pointers, 1);
+        decode->data.uinteger = get_ptr_from(ctrl, &mem[offset], psize);
+        decode->data.data_size = psize + 1;
+        decode->offset_to_next = offset + psize + 1;
+        TMMDB_DBG_CARP
+            ("decode_one{ptr} ctrl:%d, offset:%d psize:%d point_to:%d\n", ctrl,
+             offset, psize, decode->data.uinteger);
+        return;
+    }
+
+    int size = ctrl & 31;
+    switch (size) {
+    case 29:
+        size = 29 + mem[offset++];
+        break;
+    case 30:
+        size = 285 + get_uint16(&mem[offset]);
+        offset += 2;
+        break;
+    case 31:
+        size = 65821 + get_uint24(&mem[offset]);
+        offset += 3;
+    default:
+        break;
+    }
+
+    if (type == TMMDB_DTYPE_MAP || type == TMMDB_DTYPE_ARRAY) {
+        decode->data.data_size = size;
+        decode->offset_to_next = offset;
+        TMMDB_DBG_CARP("decode_one type:%d size:%d\n", type, size);
+        return;
+    }
+
+    if (type == TMMDB_DTYPE_BOOLEAN) {
         decode->data.uinteger = !!size;
         decode->data.data_size = 0;
         decode->offset_to_next = offset;
@@ -528,363 +1940,2325 @@ LOCAL void decode_one(TMMDB_s * mmdb, uint32_t offset, TMMDB_decode_s * decode)
         return;
     }
 
-    if (size == 0 && type != TMMDB_DTYPE_UINT16 && type != TMMDB_DTYPE_UINT32
-        && type != TMMDB_DTYPE_INT32) {
-        decode->data.ptr = NULL;
-        decode->data.data_size = 0;
-        decode->offset_to_next = offset;
+    if (size == 0 && type != TMMDB_DTYPE_UINT16 && type != TMMDB_DTYPE_UINT32
+        && type != TMMDB_DTYPE_INT32 && type != TMMDB_DTYPE_UINT64
+        && type != TMMDB_DTYPE_UINT128) {
+        decode->data.ptr = NULL;
+        decode->data.data_size = 0;
+        decode->offset_to_next = offset;
+        return;
+    }
+
+    if ((type == TMMDB_DTYPE_UINT32) || (type == TMMDB_DTYPE_UINT16)) {
+        decode->data.uinteger = get_uintX(&mem[offset], size);
+    } else if (type == TMMDB_DTYPE_INT32) {
+        decode->data.sinteger = get_sintX(&mem[offset], size);
+    } else if (type == TMMDB_DTYPE_UINT64) {
+        assert(size >= 0 && size <= 8);
+        memset(decode->data.c8, 0, 8);
+        if (size > 0)
+            memcpy(decode->data.c8 + 8 - size, &mem[offset], size);
+    } else if (type == TMMDB_DTYPE_UINT128) {
+        assert(size >= 0 && size <= 16);
+        memset(decode->data.c16, 0, 16);
+        if (size > 0)
+            memcpy(decode->data.c16 + 16 - size, &mem[offset], size);
+    } else if (type == TMMDB_DTYPE_IEEE754_FLOAT) {
+        size = 4;
+        decode->data.float_value = get_ieee754_float(&mem[offset]);
+    } else if (type == TMMDB_DTYPE_IEEE754_DOUBLE) {
+        size = 8;
+        decode->data.double_value = get_ieee754_double(&mem[offset]);
+    } else {
+        decode->data.ptr = &mem[offset];
+        decode->data.data_size = size;
+    }
+    decode->offset_to_next = offset + size;
+    TMMDB_DBG_CARP("decode_one type:%d size:%d\n", type, size);
+
+    return;
+}
+
+LOCAL void skip_values(TMMDB_s * mmdb, TMMDB_decode_s * decode)
+{
+    if (decode->data.type == TMMDB_DTYPE_MAP) {
+        int size = decode->data.data_size;
+        while (size-- > 0) {
+            decode_one(mmdb, decode->offset_to_next, decode);   // key
+            decode_one(mmdb, decode->offset_to_next, decode);   // value
+            skip_values(mmdb, decode);
+        }
+
+    } else if (decode->data.type == TMMDB_DTYPE_ARRAY) {
+        int size = decode->data.data_size;
+        while (size-- > 0) {
+            decode_one(mmdb, decode->offset_to_next, decode);   // value
+            skip_values(mmdb, decode);
+        }
+    }
+}
+
+// skip the members of the map or array in decode
+LOCAL void skip_hash_array(TMMDB_s * mmdb, TMMDB_decode_s * decode)
+{
+#if TMMDB_STATS
+    uint32_t start = decode->offset_to_next;
+    skip_values(mmdb, decode);
+    STATS_ADD(mmdb, bytes_skipped, decode->offset_to_next - start);
+#else
+    skip_values(mmdb, decode);
+#endif
+}
+
+LOCAL void DPRINT_KEY(TMMDB_s * mmdb, TMMDB_return_s * data)
+{
+    uint8_t str[256];
+    int len = data->data_size > 255 ? 255 : data->data_size;
+
+    memcpy(str, data->ptr, len);
+    str[len] = '\0';
+    fprintf(stderr, "%s\n", str);
+}
+
+const char *TMMDB_lib_version(void)
+{
+    return PACKAGE_VERSION;
+}
+
+int TMMDB_get_tree(TMMDB_entry_s * start, TMMDB_decode_all_s ** decode_all)
+{
+    TMMDB_decode_all_s *decode = *decode_all = TMMDB_alloc_decode_all();
+    return get_tree(start->mmdb, start->offset, decode);
+}
+
+LOCAL int get_tree(TMMDB_s * mmdb, uint32_t offset, TMMDB_decode_all_s * decode)
+{
+    decode_one(mmdb, offset, &decode->decode);
+
+    if (decode->decode.data.type == TMMDB_DTYPE_PTR) {
+        // skip pointer silently
+        TMMDB_DBG_CARP("Skip ptr\n");
+        uint32_t tmp = decode->decode.offset_to_next;
+        uint32_t last_offset;
+        while (decode->decode.data.type == TMMDB_DTYPE_PTR) {
+            decode_one(mmdb, last_offset =
+                       decode->decode.data.uinteger, &decode->decode);
+        }
+
+        if (decode->decode.data.type == TMMDB_DTYPE_ARRAY
+            || decode->decode.data.type == TMMDB_DTYPE_MAP) {
+            get_tree(mmdb, last_offset, decode);
+        }
+        decode->decode.offset_to_next = tmp;
+        return TMMDB_SUCCESS;
+
+    }
+
+    switch (decode->decode.data.type) {
+
+    case TMMDB_DTYPE_ARRAY:
+        {
+            int array_size = decode->decode.data.data_size;
+            TMMDB_DBG_CARP("Decode array with %d entries\n", array_size);
+            uint32_t array_offset = decode->decode.offset_to_next;
+            TMMDB_decode_all_s *previous = decode;
+            // decode->indent = 1;
+            while (array_size-- > 0) {
+                TMMDB_decode_all_s *decode_to = previous->next =
+                    TMMDB_alloc_decode_all();
+                get_tree(mmdb, array_offset, decode_to);
+                array_offset = decode_to->decode.offset_to_next;
+                while (previous->next)
+                    previous = previous->next;
+
+            }
+            decode->decode.offset_to_next = array_offset;
+
+        }
+        break;
+    case TMMDB_DTYPE_MAP:
+        {
+            int size = decode->decode.data.data_size;
+
+#if TMMDB_DEBUG
+            int rnd = rand();
+            TMMDB_DBG_CARP("%u decode hash with %d keys\n", rnd, size);
+#endif
+            offset = decode->decode.offset_to_next;
+            TMMDB_decode_all_s *previous = decode;
+            while (size-- > 0) {
+                TMMDB_decode_all_s *decode_to = previous->next =
+                    TMMDB_alloc_decode_all();
+                get_tree(mmdb, offset, decode_to);
+                while (previous->next)
+                    previous = previous->next;
+
+#if TMMDB_DEBUG
+                TMMDB_DBG_CARP("key num: %d (%u)", size, rnd);
+                DPRINT_KEY(mmdb, &decode_to->decode.data);
+#endif
+
+                offset = decode_to->decode.offset_to_next;
+                decode_to = previous->next = TMMDB_alloc_decode_all();
+                get_tree(mmdb, offset, decode_to);
+                while (previous->next)
+                    previous = previous->next;
+                offset = decode_to->decode.offset_to_next;
+            }
+            decode->decode.offset_to_next = offset;
+        }
+        break;
+    default:
+        break;
+    }
+    return TMMDB_SUCCESS;
+}
+
+int TMMDB_dump(TMMDB_s * mmdb, TMMDB_decode_all_s * decode_all, int indent)
+{
+    while (decode_all) {
+        decode_all = dump(mmdb, decode_all, indent);
+    }
+    // not sure about the return type right now
+    return TMMDB_SUCCESS;
+}
+
+LOCAL void silly_pindent(int i)
+{
+    fprintf(stderr, "%*s", i, "");
+}
+
+LOCAL TMMDB_decode_all_s *dump(TMMDB_s * mmdb, TMMDB_decode_all_s * decode_all,
+                              int indent)
+{
+    switch (decode_all->decode.data.type) {
+    case TMMDB_DTYPE_MAP:
+        {
+            int size = decode_all->decode.data.data_size;
+            for (decode_all = decode_all->next; size && decode_all; size--) {
+                decode_all = dump(mmdb, decode_all, indent + 2);
+                decode_all = dump(mmdb, decode_all, indent + 2);
+            }
+        }
+        break;
+    case TMMDB_DTYPE_ARRAY:
+        {
+            int size = decode_all->decode.data.data_size;
+            for (decode_all = decode_all->next; size && decode_all; size--) {
+                decode_all = dump(mmdb, decode_all, indent + 2);
+            }
+        }
+        break;
+    case TMMDB_DTYPE_UTF8_STRING:
+    case TMMDB_DTYPE_BYTES:
+        silly_pindent(indent);
+        DPRINT_KEY(mmdb, &decode_all->decode.data);
+        decode_all = decode_all->next;
+        break;
+    case TMMDB_DTYPE_IEEE754_DOUBLE:
+        silly_pindent(indent);
+        fprintf(stdout, "%f\n", decode_all->decode.data.double_value);
+        decode_all = decode_all->next;
+        break;
+    case TMMDB_DTYPE_IEEE754_FLOAT:
+        silly_pindent(indent);
+        fprintf(stdout, "%f\n", decode_all->decode.data.float_value);
+        decode_all = decode_all->next;
+        break;
+    case TMMDB_DTYPE_UINT16:
+    case TMMDB_DTYPE_UINT32:
+    case TMMDB_DTYPE_BOOLEAN:
+        silly_pindent(indent);
+        fprintf(stdout, "%u\n", decode_all->decode.data.uinteger);
+        decode_all = decode_all->next;
+        break;
+    case TMMDB_DTYPE_UINT64:
+    case TMMDB_DTYPE_UINT128:
+        {
+            char num[40];
+            int len = decode_all->decode.data.type == TMMDB_DTYPE_UINT64
+                ? format_uint64(num, get_uint64(decode_all->decode.data.c8))
+                : format_uint128(num, decode_all->decode.data.c16);
+            silly_pindent(indent);
+            fprintf(stdout, "%.*s\n", len, num);
+            decode_all = decode_all->next;
+        }
+        break;
+    case TMMDB_DTYPE_INT32:
+        silly_pindent(indent);
+        fprintf(stdout, "%d\n", decode_all->decode.data.sinteger);
+        decode_all = decode_all->next;
+        break;
+    default:
+        TMMDB_DBG_CARP("decode_one UNIPLEMENTED type:%d\n",
+                       decode_all->decode.data.type);
+        assert(0);
+    }
+    return decode_all;
+}
+
+// what walk_entry reports. enter sees every entry in decode order, map
+// keys included and pointers followed. leave sees it again after its
+// children, with offset_to_next set to the offset behind the entry.
+// index counts the entries of the walk in decode order.
+typedef struct {
+    int (*enter) (void *ctx, TMMDB_decode_s const *decode, int is_key);
+    int (*leave) (void *ctx, TMMDB_decode_s const *decode, size_t index);
+} walk_ops_s;
+
+typedef struct {
+    walk_ops_s const *ops;
+    void *ctx;
+    size_t index;               /* of the next entry */
+} walk_s;
+
+// the one recursion over a decoded entry, TMMDB_walk, TMMDB_get_tree_arena
+// and TMMDB_get_flat_tree are walk_ops_s on top of it. *behind is the offset
+// behind the entry at offset afterwards.
+LOCAL int walk_entry(TMMDB_s * mmdb, uint32_t offset, int is_key,
+                     walk_s * w, uint32_t * behind)
+{
+    TMMDB_decode_s decode;
+    decode_one(mmdb, offset, &decode);
+    *behind = decode.offset_to_next;
+    int followed = decode.data.type == TMMDB_DTYPE_PTR;
+    while (decode.data.type == TMMDB_DTYPE_PTR)
+        decode_one(mmdb, decode.data.uinteger, &decode);
+
+    size_t index = w->index++;
+    FD_RET_ON_ERR(w->ops->enter(w->ctx, &decode, is_key));
+    uint32_t child = decode.offset_to_next;
+    int size = decode.data.data_size;
+    if (decode.data.type == TMMDB_DTYPE_MAP) {
+        while (size-- > 0) {
+            FD_RET_ON_ERR(walk_entry(mmdb, child, 1, w, &child));
+            FD_RET_ON_ERR(walk_entry(mmdb, child, 0, w, &child));
+        }
+    } else if (decode.data.type == TMMDB_DTYPE_ARRAY) {
+        while (size-- > 0)
+            FD_RET_ON_ERR(walk_entry(mmdb, child, 0, w, &child));
+    }
+    if (!followed)
+        *behind = child;
+    decode.offset_to_next = *behind;
+    return w->ops->leave(w->ctx, &decode, index);
+}
+
+LOCAL int walk_start(TMMDB_entry_s * start, walk_ops_s const *ops, void *ctx)
+{
+    walk_s w = {.ops = ops,.ctx = ctx,.index = 0 };
+    uint32_t behind;
+    return walk_entry(start->mmdb, start->offset, 0, &w, &behind);
+}
+
+// append a node to the arena in enter, the offset behind it in leave
+LOCAL int arena_enter(void *ctx, TMMDB_decode_s const *decode, int is_key)
+{
+    TMMDB_arena_s *arena = ctx;
+    if (arena->used == arena->capacity) {
+        arena->capacity = arena->capacity ? arena->capacity * 2 : 256;
+        arena->nodes = xrealloc(arena->nodes,
+                                arena->capacity * sizeof(TMMDB_decode_all_s));
+    }
+    arena->nodes[arena->used++].decode = *decode;
+    return TMMDB_SUCCESS;
+}
+
+LOCAL int arena_leave(void *ctx, TMMDB_decode_s const *decode, size_t index)
+{
+    TMMDB_arena_s *arena = ctx;
+    arena->nodes[index].decode.offset_to_next = decode->offset_to_next;
+    return TMMDB_SUCCESS;
+}
+
+LOCAL const walk_ops_s arena_ops = { arena_enter, arena_leave };
+
+int TMMDB_get_tree_arena(TMMDB_entry_s * start, TMMDB_arena_s * arena,
+                         TMMDB_decode_all_s ** decode_all)
+{
+    arena->used = 0;            // the previous tree is gone
+    walk_start(start, &arena_ops, arena);
+
+    // link the nodes after the last realloc
+    TMMDB_decode_all_s *node = arena->nodes;
+    for (size_t i = 1; i < arena->used; i++, node++)
+        node->next = node + 1;
+    node->next = NULL;
+    *decode_all = arena->nodes;
+    return TMMDB_SUCCESS;
+}
+
+void TMMDB_free_arena(TMMDB_arena_s * arena)
+{
+    free(arena->nodes);
+    arena->nodes = NULL;
+    arena->used = arena->capacity = 0;
+}
+
+// append a node to the tree in enter, its subtree_end in leave
+LOCAL int flat_enter(void *ctx, TMMDB_decode_s const *decode, int is_key)
+{
+    TMMDB_flat_tree_s *tree = ctx;
+    if (tree->used == tree->capacity) {
+        tree->capacity = tree->capacity ? tree->capacity * 2 : 256;
+        tree->nodes = xrealloc(tree->nodes,
+                               tree->capacity * sizeof(TMMDB_flat_node_s));
+    }
+    tree->nodes[tree->used++].data = decode->data;
+    return TMMDB_SUCCESS;
+}
+
+LOCAL int flat_leave(void *ctx, TMMDB_decode_s const *decode, size_t index)
+{
+    TMMDB_flat_tree_s *tree = ctx;
+    tree->nodes[index].subtree_end = tree->used;
+    return TMMDB_SUCCESS;
+}
+
+LOCAL const walk_ops_s flat_ops = { flat_enter, flat_leave };
+
+int TMMDB_get_flat_tree(TMMDB_entry_s * start, TMMDB_flat_tree_s * tree)
+{
+    tree->used = 0;             // the previous tree is gone
+    walk_start(start, &flat_ops, tree);
+    return TMMDB_SUCCESS;
+}
+
+void TMMDB_free_flat_tree(TMMDB_flat_tree_s * tree)
+{
+    free(tree->nodes);
+    tree->nodes = NULL;
+    tree->used = tree->capacity = 0;
+}
+
+#define VISIT(visitor, cb, ...)                                        \
+  do {                                                                 \
+    if ((visitor)->cb) {                                               \
+      int err = (visitor)->cb(__VA_ARGS__);                            \
+      if (err != TMMDB_SUCCESS)                                        \
+        return err;                                                    \
+    }                                                                  \
+  } while (0)
+
+// TMMDB_walk, the walk_ops_s calling a TMMDB_visitor_s
+typedef struct {
+    TMMDB_visitor_s const *visitor;
+    void *ctx;
+} visit_s;
+
+LOCAL int visit_enter(void *ctx, TMMDB_decode_s const *decode, int is_key)
+{
+    visit_s *v = ctx;
+    TMMDB_return_s const *data = &decode->data;
+    if (is_key)
+        VISIT(v->visitor, key, v->ctx, data->ptr, data->data_size);
+    else if (data->type == TMMDB_DTYPE_MAP)
+        VISIT(v->visitor, begin_map, v->ctx, data->data_size);
+    else if (data->type == TMMDB_DTYPE_ARRAY)
+        VISIT(v->visitor, begin_array, v->ctx, data->data_size);
+    else
+        VISIT(v->visitor, value, v->ctx, data);
+    return TMMDB_SUCCESS;
+}
+
+LOCAL int visit_leave(void *ctx, TMMDB_decode_s const *decode, size_t index)
+{
+    visit_s *v = ctx;
+    if (decode->data.type == TMMDB_DTYPE_MAP)
+        VISIT(v->visitor, end_map, v->ctx);
+    else if (decode->data.type == TMMDB_DTYPE_ARRAY)
+        VISIT(v->visitor, end_array, v->ctx);
+    return TMMDB_SUCCESS;
+}
+
+LOCAL const walk_ops_s visit_ops = { visit_enter, visit_leave };
+
+int TMMDB_walk(TMMDB_entry_s * start, TMMDB_visitor_s const *visitor,
+               void *ctx)
+{
+    visit_s v = {.visitor = visitor,.ctx = ctx };
+    return walk_start(start, &visit_ops, &v);
+}
+
+TMMDB_decode_all_s *TMMDB_alloc_decode_all(void)
+{
+    return xcalloc(1, sizeof(TMMDB_decode_all_s));
+}
+
+void TMMDB_free_decode_all(TMMDB_decode_all_s * freeme)
+{
+    if (freeme == NULL)
+        return;
+    if (freeme->next)
+        TMMDB_free_decode_all(freeme->next);
+    free(freeme);
+}
+
+LOCAL void decode_one_follow(TMMDB_s * mmdb, uint32_t offset,
+                             TMMDB_decode_s * decode)
+{
+    decode_one(mmdb, offset, decode);
+    if (decode->data.type == TMMDB_DTYPE_PTR)
+        decode_one(mmdb, decode->data.uinteger, decode);
+}
+
+// a key matches if the length, the first byte and the rest are the same
+LOCAL TMMDB_INLINE int key_matches(TMMDB_query_key_s const *k,
+                                   TMMDB_return_s const *key)
+{
+    return key->data_size == k->len
+        && (k->len == 0 || (((const uint8_t *)key->ptr)[0] == k->first
+                            && !memcmp(key->ptr, k->key, k->len)));
+}
+
+// move decode from the map or array to the value for k.
+// Returns TMMDB_TRUE if found.
+LOCAL int query_step(TMMDB_s * mmdb, TMMDB_decode_s * decode,
+                     TMMDB_query_key_s const *k)
+{
+    TMMDB_decode_s key;
+    switch (decode->data.type) {
+    case TMMDB_DTYPE_MAP:
+        {
+            int size = decode->data.data_size;
+            uint32_t offset = decode->offset_to_next;
+            while (size-- > 0) {
+                decode_one(mmdb, offset, &key);
+                uint32_t offset_to_value = key.offset_to_next;
+                if (key.data.type == TMMDB_DTYPE_PTR)
+                    decode_one(mmdb, key.data.uinteger, &key);
+
+                assert(key.data.type == TMMDB_DTYPE_BYTES ||
+                       key.data.type == TMMDB_DTYPE_UTF8_STRING);
+
+                STATS_ADD(mmdb, keys_compared, 1);
+                if (key_matches(k, &key.data)) {
+                    decode_one_follow(mmdb, offset_to_value, decode);
+                    return TMMDB_TRUE;
+                }
+                // we search for another key skip this
+                decode_one(mmdb, offset_to_value, decode);
+                skip_hash_array(mmdb, decode);
+                offset = decode->offset_to_next;
+            }
+        }
+        break;
+    case TMMDB_DTYPE_ARRAY:
+        {
+            if (k->idx >= decode->data.data_size || k->idx < 0)
+                break;
+            for (int i = 0; i < k->idx; i++) {
+                decode_one(mmdb, decode->offset_to_next, decode);
+                skip_hash_array(mmdb, decode);
+            }
+            decode_one_follow(mmdb, decode->offset_to_next, decode);
+            return TMMDB_TRUE;
+        }
+    default:
+        break;
+    }
+    return TMMDB_FALSE;
+}
+
+LOCAL void query_key_init(TMMDB_query_key_s * k, const char *key, int idx)
+{
+    k->key = key;
+    k->len = strlen(key);
+    k->first = key[0];
+    k->idx = idx;
+}
+
+int TMMDB_vget_value(TMMDB_entry_s * start, TMMDB_return_s * result,
+                     va_list params)
+{
+    TMMDB_decode_s decode;
+    TMMDB_query_key_s k;
+    TMMDB_s *mmdb = start->mmdb;
+    char *src_key;
+    decode_one_follow(mmdb, start->offset, &decode);
+    while ((src_key = va_arg(params, char *))) {
+        TMMDB_DBG_CARP("decode_one src_key:%s\n", src_key);
+        query_key_init(&k, src_key, strtol(src_key, NULL, 10));
+        if (!query_step(mmdb, &decode, &k)) {
+            memset(result, 0, sizeof(TMMDB_return_s));  // not found.
+            goto end;
+        }
+    }
+    memcpy(result, &decode.data, sizeof(TMMDB_return_s));
+ end:
+    // params belongs to the caller, who ends it
+    return TMMDB_SUCCESS;
+}
+
+// a non negative decimal number or -1
+LOCAL int parse_index(const char *key)
+{
+    long idx = 0;
+    if (!*key)
+        return -1;
+    for (; *key; key++) {
+        if (*key < '0' || *key > '9' || idx > INT_MAX / 10)
+            return -1;
+        idx = idx * 10 + *key - '0';
+    }
+    return idx > INT_MAX ? -1 : idx;
+}
+
+int TMMDB_compile_query(TMMDB_query_s ** query, const char *const *keys)
+{
+    int count = 0;
+    size_t strings = 0;
+    for (; keys[count]; count++)
+        strings += strlen(keys[count]) + 1;
+
+    // one block for the query, the keys and a copy of the strings
+    TMMDB_query_s *q = *query = xcalloc(1, sizeof(TMMDB_query_s)
+                                        + count * sizeof(TMMDB_query_key_s)
+                                        + strings);
+    char *copy = (char *)&q->keys[count];
+    q->count = count;
+    for (int i = 0; i < count; i++) {
+        strcpy(copy, keys[i]);
+        query_key_init(&q->keys[i], copy, parse_index(copy));
+        copy += q->keys[i].len + 1;
+    }
+    return TMMDB_SUCCESS;
+}
+
+int TMMDB_query_value(TMMDB_entry_s * start, TMMDB_query_s const *query,
+                      TMMDB_return_s * result)
+{
+    TMMDB_decode_s decode;
+    TMMDB_s *mmdb = start->mmdb;
+    decode_one_follow(mmdb, start->offset, &decode);
+    for (int i = 0; i < query->count; i++) {
+        if (!query_step(mmdb, &decode, &query->keys[i])) {
+            memset(result, 0, sizeof(TMMDB_return_s));  // not found.
+            return TMMDB_SUCCESS;
+        }
+    }
+    memcpy(result, &decode.data, sizeof(TMMDB_return_s));
+    return TMMDB_SUCCESS;
+}
+
+void TMMDB_free_query(TMMDB_query_s * query)
+{
+    free(query);
+}
+
+// the state of one TMMDB_get_values call
+typedef struct {
+    TMMDB_s *mmdb;
+    TMMDB_query_s const *const *queries;
+    TMMDB_return_s *results;
+    int pending;                /* queries not found so far */
+} values_ctx_s;
+
+LOCAL void values_collect(values_ctx_s * ctx, TMMDB_decode_s * decode,
+                          const int *active, int n, int depth);
+
+// decode holds the value for the keys 0 - depth of the active queries.
+// Store the result for the queries ending here and descend for the others.
+// With skip, decode is moved behind the value like skip_hash_array does.
+LOCAL void values_found(values_ctx_s * ctx, TMMDB_decode_s * decode,
+                        const int *active, int n, int depth, int skip)
+{
+    int sub[n], m = 0;
+    for (int i = 0; i < n; i++) {
+        if (ctx->queries[active[i]]->count == depth + 1) {
+            memcpy(&ctx->results[active[i]], &decode->data,
+                   sizeof(TMMDB_return_s));
+            ctx->pending--;
+        } else {
+            sub[m++] = active[i];
+        }
+    }
+    if (m)
+        values_collect(ctx, decode, sub, m, depth + 1);
+    else if (skip)
+        skip_hash_array(ctx->mmdb, decode);
+}
+
+// walk the map or array in decode once and hand every value some of the
+// active queries want at depth to values_found. decode is behind the map or
+// array afterwards, unless all queries are done.
+LOCAL void values_collect(values_ctx_s * ctx, TMMDB_decode_s * decode,
+                          const int *active, int n, int depth)
+{
+    TMMDB_s *mmdb = ctx->mmdb;
+    TMMDB_decode_s key, value;
+    int sub[n];
+    int type = decode->data.type;
+    if (type != TMMDB_DTYPE_MAP && type != TMMDB_DTYPE_ARRAY)
+        return;
+
+    int size = decode->data.data_size;
+    for (int idx = 0; idx < size && ctx->pending; idx++) {
+        int m = 0;
+        if (type == TMMDB_DTYPE_MAP) {
+            decode_one(mmdb, decode->offset_to_next, &key);
+            uint32_t offset_to_value = key.offset_to_next;
+            if (key.data.type == TMMDB_DTYPE_PTR)
+                decode_one(mmdb, key.data.uinteger, &key);
+            for (int i = 0; i < n; i++)
+                if (key_matches(&ctx->queries[active[i]]->keys[depth],
+                                &key.data))
+                    sub[m++] = active[i];
+            decode_one(mmdb, offset_to_value, decode);
+        } else {
+            for (int i = 0; i < n; i++)
+                if (ctx->queries[active[i]]->keys[depth].idx == idx)
+                    sub[m++] = active[i];
+            decode_one(mmdb, decode->offset_to_next, decode);
+        }
+
+        if (m == 0) {
+            skip_hash_array(mmdb, decode);
+        } else if (decode->data.type == TMMDB_DTYPE_PTR) {
+            // the value is elsewhere, decode is behind the pointer already
+            decode_one(mmdb, decode->data.uinteger, &value);
+            values_found(ctx, &value, sub, m, depth, 0);
+        } else {
+            values_found(ctx, decode, sub, m, depth, 1);
+        }
+    }
+}
+
+int TMMDB_get_values(TMMDB_entry_s * start,
+                     TMMDB_query_s const *const *queries, int count,
+                     TMMDB_return_s * results)
+{
+    TMMDB_decode_s decode;
+    if (count <= 0)
+        return TMMDB_SUCCESS;
+
+    values_ctx_s ctx = {.mmdb = start->mmdb,.queries = queries,
+        .results = results,.pending = count
+    };
+    int active[count];
+    for (int i = 0; i < count; i++)
+        active[i] = i;
+    memset(results, 0, count * sizeof(TMMDB_return_s));   // not found.
+    decode_one_follow(ctx.mmdb, start->offset, &decode);
+    values_found(&ctx, &decode, active, count, -1, 0);
+    return TMMDB_SUCCESS;
+}
+
+// one cached record
+struct record_slot_s {
+    uint32_t offset;            /* the key, entry.offset */
+    int chain;                  /* next slot in the same bucket or -1 */
+    int prev, next;             /* LRU list, most recently used first */
+    int referenced;             /* CLOCK */
+};
+
+struct TMMDB_record_cache_s {
+    TMMDB_query_s **queries;    /* private copies */
+    int count;
+    int capacity;
+    int used;
+    int policy;
+    int *buckets;               /* first slot of every bucket or -1 */
+    int bucket_bits;
+    struct record_slot_s *slots;
+    TMMDB_return_s *values;     /* count values for every slot */
+    int head, tail;             /* LRU */
+    int hand;                   /* CLOCK */
+    uint64_t hits;
+    uint64_t misses;
+};
+
+LOCAL void free_record_cache(struct TMMDB_record_cache_s *cache)
+{
+    if (cache) {
+        for (int i = 0; i < cache->count; i++)
+            TMMDB_free_query(cache->queries[i]);
+        free(cache->queries);
+        free(cache->buckets);
+        free(cache->slots);
+        free(cache->values);
+        free(cache);
+    }
+}
+
+// private copies of queries for the caches, NULL terminated
+LOCAL TMMDB_query_s **copy_queries(TMMDB_query_s const *const *queries,
+                                   int count)
+{
+    TMMDB_query_s **copies = xcalloc(count + 1, sizeof(TMMDB_query_s *));
+    for (int i = 0; i < count; i++) {
+        const char *keys[queries[i]->count + 1];
+        for (int k = 0; k < queries[i]->count; k++)
+            keys[k] = queries[i]->keys[k].key;
+        keys[queries[i]->count] = NULL;
+        TMMDB_compile_query(&copies[i], keys);
+    }
+    return copies;
+}
+
+int TMMDB_enable_record_cache(TMMDB_s * mmdb,
+                              TMMDB_query_s const *const *queries, int count,
+                              int capacity, int policy)
+{
+    if (capacity < 0 || capacity > TMMDB_RECORD_CACHE_MAX_CAPACITY || count < 0
+        || (policy != TMMDB_CACHE_LRU && policy != TMMDB_CACHE_CLOCK))
+        return TMMDB_INVALIDARGUMENT;
+
+    free_record_cache(mmdb->record_cache);
+    mmdb->record_cache = NULL;
+    if (capacity == 0)
+        return TMMDB_SUCCESS;
+
+    struct TMMDB_record_cache_s *cache = xcalloc(1, sizeof(*cache));
+    cache->queries = copy_queries(queries, count);
+    cache->count = count;
+    cache->capacity = capacity;
+    cache->policy = policy;
+
+    // at least twice as many buckets as slots
+    size_t buckets = 2;
+    cache->bucket_bits = 1;
+    while (buckets < 2 * (size_t)capacity)
+        buckets <<= 1, cache->bucket_bits++;
+    cache->buckets = xmalloc(buckets * sizeof(int));
+    memset(cache->buckets, -1, buckets * sizeof(int));
+    cache->slots = xcalloc(capacity, sizeof(struct record_slot_s));
+    cache->values = xcalloc((size_t)capacity * (count ? count : 1),
+                            sizeof(TMMDB_return_s));
+    cache->head = cache->tail = -1;
+    mmdb->record_cache = cache;
+    return TMMDB_SUCCESS;
+}
+
+// the top bits of a multiplicative hash, all of them are mixed
+LOCAL TMMDB_INLINE size_t hash_offset(uint32_t offset, int bits)
+{
+    return (offset * 0x9e3779b97f4a7c15ULL) >> (64 - bits);
+}
+
+LOCAL TMMDB_INLINE uint32_t record_bucket(struct TMMDB_record_cache_s *cache,
+                                          uint32_t offset)
+{
+    return hash_offset(offset, cache->bucket_bits);
+}
+
+LOCAL void lru_unlink(struct TMMDB_record_cache_s *cache, int i)
+{
+    struct record_slot_s *s = &cache->slots[i];
+    if (s->prev >= 0)
+        cache->slots[s->prev].next = s->next;
+    else
+        cache->head = s->next;
+    if (s->next >= 0)
+        cache->slots[s->next].prev = s->prev;
+    else
+        cache->tail = s->prev;
+}
+
+LOCAL void lru_push_front(struct TMMDB_record_cache_s *cache, int i)
+{
+    struct record_slot_s *s = &cache->slots[i];
+    s->prev = -1;
+    s->next = cache->head;
+    if (cache->head >= 0)
+        cache->slots[cache->head].prev = i;
+    cache->head = i;
+    if (cache->tail < 0)
+        cache->tail = i;
+}
+
+// pick a slot for a new record, evict the old one if the cache is full
+LOCAL int record_victim(struct TMMDB_record_cache_s *cache)
+{
+    int i;
+    if (cache->used < cache->capacity)
+        return cache->used++;
+
+    if (cache->policy == TMMDB_CACHE_LRU) {
+        i = cache->tail;
+        lru_unlink(cache, i);
+    } else {
+        // second chance for every referenced slot
+        while (cache->slots[cache->hand].referenced) {
+            cache->slots[cache->hand].referenced = 0;
+            cache->hand = (cache->hand + 1) % cache->capacity;
+        }
+        i = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->capacity;
+    }
+
+    int *link = &cache->buckets[record_bucket(cache, cache->slots[i].offset)];
+    while (*link != i)
+        link = &cache->slots[*link].chain;
+    *link = cache->slots[i].chain;
+    return i;
+}
+
+int TMMDB_cached_values(TMMDB_entry_s * start, TMMDB_return_s * results)
+{
+    struct TMMDB_record_cache_s *cache = start->mmdb->record_cache;
+    if (!cache)
+        return TMMDB_INVALIDARGUMENT;
+
+    uint32_t b = record_bucket(cache, start->offset);
+    int i;
+    for (i = cache->buckets[b]; i >= 0; i = cache->slots[i].chain)
+        if (cache->slots[i].offset == start->offset)
+            break;
+
+    if (i >= 0) {
+        cache->hits++;
+        if (cache->policy == TMMDB_CACHE_LRU) {
+            if (cache->head != i) {
+                lru_unlink(cache, i);
+                lru_push_front(cache, i);
+            }
+        } else {
+            cache->slots[i].referenced = 1;
+        }
+        memcpy(results, &cache->values[(size_t)i * cache->count],
+               cache->count * sizeof(TMMDB_return_s));
+        return TMMDB_SUCCESS;
+    }
+
+    cache->misses++;
+    int err = TMMDB_get_values(start,
+                               (TMMDB_query_s const *const *)cache->queries,
+                               cache->count, results);
+    if (err != TMMDB_SUCCESS)
+        return err;
+
+    i = record_victim(cache);
+    cache->slots[i].offset = start->offset;
+    cache->slots[i].referenced = 0;
+    cache->slots[i].chain = cache->buckets[b];
+    cache->buckets[b] = i;
+    if (cache->policy == TMMDB_CACHE_LRU)
+        lru_push_front(cache, i);
+    memcpy(&cache->values[(size_t)i * cache->count], results,
+           cache->count * sizeof(TMMDB_return_s));
+    return TMMDB_SUCCESS;
+}
+
+void TMMDB_record_cache_stats(TMMDB_s * mmdb, uint64_t * hits,
+                              uint64_t * misses)
+{
+    struct TMMDB_record_cache_s *cache = mmdb->record_cache;
+    *hits = cache ? cache->hits : 0;
+    *misses = cache ? cache->misses : 0;
+}
+
+// TMMDB_build_hot_fields: the results of a few queries for every record of
+// the database, decoded once. The rows are in offset order, an open
+// addressing hash of the offsets finds the row of an entry.
+struct hot_slot_s {
+    uint32_t offset;            /* entry.offset, 0 for a free slot */
+    uint32_t row;
+};
+
+struct TMMDB_hot_fields_s {
+    TMMDB_query_s **queries;    /* private copies */
+    int count;                  /* values per row */
+    uint32_t rows;
+    uint32_t *offsets;          /* entry.offset of every row, sorted */
+    TMMDB_return_s *values;     /* count values for every row */
+    struct hot_slot_s *slots;
+    size_t slot_mask;
+    int slot_bits;
+};
+
+LOCAL void free_hot(struct TMMDB_hot_fields_s *hot)
+{
+    if (hot) {
+        for (int i = 0; i < hot->count; i++)
+            TMMDB_free_query(hot->queries[i]);
+        free(hot->queries);
+        free(hot->offsets);
+        free(hot->values);
+        free(hot->slots);
+        free(hot);
+    }
+}
+
+LOCAL void free_hot_fields(TMMDB_s * mmdb)
+{
+    free_hot(mmdb->hot_fields);
+    mmdb->hot_fields = NULL;
+    mmdb->hot_fields_size = 0;
+}
+
+LOCAL int cmp_uint32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// the entry.offset of every record in the tree, sorted and unique
+LOCAL int distinct_records(TMMDB_s * mmdb, uint32_t ** offsets,
+                           uint32_t * count)
+{
+    int rl = mmdb->full_record_size_bytes;
+    uint32_t data_size = mmdb->size - (uint32_t) mmdb->node_count * rl;
+    size_t n = 0, capacity = 1024;
+    uint32_t *o = xmalloc(capacity * sizeof(uint32_t));
+    for (uint32_t node = 0; node < (uint32_t) mmdb->node_count; node++) {
+        const uint8_t *p = &mmdb->file_in_mem_ptr[node * rl];
+        for (int bit = 0; bit < 2; bit++) {
+            uint32_t record = get_record(p, rl, bit);
+            if (record <= (uint32_t) mmdb->node_count)
+                continue;
+            if (record - mmdb->node_count >= data_size) {
+                free(o);
+                return TMMDB_CORRUPTDATABASE;
+            }
+            if (n == capacity)
+                o = xrealloc(o, (capacity *= 2) * sizeof(uint32_t));
+            o[n++] = record - mmdb->node_count;
+        }
+    }
+    qsort(o, n, sizeof(uint32_t), cmp_uint32);
+    size_t unique = 0;
+    for (size_t i = 0; i < n; i++)
+        if (!unique || o[i] != o[unique - 1])
+            o[unique++] = o[i];
+    *offsets = xrealloc(o, (unique ? unique : 1) * sizeof(uint32_t));
+    *count = unique;
+    return TMMDB_SUCCESS;
+}
+
+LOCAL TMMDB_INLINE size_t hot_slot(struct TMMDB_hot_fields_s *hot,
+                                   uint32_t offset)
+{
+    return hash_offset(offset, hot->slot_bits);
+}
+
+// the hash over hot->offsets, the rows are set already
+LOCAL void hot_index(TMMDB_s * mmdb, struct TMMDB_hot_fields_s *hot)
+{
+    // at least twice as many slots as rows
+    size_t slots = 2;
+    hot->slot_bits = 1;
+    while (slots < 2 * (size_t)hot->rows)
+        slots <<= 1, hot->slot_bits++;
+    hot->slot_mask = slots - 1;
+    hot->slots = xcalloc(slots, sizeof(struct hot_slot_s));
+    for (uint32_t row = 0; row < hot->rows; row++) {
+        size_t i = hot_slot(hot, hot->offsets[row]);
+        while (hot->slots[i].offset)
+            i = (i + 1) & hot->slot_mask;
+        hot->slots[i].offset = hot->offsets[row];
+        hot->slots[i].row = row;
+    }
+    mmdb->hot_fields_size = sizeof(*hot)
+        + (size_t)hot->rows * sizeof(uint32_t)
+        + (size_t)hot->rows * hot->count * sizeof(TMMDB_return_s)
+        + slots * sizeof(struct hot_slot_s);
+}
+
+int TMMDB_build_hot_fields(TMMDB_s * mmdb,
+                           TMMDB_query_s const *const *queries, int count)
+{
+    if (count < 0)
+        return TMMDB_INVALIDARGUMENT;
+    free_hot_fields(mmdb);
+    if (count == 0)
+        return TMMDB_SUCCESS;
+
+    struct TMMDB_hot_fields_s *hot = xcalloc(1, sizeof(*hot));
+    hot->queries = copy_queries(queries, count);
+    hot->count = count;
+    mmdb->hot_fields = hot;
+    int err = distinct_records(mmdb, &hot->offsets, &hot->rows);
+    if (err != TMMDB_SUCCESS) {
+        free_hot_fields(mmdb);
+        return err;
+    }
+    hot->values = xcalloc((size_t)hot->rows * count, sizeof(TMMDB_return_s));
+    for (uint32_t row = 0; row < hot->rows && err == TMMDB_SUCCESS; row++) {
+        TMMDB_entry_s entry = {.mmdb = mmdb,.offset = hot->offsets[row] };
+        err = TMMDB_get_values(&entry,
+                               (TMMDB_query_s const *const *)hot->queries,
+                               count, &hot->values[(size_t)row * count]);
+    }
+    if (err != TMMDB_SUCCESS) {
+        free_hot_fields(mmdb);
+        return err;
+    }
+    hot_index(mmdb, hot);
+    return TMMDB_SUCCESS;
+}
+
+// the row of start, count values like TMMDB_get_values returns them, or
+// NULL if there is no table or start is no record of the tree
+const TMMDB_return_s *TMMDB_hot_fields(TMMDB_entry_s const *start)
+{
+    struct TMMDB_hot_fields_s *hot = start->mmdb->hot_fields;
+    if (!hot || !start->offset)
+        return NULL;
+    for (size_t i = hot_slot(hot, start->offset);;
+         i = (i + 1) & hot->slot_mask) {
+        if (hot->slots[i].offset == start->offset)
+            return &hot->values[(size_t)hot->slots[i].row * hot->count];
+        if (!hot->slots[i].offset)
+            return NULL;
+    }
+}
+
+#define HOT_MAGIC "TMMDBHOT"
+#define HOT_VERSION (1)
+
+// the sidecar file starts with it. It is for the same database on the same
+// kind of machine, the values are TMMDB_return_s as they are in memory.
+struct hot_header_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t value_size;        /* sizeof(TMMDB_return_s) */
+    uint64_t db_size;
+    uint32_t node_count;
+    uint32_t build_epoch;
+    uint32_t count;
+    uint32_t rows;
+};
+
+LOCAL void hot_header(TMMDB_s * mmdb, struct hot_header_s *h, int count,
+                      uint32_t rows)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, HOT_MAGIC, 8);
+    h->version = HOT_VERSION;
+    h->value_size = sizeof(TMMDB_return_s);
+    h->db_size = mmdb->size;
+    h->node_count = mmdb->node_count;
+    h->build_epoch = get_uint_value(&mmdb->meta, KEYS("build_epoch"));
+    h->count = count;
+    h->rows = rows;
+}
+
+// strings and bytes point into the database, the file has their offset
+// + 1 from dataptr, 0 for NULL
+LOCAL TMMDB_INLINE int hot_has_ptr(const TMMDB_return_s * v)
+{
+    return v->offset && (v->type == TMMDB_DTYPE_UTF8_STRING
+                         || v->type == TMMDB_DTYPE_BYTES);
+}
+
+LOCAL int write_all(FILE * f, const void *data, size_t size)
+{
+    return fwrite(data, 1, size, f) == size ? TMMDB_SUCCESS : TMMDB_IOERROR;
+}
+
+int TMMDB_save_hot_fields(TMMDB_s * mmdb, const char *fname)
+{
+    struct TMMDB_hot_fields_s *hot = mmdb->hot_fields;
+    if (!hot)
+        return TMMDB_INVALIDARGUMENT;
+    FILE *f = fopen(fname, "wb");
+    if (!f)
+        return TMMDB_OPENFILEERROR;
+    struct hot_header_s h;
+    hot_header(mmdb, &h, hot->count, hot->rows);
+    int err = write_all(f, &h, sizeof(h));
+    for (int i = 0; i < hot->count && err == TMMDB_SUCCESS; i++) {
+        uint32_t keys = hot->queries[i]->count;
+        err = write_all(f, &keys, sizeof(keys));
+        for (uint32_t k = 0; k < keys && err == TMMDB_SUCCESS; k++) {
+            uint32_t len = hot->queries[i]->keys[k].len;
+            err = write_all(f, &len, sizeof(len));
+            if (err == TMMDB_SUCCESS)
+                err = write_all(f, hot->queries[i]->keys[k].key, len);
+        }
+    }
+    if (err == TMMDB_SUCCESS)
+        err = write_all(f, hot->offsets, hot->rows * sizeof(uint32_t));
+    size_t n = (size_t)hot->rows * hot->count;
+    for (size_t i = 0; i < n && err == TMMDB_SUCCESS; i++) {
+        TMMDB_return_s v = hot->values[i];
+        if (hot_has_ptr(&v))
+            v.ptr = (const void *)(uintptr_t) (v.ptr
+                                               ? (const uint8_t *)v.ptr -
+                                               mmdb->dataptr + 1 : 0);
+        err = write_all(f, &v, sizeof(v));
+    }
+    if (fclose(f) && err == TMMDB_SUCCESS)
+        err = TMMDB_IOERROR;
+    return err;
+}
+
+LOCAL int read_all(FILE * f, void *data, size_t size)
+{
+    return fread(data, 1, size, f) == size ? TMMDB_SUCCESS : TMMDB_IOERROR;
+}
+
+// TMMDB_INVALIDDATABASE if the file is for another database or other
+// queries, build the table then
+int TMMDB_load_hot_fields(TMMDB_s * mmdb,
+                          TMMDB_query_s const *const *queries, int count,
+                          const char *fname)
+{
+    if (count <= 0)
+        return TMMDB_INVALIDARGUMENT;
+    FILE *f = fopen(fname, "rb");
+    if (!f)
+        return TMMDB_OPENFILEERROR;
+    struct hot_header_s h, expect;
+    int err = read_all(f, &h, sizeof(h));
+    hot_header(mmdb, &expect, count, h.rows);
+    if (err == TMMDB_SUCCESS && memcmp(&h, &expect, sizeof(h)))
+        err = TMMDB_INVALIDDATABASE;
+    for (int i = 0; i < count && err == TMMDB_SUCCESS; i++) {
+        uint32_t keys;
+        err = read_all(f, &keys, sizeof(keys));
+        if (err == TMMDB_SUCCESS && keys != (uint32_t) queries[i]->count)
+            err = TMMDB_INVALIDDATABASE;
+        for (uint32_t k = 0; k < keys && err == TMMDB_SUCCESS; k++) {
+            uint32_t len;
+            char key[256];
+            err = read_all(f, &len, sizeof(len));
+            if (err == TMMDB_SUCCESS
+                && (len != (uint32_t) queries[i]->keys[k].len
+                    || len > sizeof(key)))
+                err = TMMDB_INVALIDDATABASE;
+            if (err == TMMDB_SUCCESS)
+                err = read_all(f, key, len);
+            if (err == TMMDB_SUCCESS
+                && memcmp(key, queries[i]->keys[k].key, len))
+                err = TMMDB_INVALIDDATABASE;
+        }
+    }
+    // every row is a record of the tree, the file holds all of them. Checked
+    // before rows sizes the allocations.
+    struct stat st;
+    long pos = ftell(f);
+    if (err == TMMDB_SUCCESS
+        && ((uint64_t) h.rows > 2ULL * mmdb->node_count
+            || pos < 0 || fstat(fileno(f), &st)
+            || (uint64_t) st.st_size - pos != (uint64_t) h.rows
+            * (sizeof(uint32_t) + (uint64_t) count * sizeof(TMMDB_return_s))))
+        err = TMMDB_INVALIDDATABASE;
+    if (err != TMMDB_SUCCESS) {
+        fclose(f);
+        return err == TMMDB_IOERROR ? TMMDB_INVALIDDATABASE : err;
+    }
+
+    // the old table stays until the new one is complete
+    struct TMMDB_hot_fields_s *hot = xcalloc(1, sizeof(*hot));
+    hot->queries = copy_queries(queries, count);
+    hot->count = count;
+    hot->rows = h.rows;
+    hot->offsets = xmalloc((h.rows ? h.rows : 1) * sizeof(uint32_t));
+    hot->values = xcalloc((size_t)h.rows * count, sizeof(TMMDB_return_s));
+    err = read_all(f, hot->offsets, (size_t)h.rows * sizeof(uint32_t));
+    if (err == TMMDB_SUCCESS)
+        err = read_all(f, hot->values,
+                       (size_t)h.rows * count * sizeof(TMMDB_return_s));
+    fclose(f);
+    uint32_t data_size = mmdb->size
+        - (uint32_t) mmdb->node_count * mmdb->full_record_size_bytes;
+    for (size_t i = 0; i < (size_t)h.rows * count && err == TMMDB_SUCCESS;
+         i++) {
+        TMMDB_return_s *v = &hot->values[i];
+        if (!hot_has_ptr(v))
+            continue;
+        uintptr_t offset = (uintptr_t) v->ptr;
+        if (offset > data_size || v->data_size < 0
+            || (offset && offset - 1 + v->data_size > data_size))
+            err = TMMDB_INVALIDDATABASE;
+        else
+            v->ptr = offset ? mmdb->dataptr + offset - 1 : NULL;
+    }
+    for (uint32_t row = 0; row < h.rows && err == TMMDB_SUCCESS; row++)
+        if (!hot->offsets[row] || hot->offsets[row] >= data_size)
+            err = TMMDB_INVALIDDATABASE;
+    if (err != TMMDB_SUCCESS) {
+        free_hot(hot);
+        return err == TMMDB_IOERROR ? TMMDB_INVALIDDATABASE : err;
+    }
+    free_hot_fields(mmdb);
+    mmdb->hot_fields = hot;
+    hot_index(mmdb, hot);
+    return TMMDB_SUCCESS;
+}
+
+LOCAL char *buffer_reserve(TMMDB_buffer_s * buf, size_t n)
+{
+    if (buf->len + n + 1 > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity * 2 : 1024;
+        while (capacity < buf->len + n + 1)
+            capacity *= 2;
+        buf->data = xrealloc(buf->data, capacity);
+        buf->capacity = capacity;
+    }
+    return buf->data + buf->len;
+}
+
+LOCAL TMMDB_INLINE void buffer_put(TMMDB_buffer_s * buf, const void *p,
+                                   size_t n)
+{
+    memcpy(buffer_reserve(buf, n), p, n);
+    buf->len += n;
+}
+
+LOCAL TMMDB_INLINE void buffer_putc(TMMDB_buffer_s * buf, char c)
+{
+    *buffer_reserve(buf, 1) = c;
+    buf->len++;
+}
+
+void TMMDB_buffer_append(TMMDB_buffer_s * buf, const void *data, size_t len)
+{
+    buffer_put(buf, data, len);
+    buf->data[buf->len] = '\0';
+}
+
+void TMMDB_free_buffer(TMMDB_buffer_s * buf)
+{
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->capacity = 0;
+}
+
+LOCAL uint64_t get_uint64(const uint8_t * p)
+{
+    return (uint64_t) load_uint32(p) << 32 | load_uint32(p + 4);
+}
+
+LOCAL const char digit_pairs[201] =
+    "00010203040506070809" "10111213141516171819"
+    "20212223242526272829" "30313233343536373839"
+    "40414243444546474849" "50515253545556575859"
+    "60616263646566676869" "70717273747576777879"
+    "80818283848586878889" "90919293949596979899";
+
+// decimal digits of v, two at a time. Returns the length ( max 20 ).
+LOCAL int format_uint64(char *out, uint64_t v)
+{
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    while (v >= 100) {
+        p -= 2;
+        memcpy(p, &digit_pairs[(v % 100) * 2], 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, &digit_pairs[v * 2], 2);
+    } else {
+        *--p = '0' + v;
+    }
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(out, p, len);
+    return len;
+}
+
+// decimal digits of the 16 byte big endian number p. Returns the length
+// ( max 39 ).
+LOCAL int format_uint128(char *out, const uint8_t * p)
+{
+    uint32_t w[4];
+    uint32_t chunks[5];         /* base 10^9, least significant first */
+    int n = 0;
+    for (int i = 0; i < 4; i++)
+        w[i] = load_uint32(p + 4 * i);
+    do {
+        uint64_t rem = 0;
+        for (int i = 0; i < 4; i++) {
+            uint64_t cur = rem << 32 | w[i];
+            w[i] = cur / 1000000000U;
+            rem = cur % 1000000000U;
+        }
+        chunks[n++] = rem;
+    } while (w[0] || w[1] || w[2] || w[3]);
+
+    int len = format_uint64(out, chunks[--n]);
+    while (n-- > 0) {
+        char tmp[20];
+        int l = format_uint64(tmp, chunks[n]);
+        memset(out + len, '0', 9 - l);  // leading zeros of the chunk
+        memcpy(out + len + 9 - l, tmp, l);
+        len += 9;
+    }
+    return len;
+}
+
+LOCAL TMMDB_INLINE int json_needs_escape(uint8_t c)
+{
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+// a JSON string, the runs without escapes are copied in one go
+LOCAL void json_string(TMMDB_buffer_s * buf, const uint8_t * p, int len)
+{
+    static const char hex[] = "0123456789abcdef";
+    buffer_putc(buf, '"');
+    const uint8_t *end = p + len;
+    while (p < end) {
+        const uint8_t *run = p;
+        while (p < end && !json_needs_escape(*p))
+            p++;
+        if (p > run)
+            buffer_put(buf, run, p - run);
+        if (p == end)
+            break;
+
+        char esc[6] = { '\\', *p };
+        int esc_len = 2;
+        switch (*p) {
+        case '"':
+        case '\\':
+            break;
+        case '\b':
+            esc[1] = 'b';
+            break;
+        case '\f':
+            esc[1] = 'f';
+            break;
+        case '\n':
+            esc[1] = 'n';
+            break;
+        case '\r':
+            esc[1] = 'r';
+            break;
+        case '\t':
+            esc[1] = 't';
+            break;
+        default:
+            memcpy(esc + 1, "u00", 3);
+            esc[4] = hex[*p >> 4];
+            esc[5] = hex[*p & 15];
+            esc_len = 6;
+        }
+        buffer_put(buf, esc, esc_len);
+        p++;
+    }
+    buffer_putc(buf, '"');
+}
+
+typedef struct {
+    TMMDB_buffer_s *buf;
+    int first;                  /* no comma before the next element */
+} json_ctx_s;
+
+LOCAL TMMDB_INLINE void json_separator(json_ctx_s * j)
+{
+    if (!j->first)
+        buffer_putc(j->buf, ',');
+    j->first = 0;
+}
+
+LOCAL int json_begin_map(void *ctx, int size)
+{
+    json_ctx_s *j = ctx;
+    json_separator(j);
+    buffer_putc(j->buf, '{');
+    j->first = 1;
+    return TMMDB_SUCCESS;
+}
+
+LOCAL int json_end_map(void *ctx)
+{
+    json_ctx_s *j = ctx;
+    buffer_putc(j->buf, '}');
+    j->first = 0;
+    return TMMDB_SUCCESS;
+}
+
+LOCAL int json_begin_array(void *ctx, int size)
+{
+    json_ctx_s *j = ctx;
+    json_separator(j);
+    buffer_putc(j->buf, '[');
+    j->first = 1;
+    return TMMDB_SUCCESS;
+}
+
+LOCAL int json_end_array(void *ctx)
+{
+    json_ctx_s *j = ctx;
+    buffer_putc(j->buf, ']');
+    j->first = 0;
+    return TMMDB_SUCCESS;
+}
+
+LOCAL int json_key(void *ctx, const char *key, int len)
+{
+    json_ctx_s *j = ctx;
+    json_separator(j);
+    json_string(j->buf, (const uint8_t *)key, len);
+    buffer_putc(j->buf, ':');
+    j->first = 1;               // the value follows without a comma
+    return TMMDB_SUCCESS;
+}
+
+// a small unsigned bignum for the shortest digits of a double, least
+// significant word first. 40 words hold the ~1130 bits a double needs.
+#define BIG_WORDS (40)
+typedef struct {
+    int n;                      /* used words, no leading zero words */
+    uint32_t w[BIG_WORDS];
+} big_s;
+
+LOCAL void big_set(big_s * b, uint64_t v)
+{
+    b->w[0] = v;
+    b->w[1] = v >> 32;
+    b->n = b->w[1] ? 2 : b->w[0] ? 1 : 0;
+}
+
+LOCAL void big_shl(big_s * b, int bits)
+{
+    int words = bits / 32, sh = bits % 32;
+    if (!b->n)
         return;
+    assert(b->n + words + 1 <= BIG_WORDS);
+    b->w[b->n + words] = 0;
+    for (int i = b->n - 1; i >= 0; i--) {
+        uint64_t v = (uint64_t) b->w[i] << sh;
+        b->w[i + words + 1] |= v >> 32;
+        b->w[i + words] = v;
     }
+    memset(b->w, 0, words * sizeof(uint32_t));
+    b->n += words + 1;
+    if (!b->w[b->n - 1])
+        b->n--;
+}
 
-    if ((type == TMMDB_DTYPE_UINT32) || (type == TMMDB_DTYPE_UINT16)) {
-        decode->data.uinteger = get_uintX(&mem[offset], size);
-    } else if (type == TMMDB_DTYPE_INT32) {
-        decode->data.sinteger = get_sintX(&mem[offset], size);
-    } else if (type == TMMDB_DTYPE_UINT64) {
-        assert(size >= 0 && size <= 8);
-        memset(decode->data.c8, 0, 8);
-        if (size > 0)
-            memcpy(decode->data.c8 + 8 - size, &mem[offset], size);
-    } else if (type == TMMDB_DTYPE_UINT128) {
-        assert(size >= 0 && size <= 16);
-        memset(decode->data.c16, 0, 16);
-        if (size > 0)
-            memcpy(decode->data.c16 + 16 - size, &mem[offset], size);
-    } else if (type == TMMDB_DTYPE_IEEE754_FLOAT) {
-        size = 4;
-        decode->data.float_value = get_ieee754_float(&mem[offset]);
-    } else if (type == TMMDB_DTYPE_IEEE754_DOUBLE) {
-        size = 8;
-        decode->data.double_value = get_ieee754_double(&mem[offset]);
+LOCAL void big_mul(big_s * b, uint32_t m)
+{
+    uint64_t carry = 0;
+    for (int i = 0; i < b->n; i++) {
+        carry += (uint64_t) b->w[i] * m;
+        b->w[i] = carry;
+        carry >>= 32;
+    }
+    if (carry) {
+        assert(b->n < BIG_WORDS);
+        b->w[b->n++] = carry;
+    }
+}
+
+LOCAL void big_mul_pow10(big_s * b, int e)
+{
+    static const uint32_t pow10[] = { 1, 10, 100, 1000, 10000, 100000,
+        1000000, 10000000, 100000000, 1000000000
+    };
+    for (; e >= 9; e -= 9)
+        big_mul(b, pow10[9]);
+    big_mul(b, pow10[e]);
+}
+
+LOCAL int big_cmp(const big_s * a, const big_s * b)
+{
+    if (a->n != b->n)
+        return a->n < b->n ? -1 : 1;
+    for (int i = a->n - 1; i >= 0; i--)
+        if (a->w[i] != b->w[i])
+            return a->w[i] < b->w[i] ? -1 : 1;
+    return 0;
+}
+
+// a + b compared with c
+LOCAL int big_cmp_sum(const big_s * a, const big_s * b, const big_s * c)
+{
+    big_s sum;
+    uint64_t carry = 0;
+    int n = a->n > b->n ? a->n : b->n;
+    for (int i = 0; i < n; i++) {
+        carry += (uint64_t) (i < a->n ? a->w[i] : 0) + (i < b->n ? b->w[i] : 0);
+        sum.w[i] = carry;
+        carry >>= 32;
+    }
+    sum.n = n;
+    if (carry)
+        sum.w[sum.n++] = carry;
+    return big_cmp(&sum, c);
+}
+
+// a -= b, a >= b
+LOCAL void big_sub(big_s * a, const big_s * b)
+{
+    uint32_t borrow = 0;
+    for (int i = 0; i < a->n; i++) {
+        uint64_t sub = (uint64_t) (i < b->n ? b->w[i] : 0) + borrow;
+        borrow = a->w[i] < sub;
+        a->w[i] -= (uint32_t) sub;
+    }
+    while (a->n && !a->w[a->n - 1])
+        a->n--;
+}
+
+LOCAL TMMDB_INLINE uint64_t big_get(const big_s * b)
+{
+    return b->n == 0 ? 0 : b->n == 1 ? b->w[0]
+        : (uint64_t) b->w[1] << 32 | b->w[0];
+}
+
+// the digit loop of shortest_digits for a scale below 2^59, r, mp and mm
+// stay below 10 * s in it
+LOCAL int small_digits(char *digits, uint64_t r, uint64_t s, uint64_t mp,
+                       uint64_t mm, int even)
+{
+    int n = 0;
+    for (;;) {
+        r *= 10;
+        mp *= 10;
+        mm *= 10;
+        int d = r / s;
+        r %= s;
+        int low = r < mm || (even && r == mm);
+        int high = r + mp > s || (even && r + mp == s);
+        if (low && high)
+            d += 2 * r >= s;    // the closer one
+        else if (high)
+            d++;
+        digits[n++] = '0' + d;
+        if (low || high)
+            return n;
+    }
+}
+
+// the shortest digits that read back as f * 2^e, the free-format
+// algorithm of Burger and Dybvig. mbits is the mantissa size with the
+// hidden bit, min_e the exponent of the denormals. Returns the number of
+// digits, the value is 0.digits * 10^*k.
+LOCAL int shortest_digits(char *digits, int *k, uint64_t f, int e,
+                          int mbits, int min_e)
+{
+    big_s r, s, mp, mm;         /* value, scale and the gaps above/below */
+    int even = !(f & 1);        /* a reader rounds ties to even */
+    int boundary = f == 1ULL << (mbits - 1) && e > min_e;
+    if (e >= 0) {
+        big_set(&r, f);
+        big_shl(&r, e + 1 + boundary);
+        big_set(&s, 2 << boundary);
+        big_set(&mp, 1);
+        big_shl(&mp, e + boundary);
+        big_set(&mm, 1);
+        big_shl(&mm, e);
     } else {
-        decode->data.ptr = &mem[offset];
-        decode->data.data_size = size;
+        big_set(&r, f << (1 + boundary));
+        big_set(&s, 1);
+        big_shl(&s, 1 + boundary - e);
+        big_set(&mp, 1 << boundary);
+        big_set(&mm, 1);
+    }
+
+    // an estimate of the decimal exponent from the binary one that is
+    // never too big, the loop below fixes it up
+    int bits = 0;
+    for (uint64_t t = f; t; t >>= 1)
+        bits++;
+    double est = (e + bits - 1) * 0.30102999566398114 - 1e-10;
+    int kk = (int)est + (est > (int)est);
+    if (kk >= 0) {
+        big_mul_pow10(&s, kk);
+    } else {
+        big_mul_pow10(&r, -kk);
+        big_mul_pow10(&mp, -kk);
+        big_mul_pow10(&mm, -kk);
+    }
+    for (int c; (c = big_cmp_sum(&r, &mp, &s)) > 0 || (even && c == 0);
+         kk++)
+        big_mul(&s, 10);
+    *k = kk;
+    if (s.n < 2 || (s.n == 2 && s.w[1] < 1U << 27))
+        return small_digits(digits, big_get(&r), big_get(&s), big_get(&mp),
+                            big_get(&mm), even);
+
+    int n = 0;
+    for (;;) {
+        big_mul(&r, 10);
+        big_mul(&mp, 10);
+        big_mul(&mm, 10);
+        int d = 0;
+        while (big_cmp(&r, &s) >= 0) {
+            big_sub(&r, &s);
+            d++;
+        }
+        int c = big_cmp(&r, &mm);
+        int low = c < 0 || (even && c == 0);
+        c = big_cmp_sum(&r, &mp, &s);
+        int high = c > 0 || (even && c == 0);
+        if (low && high)
+            d += big_cmp_sum(&r, &r, &s) >= 0;  // the closer one
+        else if (high)
+            d++;
+        digits[n++] = '0' + d;
+        if (low || high)
+            return n;
+    }
+}
+
+// the shortest number that reads back as the same double or float, the
+// way %g writes it but without the locale and the padding digits.
+LOCAL void json_number(TMMDB_buffer_s * buf, int neg, uint64_t f, int e,
+                       int mbits, int min_e)
+{
+    char *out = buffer_reserve(buf, 32), *p = out;
+    if (neg)
+        *p++ = '-';
+    if (!f) {
+        *p++ = '0';
+        buf->len += p - out;
+        return;
+    }
+    char digits[20];
+    int k, n = shortest_digits(digits, &k, f, e, mbits, min_e);
+    int x = k - 1;              /* of d.ddd * 10^x */
+    if (x < -4 || x >= 17) {
+        *p++ = digits[0];
+        if (n > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, n - 1);
+            p += n - 1;
+        }
+        *p++ = 'e';
+        *p++ = x < 0 ? '-' : '+';
+        x = x < 0 ? -x : x;
+        if (x >= 100)
+            *p++ = '0' + x / 100;
+        memcpy(p, &digit_pairs[x % 100 * 2], 2);
+        p += 2;
+    } else if (x < 0) {
+        memcpy(p, "0.0000", 1 - x);
+        p += 1 - x;
+        memcpy(p, digits, n);
+        p += n;
+    } else if (n <= x + 1) {
+        memcpy(p, digits, n);
+        memset(p + n, '0', x + 1 - n);
+        p += x + 1;
+    } else {
+        memcpy(p, digits, x + 1);
+        p[x + 1] = '.';
+        memcpy(p + x + 2, digits + x + 1, n - x - 1);
+        p += n + 1;
+    }
+    buf->len += p - out;
+}
+
+LOCAL void json_double(TMMDB_buffer_s * buf, double v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    int exp = bits >> 52 & 0x7ff;
+    uint64_t f = bits & ((1ULL << 52) - 1);
+    if (exp == 0x7ff)
+        buffer_put(buf, "null", 4);     // NaN and Inf are not JSON
+    else
+        json_number(buf, bits >> 63, exp ? f | 1ULL << 52 : f,
+                    (exp ? exp : 1) - 1075, 53, -1074);
+}
+
+LOCAL void json_float(TMMDB_buffer_s * buf, float v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    int exp = bits >> 23 & 0xff;
+    uint32_t f = bits & ((1U << 23) - 1);
+    if (exp == 0xff)
+        buffer_put(buf, "null", 4);
+    else
+        json_number(buf, bits >> 31, exp ? f | 1U << 23 : f,
+                    (exp ? exp : 1) - 150, 24, -149);
+}
+
+LOCAL int json_value(void *ctx, TMMDB_return_s const *value)
+{
+    json_ctx_s *j = ctx;
+    TMMDB_buffer_s *buf = j->buf;
+    json_separator(j);
+    switch (value->type) {
+    case TMMDB_DTYPE_UTF8_STRING:
+        json_string(buf, value->ptr, value->data_size);
+        break;
+    case TMMDB_DTYPE_BYTES:
+        {
+            // JSON has no bytes, we write them as a hex string
+            static const char hex[] = "0123456789abcdef";
+            const uint8_t *p = value->ptr;
+            char *out = buffer_reserve(buf, 2 + 2 * value->data_size);
+            *out++ = '"';
+            for (int i = 0; i < value->data_size; i++) {
+                *out++ = hex[p[i] >> 4];
+                *out++ = hex[p[i] & 15];
+            }
+            *out = '"';
+            buf->len += 2 + 2 * value->data_size;
+        }
+        break;
+    case TMMDB_DTYPE_IEEE754_DOUBLE:
+        json_double(buf, value->double_value);
+        break;
+    case TMMDB_DTYPE_IEEE754_FLOAT:
+        json_float(buf, value->float_value);
+        break;
+    case TMMDB_DTYPE_UINT16:
+    case TMMDB_DTYPE_UINT32:
+        buf->len += format_uint64(buffer_reserve(buf, 20), value->uinteger);
+        break;
+    case TMMDB_DTYPE_INT32:
+        if (value->sinteger < 0) {
+            buffer_putc(buf, '-');
+            buf->len += format_uint64(buffer_reserve(buf, 20),
+                                      -(int64_t) value->sinteger);
+        } else {
+            buf->len += format_uint64(buffer_reserve(buf, 20),
+                                      value->sinteger);
+        }
+        break;
+    case TMMDB_DTYPE_UINT64:
+        buf->len += format_uint64(buffer_reserve(buf, 20),
+                                  get_uint64(value->c8));
+        break;
+    case TMMDB_DTYPE_UINT128:
+        buf->len += format_uint128(buffer_reserve(buf, 40), value->c16);
+        break;
+    case TMMDB_DTYPE_BOOLEAN:
+        if (value->uinteger)
+            buffer_put(buf, "true", 4);
+        else
+            buffer_put(buf, "false", 5);
+        break;
+    default:
+        buffer_put(buf, "null", 4);
+        break;
+    }
+    return TMMDB_SUCCESS;
+}
+
+LOCAL const TMMDB_visitor_s json_visitor = {
+    .begin_map = json_begin_map,.end_map = json_end_map,
+    .begin_array = json_begin_array,.end_array = json_end_array,
+    .key = json_key,.value = json_value
+};
+
+int TMMDB_record_to_json(TMMDB_entry_s * start, TMMDB_buffer_s * buf)
+{
+    json_ctx_s j = {.buf = buf,.first = 1 };
+    int err = TMMDB_walk(start, &json_visitor, &j);
+    buffer_reserve(buf, 0)[0] = '\0';
+    return err;
+}
+
+// the state of a walk over all networks
+typedef struct {
+    TMMDB_s *mmdb;
+    TMMDB_network_cb cb;
+    TMMDB_network_format_cb format;     /* used with out if set */
+    TMMDB_buffer_s *out;
+    void *ctx;
+    TMMDB_network_s net;        /* the prefix of the current node */
+} networks_s;
+
+// ::ffff:0:0/96 and friends lead to the IPv4 subtree too. We report it once,
+// for ::/96.
+LOCAL TMMDB_INLINE int is_ipv4_alias(TMMDB_s * mmdb, uint32_t node, int depth,
+                                     const uint8_t * ip)
+{
+    static const uint8_t zero[12];
+    return mmdb->ipv4_start_bits == 96 && node == mmdb->ipv4_start_node
+        && (depth != 96 || memcmp(ip, zero, 12));
+}
+
+LOCAL TMMDB_INLINE void set_bit(uint8_t * ip, int bit, int value)
+{
+    if (value)
+        ip[bit >> 3] |= 0x80 >> (bit & 7);
+    else
+        ip[bit >> 3] &= ~(0x80 >> (bit & 7));
+}
+
+// report all networks below record, depth bits of w->net.ip are the prefix
+LOCAL int networks(networks_s * w, uint32_t record, int depth)
+{
+    TMMDB_s *mmdb = w->mmdb;
+    if (record >= mmdb->node_count) {
+        if (record == mmdb->node_count)
+            return TMMDB_SUCCESS;       // no data for this network
+        w->net.netmask = depth;
+        w->net.offset = record - mmdb->node_count;
+        return w->format ? w->format(w->ctx, &w->net, w->out)
+            : w->cb(w->ctx, &w->net);
     }
-    decode->offset_to_next = offset + size;
-    TMMDB_DBG_CARP("decode_one type:%d size:%d\n", type, size);
+    if (depth >= mmdb->depth)
+        return TMMDB_CORRUPTDATABASE;
+    if (is_ipv4_alias(mmdb, record, depth, w->net.ip))
+        return TMMDB_SUCCESS;
 
-    return;
+    int rl = mmdb->full_record_size_bytes;
+    const uint8_t *p = &mmdb->file_in_mem_ptr[record * rl];
+    FD_RET_ON_ERR(networks(w, get_record(p, rl, 0), depth + 1));
+    set_bit(w->net.ip, depth, 1);
+    int err = networks(w, get_record(p, rl, 1), depth + 1);
+    set_bit(w->net.ip, depth, 0);
+    return err;
 }
 
-LOCAL void skip_hash_array(TMMDB_s * mmdb, TMMDB_decode_s * decode)
+int TMMDB_foreach_network(TMMDB_s * mmdb, TMMDB_network_cb cb, void *ctx)
 {
-    if (decode->data.type == TMMDB_DTYPE_MAP) {
-        int size = decode->data.data_size;
-        while (size-- > 0) {
-            decode_one(mmdb, decode->offset_to_next, decode);   // key
-            decode_one(mmdb, decode->offset_to_next, decode);   // value
-            skip_hash_array(mmdb, decode);
-        }
+    networks_s w = {.mmdb = mmdb,.cb = cb,.ctx = ctx };
+    return networks(&w, 0, 0);
+}
 
-    } else if (decode->data.type == TMMDB_DTYPE_ARRAY) {
-        int size = decode->data.data_size;
-        while (size-- > 0) {
-            decode_one(mmdb, decode->offset_to_next, decode);   // value
-            skip_hash_array(mmdb, decode);
+// an independent part of the tree for TMMDB_foreach_network_parallel
+typedef struct {
+    uint32_t record;
+    int depth;
+    uint8_t ip[16];
+    int done;
+    int err;
+    TMMDB_buffer_s out;
+} network_task_s;
+
+typedef struct {
+    TMMDB_s *mmdb;
+    TMMDB_network_format_cb format;
+    void *ctx;
+    network_task_s *tasks;
+    int count;
+    int next;                   /* next task to run */
+    int flushed;                /* tasks written so far */
+    int window;                 /* max tasks ahead of flushed */
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} network_pool_s;
+
+// one task for every record at depth split_bits or above
+LOCAL int network_tasks(network_pool_s * pool, uint32_t record, int depth,
+                        uint8_t * ip, int split_bits, int *capacity)
+{
+    TMMDB_s *mmdb = pool->mmdb;
+    if (record == mmdb->node_count
+        || (record < mmdb->node_count
+            && is_ipv4_alias(mmdb, record, depth, ip)))
+        return TMMDB_SUCCESS;
+
+    if (record > mmdb->node_count || depth == split_bits) {
+        if (pool->count == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 64;
+            pool->tasks = xrealloc(pool->tasks,
+                                   *capacity * sizeof(network_task_s));
         }
+        network_task_s *t = &pool->tasks[pool->count++];
+        memset(t, 0, sizeof(*t));
+        t->record = record;
+        t->depth = depth;
+        memcpy(t->ip, ip, 16);
+        return TMMDB_SUCCESS;
     }
+
+    int rl = mmdb->full_record_size_bytes;
+    const uint8_t *p = &mmdb->file_in_mem_ptr[record * rl];
+    FD_RET_ON_ERR(network_tasks(pool, get_record(p, rl, 0), depth + 1, ip,
+                                split_bits, capacity));
+    set_bit(ip, depth, 1);
+    int err = network_tasks(pool, get_record(p, rl, 1), depth + 1, ip,
+                            split_bits, capacity);
+    set_bit(ip, depth, 0);
+    return err;
 }
 
-LOCAL void DPRINT_KEY(TMMDB_s * mmdb, TMMDB_return_s * data)
+LOCAL void *network_worker(void *arg)
 {
-    uint8_t str[256];
-    int len = data->data_size > 255 ? 255 : data->data_size;
+    network_pool_s *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        // do not run too far ahead of the output
+        while (!pool->stop && pool->next < pool->count
+               && pool->next >= pool->flushed + pool->window)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        if (pool->stop || pool->next >= pool->count)
+            break;
+        network_task_s *t = &pool->tasks[pool->next++];
+        pthread_mutex_unlock(&pool->lock);
 
-    memcpy(str, data->ptr, len);
-    str[len] = '\0';
-    fprintf(stderr, "%s\n", str);
-}
+        networks_s w = {.mmdb = pool->mmdb,.format = pool->format,
+            .out = &t->out,.ctx = pool->ctx
+        };
+        memcpy(w.net.ip, t->ip, 16);
+        int err = networks(&w, t->record, t->depth);
 
-const char *TMMDB_lib_version(void)
-{
-    return PACKAGE_VERSION;
+        pthread_mutex_lock(&pool->lock);
+        t->err = err;
+        t->done = 1;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
 }
 
-int TMMDB_get_tree(TMMDB_entry_s * start, TMMDB_decode_all_s ** decode_all)
+int TMMDB_foreach_network_parallel(TMMDB_s * mmdb, int threads,
+                                   int split_bits,
+                                   TMMDB_network_format_cb format,
+                                   TMMDB_network_flush_cb flush, void *ctx)
 {
-    TMMDB_decode_all_s *decode = *decode_all = TMMDB_alloc_decode_all();
-    return get_tree(start->mmdb, start->offset, decode);
-}
+    if (threads < 1 || split_bits < 0 || split_bits > 24)
+        return TMMDB_INVALIDARGUMENT;
+    if (split_bits > mmdb->depth)
+        split_bits = mmdb->depth;
 
-LOCAL int get_tree(TMMDB_s * mmdb, uint32_t offset, TMMDB_decode_all_s * decode)
-{
-    decode_one(mmdb, offset, &decode->decode);
+    uint8_t ip[16] = { 0 };
+    int capacity = 0;
+    network_pool_s pool = {.mmdb = mmdb,.format = format,.ctx = ctx,
+        .window = 4 * threads
+    };
+    int err = network_tasks(&pool, 0, 0, ip, split_bits, &capacity);
+    if (err != TMMDB_SUCCESS) {
+        free(pool.tasks);
+        return err;
+    }
 
-    if (decode->decode.data.type == TMMDB_DTYPE_PTR) {
-        // skip pointer silently
-        TMMDB_DBG_CARP("Skip ptr\n");
-        uint32_t tmp = decode->decode.offset_to_next;
-        uint32_t last_offset;
-        while (decode->decode.data.type == TMMDB_DTYPE_PTR) {
-            decode_one(mmdb, last_offset =
-                       decode->decode.data.uinteger, &decode->decode);
-        }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+    pthread_t tid[threads];
+    int started = 0;
+    for (; started < threads; started++)
+        if (pthread_create(&tid[started], NULL, network_worker, &pool))
+            break;
+    if (!started) {
+        // no threads, do it ourself
+        pool.window = pool.count;
+        network_worker(&pool);
+    }
 
-        if (decode->decode.data.type == TMMDB_DTYPE_ARRAY
-            || decode->decode.data.type == TMMDB_DTYPE_MAP) {
-            get_tree(mmdb, last_offset, decode);
-        }
-        decode->decode.offset_to_next = tmp;
-        return TMMDB_SUCCESS;
+    // write the output in tree order
+    for (int i = 0; i < pool.count; i++) {
+        network_task_s *t = &pool.tasks[i];
+        pthread_mutex_lock(&pool.lock);
+        while (!t->done)
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+
+        if (err == TMMDB_SUCCESS)
+            err = t->err;
+        if (err == TMMDB_SUCCESS && t->out.len)
+            err = flush(ctx, &t->out);
+        TMMDB_free_buffer(&t->out);
 
+        pthread_mutex_lock(&pool.lock);
+        pool.flushed++;
+        if (err != TMMDB_SUCCESS)
+            pool.stop = 1;
+        pthread_cond_broadcast(&pool.cond);
+        pthread_mutex_unlock(&pool.lock);
+        if (err != TMMDB_SUCCESS)
+            break;
     }
 
-    switch (decode->decode.data.type) {
+    for (int i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+    // tasks started before the stop may have output left
+    for (int i = 0; i < pool.count; i++)
+        TMMDB_free_buffer(&pool.tasks[i].out);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.cond);
+    free(pool.tasks);
+    return err;
+}
 
-    case TMMDB_DTYPE_ARRAY:
-        {
-            int array_size = decode->decode.data.data_size;
-            TMMDB_DBG_CARP("Decode array with %d entries\n", array_size);
-            uint32_t array_offset = decode->decode.offset_to_next;
-            TMMDB_decode_all_s *previous = decode;
-            // decode->indent = 1;
-            while (array_size-- > 0) {
-                TMMDB_decode_all_s *decode_to = previous->next =
-                    TMMDB_alloc_decode_all();
-                get_tree(mmdb, array_offset, decode_to);
-                array_offset = decode_to->decode.offset_to_next;
-                while (previous->next)
-                    previous = previous->next;
+// a database that TMMDB_handle_reload replaces while other threads look up.
+// Every thread announces the database it uses in its hazard slot, a
+// replaced database is retired and closed by the first release, reload or
+// check that finds no slot holding it. Readers never wait, a release only
+// tries the lock.
+struct TMMDB_hazard_s {
+    TMMDB_s *mmdb;              /* in use by owner, NULL if none */
+    int depth;                  /* nested acquires, only owner touches it */
+    pthread_t owner;
+    struct TMMDB_hazard_s *next;
+};
 
-            }
-            decode->decode.offset_to_next = array_offset;
+struct TMMDB_retired_s {
+    TMMDB_s *mmdb;
+    struct TMMDB_retired_s *next;
+};
 
-        }
-        break;
-    case TMMDB_DTYPE_MAP:
-        {
-            int size = decode->decode.data.data_size;
+struct TMMDB_handle_s {
+    TMMDB_s *current;
+    uint64_t id;                /* tells the thread local cache apart */
+    struct TMMDB_hazard_s *hazards;
+    pthread_mutex_t lock;       /* everything below */
+    struct TMMDB_retired_s *retired;    /* release reads it without lock */
+    char *fname;
+    uint32_t flags;
+    TMMDB_handle_setup_cb setup;        /* for every database opened */
+    void *setup_ctx;
+    dev_t dev;                  /* the file current was opened from */
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    int watching;
+    int stop;
+    pthread_cond_t wakeup;
+    pthread_t watcher;
+    int interval_ms;
+};
 
-#if TMMDB_DEBUG
-            int rnd = rand();
-            TMMDB_DBG_CARP("%u decode hash with %d keys\n", rnd, size);
-#endif
-            offset = decode->decode.offset_to_next;
-            TMMDB_decode_all_s *previous = decode;
-            while (size-- > 0) {
-                TMMDB_decode_all_s *decode_to = previous->next =
-                    TMMDB_alloc_decode_all();
-                get_tree(mmdb, offset, decode_to);
-                while (previous->next)
-                    previous = previous->next;
+static uint64_t handle_next_id;
+static __thread struct {
+    uint64_t id;
+    struct TMMDB_hazard_s *hazard;
+} handle_tls;
 
-#if TMMDB_DEBUG
-                TMMDB_DBG_CARP("key num: %d (%u)", size, rnd);
-                DPRINT_KEY(mmdb, &decode_to->decode.data);
-#endif
+// the slot of the calling thread, the first call of a thread adds it
+LOCAL struct TMMDB_hazard_s *hazard_slot(TMMDB_handle_s * handle)
+{
+    if (handle_tls.id == handle->id)
+        return handle_tls.hazard;
+    pthread_t self = pthread_self();
+    struct TMMDB_hazard_s *hazard = ATOMIC_LOAD(&handle->hazards, ACQUIRE);
+    while (hazard && !pthread_equal(hazard->owner, self))
+        hazard = hazard->next;
+    if (!hazard) {
+        hazard = xcalloc(1, sizeof(struct TMMDB_hazard_s));
+        hazard->owner = self;
+        hazard->next = ATOMIC_LOAD(&handle->hazards, RELAXED);
+        while (!ATOMIC_CAS(&handle->hazards, &hazard->next, hazard)) ;
+    }
+    handle_tls.id = handle->id;
+    handle_tls.hazard = hazard;
+    return hazard;
+}
 
-                offset = decode_to->decode.offset_to_next;
-                decode_to = previous->next = TMMDB_alloc_decode_all();
-                get_tree(mmdb, offset, decode_to);
-                while (previous->next)
-                    previous = previous->next;
-                offset = decode_to->decode.offset_to_next;
-            }
-            decode->decode.offset_to_next = offset;
+// close the replaced databases no thread uses anymore, with handle->lock
+LOCAL void reclaim(TMMDB_handle_s * handle)
+{
+    struct TMMDB_retired_s **r = &handle->retired;
+    while (*r) {
+        // sequentially consistent with the store of current and the hazard
+        // in TMMDB_handle_acquire: a reader that missed the new current
+        // has its hazard visible here. Acquire, the reads of a released
+        // database happen before its close.
+        struct TMMDB_hazard_s *hazard = ATOMIC_LOAD(&handle->hazards, ACQUIRE);
+        while (hazard && ATOMIC_LOAD(&hazard->mmdb, SEQ_CST) != (*r)->mmdb)
+            hazard = hazard->next;
+        if (hazard) {
+            r = &(*r)->next;
+            continue;
         }
-        break;
-    default:
-        break;
+        struct TMMDB_retired_s *done = *r;
+        ATOMIC_STORE(r, done->next, RELAXED);
+        TMMDB_close(done->mmdb);
+        free(done);
     }
-    return TMMDB_SUCCESS;
 }
 
-int TMMDB_dump(TMMDB_s * mmdb, TMMDB_decode_all_s * decode_all, int indent)
+LOCAL int file_changed(TMMDB_handle_s * handle, const struct stat *s)
 {
-    while (decode_all) {
-        decode_all = dump(mmdb, decode_all, indent);
+    return s->st_dev != handle->dev || s->st_ino != handle->ino
+        || s->st_size != handle->size || s->st_mtime != handle->mtime;
+}
+
+// the file current was opened from, only set after a successful open
+LOCAL void set_file_id(TMMDB_handle_s * handle, const struct stat *s)
+{
+    handle->dev = s->st_dev;
+    handle->ino = s->st_ino;
+    handle->size = s->st_size;
+    handle->mtime = s->st_mtime;
+}
+
+int TMMDB_handle_open(TMMDB_handle_s ** handleptr, const char *fname,
+                      uint32_t flags)
+{
+    *handleptr = NULL;
+    TMMDB_handle_s *handle = xcalloc(1, sizeof(TMMDB_handle_s));
+    struct stat s;
+    int err = open_file(&handle->current, fname, flags, &s);
+    if (err == TMMDB_SUCCESS)
+        set_file_id(handle, &s);
+    if (err != TMMDB_SUCCESS) {
+        free(handle);
+        return err;
     }
-    // not sure about the return type right now
+    handle->fname = xstrdup(fname);
+    handle->flags = flags;
+    handle->id = __atomic_add_fetch(&handle_next_id, 1, __ATOMIC_RELAXED);
+    pthread_mutex_init(&handle->lock, NULL);
+    pthread_cond_init(&handle->wakeup, NULL);
+    *handleptr = handle;
     return TMMDB_SUCCESS;
 }
 
-LOCAL void silly_pindent(int i)
+// the current database, valid until TMMDB_handle_release. Calls nest, the
+// inner ones return the database of the outermost.
+TMMDB_s *TMMDB_handle_acquire(TMMDB_handle_s * handle)
 {
-    char buffer[1024];
-    int size = i >= 1024 ? 1023 : i;
-    memset(buffer, 32, size);
-    buffer[size] = '\0';
-    fputs(buffer, stderr);
+    struct TMMDB_hazard_s *hazard = hazard_slot(handle);
+    if (hazard->depth++)
+        return hazard->mmdb;
+    TMMDB_s *mmdb = ATOMIC_LOAD(&handle->current, ACQUIRE);
+    for (;;) {
+        ATOMIC_STORE(&hazard->mmdb, mmdb, SEQ_CST);
+        // still current after the hazard is visible, reclaim sees it
+        TMMDB_s *again = ATOMIC_LOAD(&handle->current, SEQ_CST);
+        if (again == mmdb)
+            return mmdb;
+        mmdb = again;
+    }
 }
 
-LOCAL TMMDB_decode_all_s *dump(TMMDB_s * mmdb, TMMDB_decode_all_s * decode_all,
-                              int indent)
+// the last release of a replaced database closes it, unless another thread
+// holds the lock. Then that thread, or the next release, reload or check
+// does.
+void TMMDB_handle_release(TMMDB_handle_s * handle)
 {
-    switch (decode_all->decode.data.type) {
-    case TMMDB_DTYPE_MAP:
-        {
-            int size = decode_all->decode.data.data_size;
-            for (decode_all = decode_all->next; size && decode_all; size--) {
-                decode_all = dump(mmdb, decode_all, indent + 2);
-                decode_all = dump(mmdb, decode_all, indent + 2);
-            }
-        }
-        break;
-    case TMMDB_DTYPE_ARRAY:
-        {
-            int size = decode_all->decode.data.data_size;
-            for (decode_all = decode_all->next; size && decode_all; size--) {
-                decode_all = dump(mmdb, decode_all, indent + 2);
-            }
-        }
-        break;
-    case TMMDB_DTYPE_UTF8_STRING:
-    case TMMDB_DTYPE_BYTES:
-        silly_pindent(indent);
-        DPRINT_KEY(mmdb, &decode_all->decode.data);
-        decode_all = decode_all->next;
-        break;
-    case TMMDB_DTYPE_IEEE754_DOUBLE:
-        silly_pindent(indent);
-        fprintf(stdout, "%f\n", decode_all->decode.data.double_value);
-        decode_all = decode_all->next;
-        break;
-    case TMMDB_DTYPE_IEEE754_FLOAT:
-        silly_pindent(indent);
-        fprintf(stdout, "%f\n", decode_all->decode.data.float_value);
-        decode_all = decode_all->next;
-        break;
-    case TMMDB_DTYPE_UINT16:
-    case TMMDB_DTYPE_UINT32:
-    case TMMDB_DTYPE_BOOLEAN:
-        silly_pindent(indent);
-        fprintf(stdout, "%u\n", decode_all->decode.data.uinteger);
-        decode_all = decode_all->next;
-        break;
-    case TMMDB_DTYPE_UINT64:
-    case TMMDB_DTYPE_UINT128:
-        silly_pindent(indent);
-        fprintf(stdout, "Some UINT64 or UINT128 data\n");
-        //fprintf(stderr, "%u\n", decode_all->decode.data.uinteger);
-        decode_all = decode_all->next;
-        break;
-    case TMMDB_DTYPE_INT32:
-        silly_pindent(indent);
-        fprintf(stdout, "%d\n", decode_all->decode.data.sinteger);
-        decode_all = decode_all->next;
-        break;
-    default:
-        TMMDB_DBG_CARP("decode_one UNIPLEMENTED type:%d\n",
-                       decode_all->decode.data.type);
-        assert(0);
+    struct TMMDB_hazard_s *hazard = hazard_slot(handle);
+    if (hazard->depth <= 0 || --hazard->depth)
+        return;
+    // seq_cst with the push in reload: either reload's reclaim sees the
+    // cleared hazard or this sees the retired database
+    ATOMIC_STORE(&hazard->mmdb, NULL, SEQ_CST);
+    if (ATOMIC_LOAD(&handle->retired, SEQ_CST)
+        && !pthread_mutex_trylock(&handle->lock)) {
+        reclaim(handle);
+        pthread_mutex_unlock(&handle->lock);
     }
-    return decode_all;
 }
 
-TMMDB_decode_all_s *TMMDB_alloc_decode_all(void)
+LOCAL int reload(TMMDB_handle_s * handle, const char *fname)
 {
-    return xcalloc(1, sizeof(TMMDB_decode_all_s));
+    TMMDB_s *mmdb;
+    struct stat s;
+    int err = open_file(&mmdb, fname, handle->flags, &s);
+    if (err == TMMDB_SUCCESS && handle->setup
+        && (err = handle->setup(handle->setup_ctx, mmdb)) != TMMDB_SUCCESS)
+        TMMDB_close(mmdb);
+    if (err != TMMDB_SUCCESS)
+        return err;
+    set_file_id(handle, &s);
+    struct TMMDB_retired_s *old = xmalloc(sizeof(struct TMMDB_retired_s));
+    old->mmdb = handle->current;
+    old->next = handle->retired;
+    ATOMIC_STORE(&handle->retired, old, SEQ_CST);
+    ATOMIC_STORE(&handle->current, mmdb, SEQ_CST);
+    reclaim(handle);
+    return TMMDB_SUCCESS;
 }
 
-void TMMDB_free_decode_all(TMMDB_decode_all_s * freeme)
+// runs setup on the current database and on every database a reload opens,
+// before it becomes current. Call it before other threads use the handle.
+// Returns the error of setup, a reload fails with it.
+int TMMDB_handle_setup(TMMDB_handle_s * handle, TMMDB_handle_setup_cb setup,
+                       void *ctx)
 {
-    if (freeme == NULL)
-        return;
-    if (freeme->next)
-        TMMDB_free_decode_all(freeme->next);
-    free(freeme);
+    pthread_mutex_lock(&handle->lock);
+    handle->setup = setup;
+    handle->setup_ctx = ctx;
+    int err = setup ? setup(ctx, handle->current) : TMMDB_SUCCESS;
+    pthread_mutex_unlock(&handle->lock);
+    return err;
 }
 
-LOCAL void decode_one_follow(TMMDB_s * mmdb, uint32_t offset,
-                             TMMDB_decode_s * decode)
+// opens fname, or the file of the handle for NULL, and makes it current.
+// The old database is closed once no thread holds it, by the last release
+// or the next reload or check. If the open fails the handle keeps its
+// database and its file.
+int TMMDB_handle_reload(TMMDB_handle_s * handle, const char *fname)
 {
-    decode_one(mmdb, offset, decode);
-    if (decode->data.type == TMMDB_DTYPE_PTR)
-        decode_one(mmdb, decode->data.uinteger, decode);
+    pthread_mutex_lock(&handle->lock);
+    if (!fname)
+        fname = handle->fname;
+    int err = reload(handle, fname);
+    if (err == TMMDB_SUCCESS && fname != handle->fname
+        && strcmp(fname, handle->fname)) {
+        free(handle->fname);
+        handle->fname = xstrdup(fname);
+    }
+    pthread_mutex_unlock(&handle->lock);
+    return err;
 }
 
-int TMMDB_vget_value(TMMDB_entry_s * start, TMMDB_return_s * result,
-                     va_list params)
+// reloads if the file was replaced or changed since current was opened.
+// Returns 1 for a reload, 0 if the file is the same or missing, or the error
+// of TMMDB_open, the old database stays current then.
+int TMMDB_handle_check(TMMDB_handle_s * handle)
 {
-    TMMDB_decode_s decode, key, value;
-    TMMDB_s *mmdb = start->mmdb;
-    uint32_t offset = start->offset;
-    char *src_key;              // = va_arg(params, char *);
-    int src_keylen;
-    while ((src_key = va_arg(params, char *))) {
-        TMMDB_DBG_CARP("decode_one src_key:%s\n", src_key);
-        decode_one(mmdb, offset, &decode);
- donotdecode:
-        src_keylen = strlen(src_key);
-        switch (decode.data.type) {
-        case TMMDB_DTYPE_PTR:
-            // we follow the pointer
-            decode_one(mmdb, decode.data.uinteger, &decode);
-            break;
+    pthread_mutex_lock(&handle->lock);
+    struct stat s;
+    int err = 0;
+    // a failed open is tried again by the next check
+    if (stat(handle->fname, &s) == 0 && file_changed(handle, &s)) {
+        err = reload(handle, handle->fname);
+        if (err == TMMDB_SUCCESS)
+            err = 1;
+    } else {
+        reclaim(handle);
+    }
+    pthread_mutex_unlock(&handle->lock);
+    return err;
+}
 
-            // learn to skip this
-        case TMMDB_DTYPE_ARRAY:
-            {
-                int size = decode.data.data_size;
-                int offset = strtol(src_key, NULL, 10);
-                if (offset >= size || offset < 0) {
-                    result->offset = 0; // not found.
-                    goto end;
-                }
-                for (int i = 0; i < offset; i++) {
-                    decode_one(mmdb, decode.offset_to_next, &decode);
-                    skip_hash_array(mmdb, &decode);
-                }
-                if ((src_key = va_arg(params, char *))) {
-                    decode_one_follow(mmdb, decode.offset_to_next, &decode);
-                    offset = decode.offset_to_next;
-                    goto donotdecode;
-                }
-                decode_one_follow(mmdb, decode.offset_to_next, &value);
-                memcpy(result, &value.data, sizeof(TMMDB_return_s));
-                goto end;
-            }
-            break;
-        case TMMDB_DTYPE_MAP:
-            {
-                int size = decode.data.data_size;
-                // printf("decode hash with %d keys\n", size);
-                offset = decode.offset_to_next;
-                while (size-- > 0) {
-                    decode_one(mmdb, offset, &key);
-
-                    uint32_t offset_to_value = key.offset_to_next;
-
-                    if (key.data.type == TMMDB_DTYPE_PTR) {
-                        // while (key.data.type == TMMDB_DTYPE_PTR) {
-                        decode_one(mmdb, key.data.uinteger, &key);
-                        // }
-                    }
-
-                    assert(key.data.type == TMMDB_DTYPE_BYTES ||
-                           key.data.type == TMMDB_DTYPE_UTF8_STRING);
-
-                    if (key.data.data_size == src_keylen &&
-                        !memcmp(src_key, key.data.ptr, src_keylen)) {
-                        if ((src_key = va_arg(params, char *))) {
-                            // DPRINT_KEY(&key.data);
-                            decode_one_follow(mmdb, offset_to_value, &decode);
-                            offset = decode.offset_to_next;
-
-                            goto donotdecode;
-                        }
-                        // found it!
-                        decode_one_follow(mmdb, offset_to_value, &value);
-                        memcpy(result, &value.data, sizeof(TMMDB_return_s));
-                        goto end;
-                    } else {
-                        // we search for another key skip  this
-                        decode_one(mmdb, offset_to_value, &value);
-                        skip_hash_array(mmdb, &value);
-                        offset = value.offset_to_next;
-                    }
-                }
-                // not found!! do something
-                //DPRINT_KEY(&key.data);
-                //
-                result->offset = 0;     // not found.
-                goto end;
-            }
-        default:
-            break;
+LOCAL void *watch(void *arg)
+{
+    TMMDB_handle_s *handle = arg;
+    pthread_mutex_lock(&handle->lock);
+    while (!handle->stop) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += handle->interval_ms / 1000;
+        until.tv_nsec += handle->interval_ms % 1000 * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
         }
+        pthread_cond_timedwait(&handle->wakeup, &handle->lock, &until);
+        if (handle->stop)
+            break;
+        pthread_mutex_unlock(&handle->lock);
+        TMMDB_handle_check(handle);
+        pthread_mutex_lock(&handle->lock);
     }
- end:
-    va_end(params);
-    return TMMDB_SUCCESS;
+    pthread_mutex_unlock(&handle->lock);
+    return NULL;
+}
+
+// a thread that calls TMMDB_handle_check every interval_ms until
+// TMMDB_handle_close
+int TMMDB_handle_watch(TMMDB_handle_s * handle, int interval_ms)
+{
+    if (interval_ms < 1)
+        return TMMDB_INVALIDARGUMENT;
+    pthread_mutex_lock(&handle->lock);
+    int err = TMMDB_SUCCESS;
+    handle->interval_ms = interval_ms;
+    if (!handle->watching) {
+        if (pthread_create(&handle->watcher, NULL, watch, handle))
+            err = TMMDB_OUTOFMEMORY;
+        else
+            handle->watching = 1;
+    }
+    pthread_mutex_unlock(&handle->lock);
+    return err;
+}
+
+// no thread may use the handle or a database of it anymore
+void TMMDB_handle_close(TMMDB_handle_s * handle)
+{
+    if (!handle)
+        return;
+    if (handle->watching) {
+        pthread_mutex_lock(&handle->lock);
+        handle->stop = 1;
+        pthread_cond_signal(&handle->wakeup);
+        pthread_mutex_unlock(&handle->lock);
+        pthread_join(handle->watcher, NULL);
+    }
+    while (handle->retired) {
+        struct TMMDB_retired_s *done = handle->retired;
+        handle->retired = done->next;
+        TMMDB_close(done->mmdb);
+        free(done);
+    }
+    while (handle->hazards) {
+        struct TMMDB_hazard_s *done = handle->hazards;
+        handle->hazards = done->next;
+        free(done);
+    }
+    TMMDB_close(handle->current);
+    pthread_mutex_destroy(&handle->lock);
+    pthread_cond_destroy(&handle->wakeup);
+    free(handle->fname);
+    free(handle);
 }
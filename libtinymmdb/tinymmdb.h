@@ -6,6 +6,7 @@ extern "C" {
 #endif
 #define _GNU_SOURCE
 #include <sys/types.h>
+#include <stdarg.h>
 //#include <sys/socket.h>
 #include <netinet/in.h>
 //#include <arpa/inet.h>
@@ -42,10 +43,37 @@ extern "C" {
 /* flags */
 #define TMMDB_MODE_NOOP (0)
 #define TMMDB_MODE_STANDARD     TMMDB_MODE_NOOP
-#define TMMDB_MODE_MEMORY_CACHE TMMDB_MODE_NOOP
+#define TMMDB_MODE_MEMORY_CACHE (2)
 #define TMMDB_MODE_MEMORY_MAP (3)
 #define TMMDB_MODE_MASK (7)
 
+/* options, or them with one of the modes above */
+#define TMMDB_OPT_JUMP_TABLE (8)
+#define TMMDB_OPT_PREFIX_CACHE (16)
+#define TMMDB_OPT_POPULATE (32)
+#define TMMDB_OPT_ADVISE (64)
+#define TMMDB_OPT_HUGE_PAGES (128)
+#define TMMDB_OPT_RANGE_TABLE (256)
+#define TMMDB_OPT_STRIDE_TRIE (512)
+
+#define TMMDB_JUMP_TABLE_DEFAULT_BITS (16)
+#define TMMDB_JUMP_TABLE_MAX_BITS (24)
+
+#define TMMDB_PREFIX_CACHE_DEFAULT_BITS (14)
+#define TMMDB_PREFIX_CACHE_MAX_BITS (24)
+
+#define TMMDB_RANGE_TABLE_DEFAULT_MAX (1 << 24)
+
+#define TMMDB_STRIDE_TRIE_DEFAULT_TOP_BITS (16)
+#define TMMDB_STRIDE_TRIE_MAX_TOP_BITS (24)
+
+#define TMMDB_STATS_LATENCY_BUCKETS (32)
+
+/* eviction policies for TMMDB_enable_record_cache */
+#define TMMDB_CACHE_LRU (0)
+#define TMMDB_CACHE_CLOCK (1)
+#define TMMDB_RECORD_CACHE_MAX_CAPACITY (1 << 28)
+
 /* err codes */
 #define TMMDB_SUCCESS (0)
 #define TMMDB_OPENFILEERROR (-1)
@@ -54,6 +82,7 @@ extern "C" {
 #define TMMDB_IOERROR (-4)
 #define TMMDB_OUTOFMEMORY (-5)
 #define TMMDB_UNKNOWNDATABASEFMT (-6)
+#define TMMDB_INVALIDARGUMENT (-7)
 
 /* Looks better */
 #define TMMDB_TRUE (1)
@@ -102,8 +131,39 @@ extern "C" {
         uint8_t *meta_data_content;
         struct TMMDB_s *fake_metadata_db;
         TMMDB_entry_s meta;     // should change to entry_s
+        const struct TMMDB_walker_s *walker;    /* lookup functions for the record size */
+        uint32_t ipv4_start_node;       /* node for ::/96 or the record if the search ends earlier */
+        int ipv4_start_bits;    /* bits to reach ipv4_start_node, 0 for IPv4 databases */
+        int ipv4_mapped_alias;  /* ::ffff:0:0/96 leads to ipv4_start_node too */
+        struct TMMDB_jump_s *jump_table;        /* optional, see TMMDB_OPT_JUMP_TABLE */
+        int jump_bits;
+        size_t jump_table_size; /* bytes */
+        struct TMMDB_record_cache_s *record_cache;      /* optional, see TMMDB_enable_record_cache */
+        struct TMMDB_prefix_cache_s *prefix_cache;      /* optional, see TMMDB_OPT_PREFIX_CACHE */
+        size_t prefix_cache_size;       /* bytes */
+        struct TMMDB_stats_head_s *stats;       /* optional, see TMMDB_enable_stats */
+        size_t mapped_size;     /* bytes mapped at file_in_mem_ptr */
+        struct TMMDB_hot_fields_s *hot_fields;  /* optional, see TMMDB_build_hot_fields */
+        size_t hot_fields_size; /* bytes */
+        struct TMMDB_range_table_s *range_table;        /* optional, see TMMDB_OPT_RANGE_TABLE */
+        size_t range_table_size;        /* bytes */
+        struct TMMDB_stride_s *stride_trie;     /* optional, see TMMDB_OPT_STRIDE_TRIE */
+        size_t stride_trie_size;        /* bytes */
     } TMMDB_s;
 
+// a database that can be replaced while other threads use it
+    typedef struct TMMDB_handle_s TMMDB_handle_s;
+
+// counters of TMMDB_stats_snapshot, summed over all threads
+    typedef struct TMMDB_stats_s {
+        uint64_t lookups;
+        uint64_t depth[129];    /* lookups by the netmask they reached */
+        uint64_t pointers;      /* pointers followed by the decoder */
+        uint64_t keys_compared; /* map keys compared to find a key */
+        uint64_t bytes_skipped; /* data skipped to reach a key */
+        uint64_t latency[TMMDB_STATS_LATENCY_BUCKETS];  /* lookups by ns, bucket i is 2^i - 2^(i+1) - 1 */
+    } TMMDB_stats_s;
+
 // this is the result for every field
     typedef struct TMMDB_return_s {
         /* return values */
@@ -134,14 +194,140 @@ extern "C" {
         struct TMMDB_decode_all_s *next;
     } TMMDB_decode_all_s;
 
+    // reusable memory for TMMDB_get_tree_arena, initialize it with { 0 }.
+    // The tree is one array in decode order, next points to the next element.
+    typedef struct TMMDB_arena_s {
+        TMMDB_decode_all_s *nodes;
+        size_t used;
+        size_t capacity;
+    } TMMDB_arena_s;
+
+    // one node of a flat tree, the children follow the node.
+    // subtree_end is the index behind the last node of the subtree.
+    typedef struct TMMDB_flat_node_s {
+        TMMDB_return_s data;
+        uint32_t subtree_end;
+    } TMMDB_flat_node_s;
+
+    // a decoded entry in pre-order, reusable. Initialize it with { 0 }.
+    typedef struct TMMDB_flat_tree_s {
+        TMMDB_flat_node_s *nodes;
+        size_t used;
+        size_t capacity;
+    } TMMDB_flat_tree_s;
+
+    // callbacks for TMMDB_walk, any of them may be NULL. Return
+    // TMMDB_SUCCESS to continue, anything else stops the walk.
+    typedef struct TMMDB_visitor_s {
+        int (*begin_map) (void *ctx, int size);
+        int (*end_map) (void *ctx);
+        int (*begin_array) (void *ctx, int size);
+        int (*end_array) (void *ctx);
+        int (*key) (void *ctx, const char *key, int len);
+        int (*value) (void *ctx, TMMDB_return_s const *value);  /* scalars */
+    } TMMDB_visitor_s;
+
+    // a growable output buffer, initialize it with { 0 }.
+    // data is NUL terminated, len does not count the NUL.
+    typedef struct TMMDB_buffer_s {
+        char *data;
+        size_t len;
+        size_t capacity;
+    } TMMDB_buffer_s;
+
+    // one network of the search tree
+    typedef struct TMMDB_network_s {
+        uint8_t ip[16];         /* network order, IPv4 databases use ip[0-3] */
+        int netmask;            /* 0 - depth */
+        uint32_t offset;        /* entry.offset of the data */
+    } TMMDB_network_s;
+
+    typedef int (*TMMDB_network_cb) (void *ctx,
+                                     TMMDB_network_s const *network);
+    typedef int (*TMMDB_network_format_cb) (void *ctx,
+                                            TMMDB_network_s const *network,
+                                            TMMDB_buffer_s * out);
+    typedef int (*TMMDB_network_flush_cb) (void *ctx, TMMDB_buffer_s * out);
+    typedef int (*TMMDB_handle_setup_cb) (void *ctx, TMMDB_s * mmdb);
+
+    // one key of a compiled query
+    typedef struct TMMDB_query_key_s {
+        const char *key;
+        int len;
+        int idx;                /* array index or -1 if key is not a number */
+        uint8_t first;          /* first byte of key, cheap prefilter */
+    } TMMDB_query_key_s;
+
+    // a key path like { "city", "names", "en", NULL } compiled once with
+    // TMMDB_compile_query and used for any number of entries.
+    typedef struct TMMDB_query_s {
+        int count;
+        TMMDB_query_key_s keys[];
+    } TMMDB_query_s;
+
     extern int TMMDB_open(TMMDB_s ** mmdbp, const char *fname, uint32_t flags);
+    extern int TMMDB_open_from_buffer(TMMDB_s ** mmdbp, const void *buffer,
+                                      size_t size, uint32_t flags);
     extern void TMMDB_close(TMMDB_s * mmdb);
     extern int TMMDB_lookup_by_ipnum(uint32_t ipnum, TMMDB_root_entry_s * res);
     extern int TMMDB_lookup_by_ipnum_128(struct in6_addr ipnum,
                                          TMMDB_root_entry_s * result);
+    extern int TMMDB_lookup_by_ipnum_v4(uint32_t ipnum,
+                                        TMMDB_root_entry_s * res);
+    extern int TMMDB_lookup_many_ipnum(TMMDB_s * mmdb, const uint32_t * ipnums,
+                                       int count, TMMDB_root_entry_s * res);
+    extern int TMMDB_lookup_many_ipnum_128(TMMDB_s * mmdb,
+                                           const struct in6_addr *ipnums,
+                                           int count,
+                                           TMMDB_root_entry_s * res);
+
+    extern int TMMDB_build_jump_table(TMMDB_s * mmdb, int bits);
+    extern int TMMDB_enable_prefix_cache(TMMDB_s * mmdb, int bits);
+    extern int TMMDB_build_range_table(TMMDB_s * mmdb, uint32_t max_ranges);
+    extern int TMMDB_build_stride_trie(TMMDB_s * mmdb, int top_bits);
+    extern size_t TMMDB_index_memory(TMMDB_s * mmdb);
+    extern int TMMDB_handle_open(TMMDB_handle_s ** handle, const char *fname,
+                                 uint32_t flags);
+    extern TMMDB_s *TMMDB_handle_acquire(TMMDB_handle_s * handle);
+    extern void TMMDB_handle_release(TMMDB_handle_s * handle);
+    extern int TMMDB_handle_setup(TMMDB_handle_s * handle,
+                                  TMMDB_handle_setup_cb setup, void *ctx);
+    extern int TMMDB_handle_reload(TMMDB_handle_s * handle, const char *fname);
+    extern int TMMDB_handle_check(TMMDB_handle_s * handle);
+    extern int TMMDB_handle_watch(TMMDB_handle_s * handle, int interval_ms);
+    extern void TMMDB_handle_close(TMMDB_handle_s * handle);
+    extern int TMMDB_enable_stats(TMMDB_s * mmdb);
+    extern int TMMDB_stats_snapshot(TMMDB_s * mmdb, TMMDB_stats_s * stats);
 
     extern int TMMDB_get_value(TMMDB_entry_s * start, TMMDB_return_s * result,
                                ...);
+    // the keys end with NULL, params is left to the caller's va_end
+    extern int TMMDB_vget_value(TMMDB_entry_s * start,
+                                TMMDB_return_s * result, va_list params);
+    extern int TMMDB_compile_query(TMMDB_query_s ** query,
+                                   const char *const *keys);
+    extern int TMMDB_query_value(TMMDB_entry_s * start,
+                                 TMMDB_query_s const *query,
+                                 TMMDB_return_s * result);
+    extern void TMMDB_free_query(TMMDB_query_s * query);
+    extern int TMMDB_get_values(TMMDB_entry_s * start,
+                                TMMDB_query_s const *const *queries,
+                                int count, TMMDB_return_s * results);
+    extern int TMMDB_enable_record_cache(TMMDB_s * mmdb,
+                                         TMMDB_query_s const *const *queries,
+                                         int count, int capacity, int policy);
+    extern int TMMDB_cached_values(TMMDB_entry_s * start,
+                                   TMMDB_return_s * results);
+    extern void TMMDB_record_cache_stats(TMMDB_s * mmdb, uint64_t * hits,
+                                         uint64_t * misses);
+    extern int TMMDB_build_hot_fields(TMMDB_s * mmdb,
+                                      TMMDB_query_s const *const *queries,
+                                      int count);
+    extern const TMMDB_return_s *TMMDB_hot_fields(TMMDB_entry_s const *start);
+    extern int TMMDB_save_hot_fields(TMMDB_s * mmdb, const char *fname);
+    extern int TMMDB_load_hot_fields(TMMDB_s * mmdb,
+                                     TMMDB_query_s const *const *queries,
+                                     int count, const char *fname);
     extern int TMMDB_strcmp_result(TMMDB_s * mmdb,
                                    TMMDB_return_s const *const result,
                                    char *str);
@@ -151,11 +337,37 @@ extern "C" {
                           int indent);
     extern int TMMDB_get_tree(TMMDB_entry_s * start,
                               TMMDB_decode_all_s ** decode_all);
+    extern int TMMDB_get_tree_arena(TMMDB_entry_s * start,
+                                    TMMDB_arena_s * arena,
+                                    TMMDB_decode_all_s ** decode_all);
+    extern void TMMDB_free_arena(TMMDB_arena_s * arena);
+    extern int TMMDB_get_flat_tree(TMMDB_entry_s * start,
+                                   TMMDB_flat_tree_s * tree);
+    extern void TMMDB_free_flat_tree(TMMDB_flat_tree_s * tree);
+    extern int TMMDB_walk(TMMDB_entry_s * start,
+                          TMMDB_visitor_s const *visitor, void *ctx);
+    extern int TMMDB_record_to_json(TMMDB_entry_s * start,
+                                    TMMDB_buffer_s * buf);
+    extern void TMMDB_buffer_append(TMMDB_buffer_s * buf, const void *data,
+                                    size_t len);
+    extern void TMMDB_free_buffer(TMMDB_buffer_s * buf);
+    extern int TMMDB_foreach_network(TMMDB_s * mmdb, TMMDB_network_cb cb,
+                                     void *ctx);
+    extern int TMMDB_foreach_network_parallel(TMMDB_s * mmdb, int threads,
+                                              int split_bits,
+                                              TMMDB_network_format_cb format,
+                                              TMMDB_network_flush_cb flush,
+                                              void *ctx);
     extern TMMDB_decode_all_s *TMMDB_alloc_decode_all(void);
     extern void TMMDB_free_decode_all(TMMDB_decode_all_s * freeme);
 
     extern int TMMDB_resolve_address(const char *host, int ai_family,
                                      int ai_flags, void *ip);
+    extern int TMMDB_parse_ipv4(const char *str, size_t len, uint32_t * ipnum);
+    extern int TMMDB_parse_ipv6(const char *str, size_t len,
+                                struct in6_addr *ip);
+    extern int TMMDB_parse_ip(TMMDB_s * mmdb, const char *str, size_t len,
+                              void *ip);
 
 #ifdef __cplusplus
 }
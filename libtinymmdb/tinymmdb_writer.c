@@ -0,0 +1,495 @@
+#include "tinymmdb_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOCAL static
+
+// records of the tree under construction, nodes are the index in nodes
+#define EMPTY_RECORD (0xffffffffU)
+#define DATA_RECORD (0x80000000U)
+#define IS_NODE(r) (!((r) & DATA_RECORD))
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+} wbuf_s;
+
+// keys already written, for TMMDB_writer_key
+typedef struct {
+    uint32_t *offsets;          /* offset of the string + 1, 0 is free */
+    uint32_t *lens;
+    uint32_t count;
+    uint32_t capacity;          /* power of 2 */
+} key_table_s;
+
+struct TMMDB_writer_s {
+    int depth;
+    int record_size;
+    uint32_t (*nodes)[2];
+    uint32_t node_count;
+    uint32_t node_capacity;
+    wbuf_s data;
+    key_table_s keys;
+};
+
+LOCAL void *xrealloc(void *ptr, size_t size)
+{
+    void *p = realloc(ptr, size);
+    if (!p)
+        abort();
+    return p;
+}
+
+LOCAL void *xcalloc(size_t count, size_t size)
+{
+    void *p = calloc(count, size);
+    if (!p)
+        abort();
+    return p;
+}
+
+LOCAL uint8_t *wbuf_reserve(wbuf_s * buf, size_t len)
+{
+    if (buf->len + len > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity : 4096;
+        while (capacity < buf->len + len)
+            capacity *= 2;
+        buf->data = xrealloc(buf->data, capacity);
+        buf->capacity = capacity;
+    }
+    uint8_t *p = buf->data + buf->len;
+    buf->len += len;
+    return p;
+}
+
+LOCAL void put_be(wbuf_s * buf, uint64_t v, int bytes)
+{
+    uint8_t *p = wbuf_reserve(buf, bytes);
+    for (int i = bytes - 1; i >= 0; i--, v >>= 8)
+        p[i] = v;
+}
+
+LOCAL int uint_bytes(uint64_t v)
+{
+    int bytes = 0;
+    for (; v; v >>= 8)
+        bytes++;
+    return bytes;
+}
+
+// control byte, the extended type and the size
+LOCAL uint32_t put_ctrl(wbuf_s * buf, int type, uint32_t size)
+{
+    uint32_t offset = buf->len;
+    int first = type > 7 ? 0 : type << 5;
+    if (size < 29) {
+        put_be(buf, first | size, 1);
+    } else if (size < 285) {
+        put_be(buf, first | 29, 1);
+    } else if (size < 65821) {
+        put_be(buf, first | 30, 1);
+    } else {
+        put_be(buf, first | 31, 1);
+    }
+    if (type > 7)
+        put_be(buf, type - 7, 1);
+    if (size >= 65821)
+        put_be(buf, size - 65821, 3);
+    else if (size >= 285)
+        put_be(buf, size - 285, 2);
+    else if (size >= 29)
+        put_be(buf, size - 29, 1);
+    return offset;
+}
+
+LOCAL uint32_t put_string(wbuf_s * buf, int type, const void *str, int len)
+{
+    uint32_t offset = put_ctrl(buf, type, len);
+    memcpy(wbuf_reserve(buf, len), str, len);
+    return offset;
+}
+
+LOCAL uint32_t put_uint(wbuf_s * buf, int type, uint64_t v)
+{
+    int bytes = uint_bytes(v);
+    uint32_t offset = put_ctrl(buf, type, bytes);
+    put_be(buf, v, bytes);
+    return offset;
+}
+
+LOCAL int pointer_size(uint32_t offset)
+{
+    return offset < 2048 ? 2 : offset < 526336 ? 3 : offset < 134744064 ? 4 : 5;
+}
+
+LOCAL uint32_t put_pointer(wbuf_s * buf, uint32_t target)
+{
+    uint32_t offset = buf->len;
+    if (target < 2048) {
+        put_be(buf, 0x20 | target >> 8, 1);
+        put_be(buf, target, 1);
+    } else if (target < 526336) {
+        target -= 2048;
+        put_be(buf, 0x28 | target >> 16, 1);
+        put_be(buf, target, 2);
+    } else if (target < 134744064) {
+        target -= 526336;
+        put_be(buf, 0x30 | target >> 24, 1);
+        put_be(buf, target, 3);
+    } else {
+        put_be(buf, 0x38, 1);
+        put_be(buf, target, 4);
+    }
+    return offset;
+}
+
+int TMMDB_writer_new(TMMDB_writer_s ** writer, int ip_version,
+                     int record_size)
+{
+    *writer = NULL;
+    if ((ip_version != 4 && ip_version != 6)
+        || (record_size != 24 && record_size != 28 && record_size != 32))
+        return TMMDB_INVALIDARGUMENT;
+    TMMDB_writer_s *w = xcalloc(1, sizeof(TMMDB_writer_s));
+    w->depth = ip_version == 4 ? 32 : 128;
+    w->record_size = record_size;
+    w->node_capacity = 1024;
+    w->nodes = xcalloc(w->node_capacity, sizeof(*w->nodes));
+    w->nodes[0][0] = w->nodes[0][1] = EMPTY_RECORD;
+    w->node_count = 1;
+    *writer = w;
+    return TMMDB_SUCCESS;
+}
+
+void TMMDB_writer_free(TMMDB_writer_s * writer)
+{
+    if (!writer)
+        return;
+    free(writer->nodes);
+    free(writer->data.data);
+    free(writer->keys.offsets);
+    free(writer->keys.lens);
+    free(writer);
+}
+
+uint32_t TMMDB_writer_map(TMMDB_writer_s * writer, int pairs)
+{
+    return put_ctrl(&writer->data, TMMDB_DTYPE_MAP, pairs);
+}
+
+uint32_t TMMDB_writer_array(TMMDB_writer_s * writer, int size)
+{
+    return put_ctrl(&writer->data, TMMDB_DTYPE_ARRAY, size);
+}
+
+uint32_t TMMDB_writer_string(TMMDB_writer_s * writer, const char *str)
+{
+    return put_string(&writer->data, TMMDB_DTYPE_UTF8_STRING, str,
+                      strlen(str));
+}
+
+uint32_t TMMDB_writer_bytes(TMMDB_writer_s * writer, const void *bytes,
+                            int size)
+{
+    return put_string(&writer->data, TMMDB_DTYPE_BYTES, bytes, size);
+}
+
+LOCAL uint32_t hash_key(const char *key, uint32_t len)
+{
+    uint32_t h = 2166136261U;
+    for (uint32_t i = 0; i < len; i++)
+        h = (h ^ (uint8_t) key[i]) * 16777619U;
+    return h;
+}
+
+// a pointer to the first copy of the key, if that is shorter
+uint32_t TMMDB_writer_key(TMMDB_writer_s * writer, const char *key)
+{
+    key_table_s *t = &writer->keys;
+    uint32_t len = strlen(key);
+    if (2 * (t->count + 1) > t->capacity) {
+        key_table_s old = *t;
+        t->capacity = old.capacity ? old.capacity * 2 : 256;
+        t->offsets = xcalloc(t->capacity, sizeof(uint32_t));
+        t->lens = xcalloc(t->capacity, sizeof(uint32_t));
+        for (uint32_t i = 0; i < old.capacity; i++) {
+            if (!old.offsets[i])
+                continue;
+            const uint8_t *s = writer->data.data + old.offsets[i] - 1;
+            uint32_t slot = hash_key((const char *)s + (old.lens[i] < 29
+                                                        ? 1 : 2),
+                                     old.lens[i]) & (t->capacity - 1);
+            while (t->offsets[slot])
+                slot = (slot + 1) & (t->capacity - 1);
+            t->offsets[slot] = old.offsets[i];
+            t->lens[slot] = old.lens[i];
+        }
+        free(old.offsets);
+        free(old.lens);
+    }
+
+    uint32_t slot = hash_key(key, len) & (t->capacity - 1);
+    for (; t->offsets[slot]; slot = (slot + 1) & (t->capacity - 1)) {
+        uint32_t offset = t->offsets[slot] - 1;
+        const uint8_t *s = writer->data.data + offset + (len < 29 ? 1 : 2);
+        if (t->lens[slot] == len && !memcmp(s, key, len))
+            return put_pointer(&writer->data, offset);
+    }
+
+    // keys up to 284 bytes, so the string starts after 1 or 2 bytes
+    uint32_t offset = TMMDB_writer_string(writer, key);
+    if (len < 285 && len + 1 > pointer_size(offset)) {
+        t->offsets[slot] = offset + 1;
+        t->lens[slot] = len;
+        t->count++;
+    }
+    return offset;
+}
+
+uint32_t TMMDB_writer_double(TMMDB_writer_s * writer, double d)
+{
+    uint64_t v;
+    memcpy(&v, &d, 8);
+    uint32_t offset = put_ctrl(&writer->data, TMMDB_DTYPE_IEEE754_DOUBLE, 8);
+    put_be(&writer->data, v, 8);
+    return offset;
+}
+
+uint32_t TMMDB_writer_float(TMMDB_writer_s * writer, float f)
+{
+    uint32_t v;
+    memcpy(&v, &f, 4);
+    uint32_t offset = put_ctrl(&writer->data, TMMDB_DTYPE_IEEE754_FLOAT, 4);
+    put_be(&writer->data, v, 4);
+    return offset;
+}
+
+// type is TMMDB_DTYPE_UINT16, TMMDB_DTYPE_UINT32 or TMMDB_DTYPE_UINT64
+uint32_t TMMDB_writer_uint(TMMDB_writer_s * writer, int type, uint64_t v)
+{
+    return put_uint(&writer->data, type, v);
+}
+
+uint32_t TMMDB_writer_int32(TMMDB_writer_s * writer, int32_t v)
+{
+    uint32_t offset = put_ctrl(&writer->data, TMMDB_DTYPE_INT32, 4);
+    put_be(&writer->data, (uint32_t) v, 4);
+    return offset;
+}
+
+uint32_t TMMDB_writer_bool(TMMDB_writer_s * writer, int v)
+{
+    return put_ctrl(&writer->data, TMMDB_DTYPE_BOOLEAN, v ? 1 : 0);
+}
+
+uint32_t TMMDB_writer_pointer(TMMDB_writer_s * writer, uint32_t offset)
+{
+    return put_pointer(&writer->data, offset);
+}
+
+LOCAL uint32_t new_node(TMMDB_writer_s * w, uint32_t left, uint32_t right)
+{
+    if (w->node_count == w->node_capacity) {
+        w->node_capacity *= 2;
+        w->nodes = xrealloc(w->nodes, w->node_capacity * sizeof(*w->nodes));
+    }
+    w->nodes[w->node_count][0] = left;
+    w->nodes[w->node_count][1] = right;
+    return w->node_count++;
+}
+
+LOCAL int ip_bit(const uint8_t * ip, int bit)
+{
+    return ip[bit >> 3] >> (7 - (bit & 7)) & 1;
+}
+
+// the record for ip/netmask becomes value, whatever was below it is gone
+LOCAL void set_record(TMMDB_writer_s * w, const uint8_t * ip, int netmask,
+                      uint32_t value)
+{
+    uint32_t node = 0;
+    for (int bit = 0; bit < netmask - 1; bit++) {
+        int b = ip_bit(ip, bit);
+        uint32_t r = w->nodes[node][b];
+        if (!IS_NODE(r)) {
+            // a more specific network inside a bigger one keeps the rest
+            uint32_t n = new_node(w, r, r);
+            w->nodes[node][b] = n;
+            r = n;
+        }
+        node = r;
+    }
+    w->nodes[node][ip_bit(ip, netmask - 1)] = value;
+}
+
+// ip has 4 bytes for IPv4 and 16 bytes for IPv6 databases
+int TMMDB_writer_insert(TMMDB_writer_s * writer, const uint8_t * ip,
+                        int netmask, uint32_t offset)
+{
+    if (netmask < 1 || netmask > writer->depth || offset >= DATA_RECORD)
+        return TMMDB_INVALIDARGUMENT;
+    set_record(writer, ip, netmask, DATA_RECORD | offset);
+    return TMMDB_SUCCESS;
+}
+
+// ::ffff:0:0/96 and 2002::/16 lead to the IPv4 subtree at ::/96 like
+// in the databases of MaxMind. Call it last, the networks in the aliased
+// ranges are replaced and later inserts there would change ::/96 too.
+int TMMDB_writer_alias_ipv4(TMMDB_writer_s * writer)
+{
+    static const uint8_t mapped[16] = {[10] = 0xff,[11] = 0xff };
+    static const uint8_t sixtofour[16] = { 0x20, 0x02 };
+    if (writer->depth != 128)
+        return TMMDB_INVALIDARGUMENT;
+
+    uint32_t r = 0;
+    for (int bit = 0; bit < 96 && IS_NODE(r); bit++)
+        r = writer->nodes[r][0];
+    if (r == 0 || r == EMPTY_RECORD)
+        return TMMDB_INVALIDARGUMENT;
+    set_record(writer, mapped, 96, r);
+    set_record(writer, sixtofour, 16, r);
+    return TMMDB_SUCCESS;
+}
+
+uint32_t TMMDB_writer_node_count(TMMDB_writer_s * writer)
+{
+    return writer->node_count;
+}
+
+// node numbers in depth first order, nodes nobody points to are dropped
+LOCAL uint32_t number_nodes(TMMDB_writer_s * w, uint32_t * number,
+                            uint32_t * order)
+{
+    uint32_t count = 0, top = 0, capacity = 256;
+    uint32_t *stack = xrealloc(NULL, capacity * sizeof(uint32_t));
+    memset(number, 0xff, w->node_count * sizeof(uint32_t));
+    stack[top++] = 0;
+    while (top) {
+        uint32_t node = stack[--top];
+        if (number[node] != EMPTY_RECORD)
+            continue;
+        number[node] = count;
+        order[count++] = node;
+        if (top + 2 > capacity) {
+            capacity *= 2;
+            stack = xrealloc(stack, capacity * sizeof(uint32_t));
+        }
+        for (int b = 1; b >= 0; b--)
+            if (IS_NODE(w->nodes[node][b]))
+                stack[top++] = w->nodes[node][b];
+    }
+    free(stack);
+    return count;
+}
+
+LOCAL void put_metadata(wbuf_s * buf, TMMDB_writer_s * w, uint32_t count,
+                        const char *database_type, const char *description)
+{
+#define KEY(k) put_string(buf, TMMDB_DTYPE_UTF8_STRING, k, strlen(k))
+    put_ctrl(buf, TMMDB_DTYPE_MAP, 9);
+    KEY("binary_format_major_version");
+    put_uint(buf, TMMDB_DTYPE_UINT16, 2);
+    KEY("binary_format_minor_version");
+    put_uint(buf, TMMDB_DTYPE_UINT16, 0);
+    KEY("build_epoch");
+    put_uint(buf, TMMDB_DTYPE_UINT64, time(NULL));
+    KEY("database_type");
+    KEY(database_type);
+    KEY("description");
+    put_ctrl(buf, TMMDB_DTYPE_MAP, 1);
+    KEY("en");
+    KEY(description);
+    KEY("ip_version");
+    put_uint(buf, TMMDB_DTYPE_UINT16, w->depth == 32 ? 4 : 6);
+    KEY("languages");
+    put_ctrl(buf, TMMDB_DTYPE_ARRAY, 1);
+    KEY("en");
+    KEY("node_count");
+    put_uint(buf, TMMDB_DTYPE_UINT32, count);
+    KEY("record_size");
+    put_uint(buf, TMMDB_DTYPE_UINT16, w->record_size);
+#undef KEY
+}
+
+LOCAL void put_node(wbuf_s * buf, int record_size, uint32_t left,
+                    uint32_t right)
+{
+    switch (record_size) {
+    case 24:
+        put_be(buf, left, 3);
+        put_be(buf, right, 3);
+        break;
+    case 28:
+        put_be(buf, left & 0xffffff, 3);
+        put_be(buf, (left >> 24) << 4 | right >> 24, 1);
+        put_be(buf, right & 0xffffff, 3);
+        break;
+    default:
+        put_be(buf, left, 4);
+        put_be(buf, right, 4);
+    }
+}
+
+// TMMDB_INVALIDARGUMENT if the nodes and the data do not fit the record size
+int TMMDB_writer_write(TMMDB_writer_s * writer, const char *fname,
+                       const char *database_type, const char *description)
+{
+    uint32_t *number = xcalloc(writer->node_count, sizeof(uint32_t));
+    uint32_t *order = xcalloc(writer->node_count, sizeof(uint32_t));
+    uint32_t count = number_nodes(writer, number, order);
+    uint64_t max_record = (uint64_t)count + TMMDB_DATASECTION_NOOP_SIZE
+        + writer->data.len;
+    if (max_record >> writer->record_size) {
+        free(number);
+        free(order);
+        return TMMDB_INVALIDARGUMENT;
+    }
+
+    FILE *fh = fopen(fname, "wb");
+    if (!fh) {
+        free(number);
+        free(order);
+        return TMMDB_OPENFILEERROR;
+    }
+
+    wbuf_s buf = { 0 };
+    int err = TMMDB_SUCCESS;
+    for (uint32_t i = 0; i < count && err == TMMDB_SUCCESS; i++) {
+        uint32_t rec[2];
+        for (int b = 0; b < 2; b++) {
+            uint32_t r = writer->nodes[order[i]][b];
+            rec[b] = r == EMPTY_RECORD ? count
+                : IS_NODE(r) ? number[r]
+                : count + TMMDB_DATASECTION_NOOP_SIZE + (r & ~DATA_RECORD);
+        }
+        put_node(&buf, writer->record_size, rec[0], rec[1]);
+        if (buf.len >= 1 << 16 || i + 1 == count) {
+            if (fwrite(buf.data, 1, buf.len, fh) != buf.len)
+                err = TMMDB_IOERROR;
+            buf.len = 0;
+        }
+    }
+
+    memset(wbuf_reserve(&buf, TMMDB_DATASECTION_NOOP_SIZE), 0,
+           TMMDB_DATASECTION_NOOP_SIZE);
+    if (fwrite(buf.data, 1, buf.len, fh) != buf.len
+        || fwrite(writer->data.data, 1, writer->data.len, fh)
+        != writer->data.len)
+        err = TMMDB_IOERROR;
+    buf.len = 0;
+    memcpy(wbuf_reserve(&buf, 14), "\xab\xcd\xefMaxMind.com", 14);
+    put_metadata(&buf, writer, count, database_type, description);
+    if (fwrite(buf.data, 1, buf.len, fh) != buf.len)
+        err = TMMDB_IOERROR;
+    if (fclose(fh) != 0)
+        err = TMMDB_IOERROR;
+
+    free(buf.data);
+    free(number);
+    free(order);
+    return err;
+}
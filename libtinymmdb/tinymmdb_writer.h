@@ -0,0 +1,48 @@
+#ifndef TMMDB_WRITER_H
+#define TMMDB_WRITER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "tinymmdb.h"
+
+// writes format 2 databases. Values go to the data section in the order
+// they are written, every function returns the data section offset of its
+// value, the offset pointers and TMMDB_writer_insert take. The lookups of
+// the library return it + TMMDB_DATASECTION_NOOP_SIZE as entry.offset.
+    typedef struct TMMDB_writer_s TMMDB_writer_s;
+
+    extern int TMMDB_writer_new(TMMDB_writer_s ** writer, int ip_version,
+                                int record_size);
+    extern void TMMDB_writer_free(TMMDB_writer_s * writer);
+
+    extern uint32_t TMMDB_writer_map(TMMDB_writer_s * writer, int pairs);
+    extern uint32_t TMMDB_writer_array(TMMDB_writer_s * writer, int size);
+    extern uint32_t TMMDB_writer_string(TMMDB_writer_s * writer,
+                                        const char *str);
+    extern uint32_t TMMDB_writer_key(TMMDB_writer_s * writer, const char *key);
+    extern uint32_t TMMDB_writer_bytes(TMMDB_writer_s * writer,
+                                       const void *bytes, int size);
+    extern uint32_t TMMDB_writer_double(TMMDB_writer_s * writer, double d);
+    extern uint32_t TMMDB_writer_float(TMMDB_writer_s * writer, float f);
+    extern uint32_t TMMDB_writer_uint(TMMDB_writer_s * writer, int type,
+                                      uint64_t v);
+    extern uint32_t TMMDB_writer_int32(TMMDB_writer_s * writer, int32_t v);
+    extern uint32_t TMMDB_writer_bool(TMMDB_writer_s * writer, int v);
+    extern uint32_t TMMDB_writer_pointer(TMMDB_writer_s * writer,
+                                         uint32_t offset);
+
+    extern int TMMDB_writer_insert(TMMDB_writer_s * writer,
+                                   const uint8_t * ip, int netmask,
+                                   uint32_t offset);
+    extern int TMMDB_writer_alias_ipv4(TMMDB_writer_s * writer);
+    extern uint32_t TMMDB_writer_node_count(TMMDB_writer_s * writer);
+    extern int TMMDB_writer_write(TMMDB_writer_s * writer, const char *fname,
+                                  const char *database_type,
+                                  const char *description);
+
+#ifdef __cplusplus
+}
+#endif
+#endif                          /* TMMDB_WRITER_H */
@@ -0,0 +1,65 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include "test_helper.h"
+
+// compare the arena tree with the TMMDB_get_tree one node by node
+static void compare(TMMDB_entry_s * entry, TMMDB_arena_s * arena,
+                    const char *what)
+{
+    TMMDB_decode_all_s *tree, *atree;
+    int err = TMMDB_get_tree(entry, &tree);
+    ok(err == TMMDB_SUCCESS, "TMMDB_get_tree %s", what);
+    err = TMMDB_get_tree_arena(entry, arena, &atree);
+    ok(err == TMMDB_SUCCESS, "TMMDB_get_tree_arena %s", what);
+    ok(atree == arena->nodes, "The tree starts the arena");
+
+    int nodes = 0, same = 0, sequential = 1;
+    TMMDB_decode_all_s *a = tree, *b = atree;
+    for (; a && b; a = a->next, b = b->next, nodes++) {
+        if (same_return(&a->decode.data, &b->decode.data)
+            && a->decode.offset_to_next == b->decode.offset_to_next)
+            same++;
+        if (b->next && b->next != b + 1)
+            sequential = 0;
+    }
+    ok(a == NULL && b == NULL, "Same number of nodes ( %d )", nodes);
+    ok(same == nodes, "All nodes are the same ( %d of %d )", same, nodes);
+    ok(sequential && arena->used == nodes, "The nodes are one array");
+    TMMDB_free_decode_all(tree);
+}
+
+int main(void)
+{
+    // one arena for everything
+    TMMDB_arena_s arena = { 0 };
+
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *mmdb;
+        int status = TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        if (!mmdb)
+            continue;
+
+        TMMDB_root_entry_s root;
+        int err = lookup_ip(mmdb, "24.24.24.24", &root);
+        ok(err == TMMDB_SUCCESS && root.entry.offset > 0, "Found 24.24.24.24");
+
+        compare(&root.entry, &arena, "record");
+        compare(&mmdb->meta, &arena, "metadata");
+        compare(&root.entry, &arena, "record again");
+
+        // an entry somewhere inside the record
+        TMMDB_return_s res;
+        TMMDB_get_value(&root.entry, &res, "location", NULL);
+        TMMDB_entry_s location = {.mmdb = mmdb,.offset = res.offset };
+        compare(&location, &arena, "location");
+        TMMDB_close(mmdb);
+    }
+    TMMDB_free_arena(&arena);
+    ok(arena.nodes == NULL && arena.capacity == 0, "TMMDB_free_arena");
+    done_testing();
+}
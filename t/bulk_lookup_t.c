@@ -0,0 +1,173 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "test_helper.h"
+#include "bulk_lookup.h"
+
+// tmmdblookup -b: the line splitter and the lookups in input order
+
+static FILE *input(const char *text, size_t len)
+{
+    FILE *fh = tmpfile();
+    fwrite(text, 1, len, fh);
+    rewind(fh);
+    return fh;
+}
+
+static long collect(void *ctx, char **lines, int *lens, int count)
+{
+    TMMDB_buffer_s *out = ctx;
+    for (int i = 0; i < count; i++) {
+        TMMDB_buffer_append(out, lines[i], lens[i]);
+        TMMDB_buffer_append(out, "|", 1);
+    }
+    return count;
+}
+
+// the lines of text read size bytes at a time, each followed by |
+static int split_is(const char *text, size_t size, const char *expect)
+{
+    TMMDB_buffer_s out = { 0 };
+    TMMDB_buffer_append(&out, "", 0);
+    FILE *fh = input(text, strlen(text));
+    long count = bulk_read_lines(fh, size, collect, &out);
+    fclose(fh);
+    long lines = 0;
+    for (const char *p = expect; (p = strchr(p, '|')); p++)
+        lines++;
+    int same = !strcmp(out.data, expect) && count == lines;
+    if (!same)
+        diag("size %zu: got %s", size, out.data);
+    TMMDB_free_buffer(&out);
+    return same;
+}
+
+static void test_split(void)
+{
+    int same = 1;
+    for (size_t size = 12; size <= 64; size++)
+        same &= split_is("1.2.3.4\r\n10.0.0.1\n\n::1 \n2001:db8::1", size,
+                         "1.2.3.4|10.0.0.1||::1|2001:db8::1|");
+    ok(same, "lines across every read boundary, CRLF, no final line end");
+    ok(split_is("a\nb\n", 12, "a|b|"), "a final line end adds no line");
+    ok(split_is("", 12, ""), "no input, no lines");
+    ok(split_is("0123456789abcdefghij\n1.2.3.4\n", 12,
+                "0123456789ab|1.2.3.4|"), "a line longer than the buffer");
+    ok(split_is("1.2.3.4\n0123456789abcdefghij", 12,
+                "1.2.3.4|0123456789ab|"), "a long last line");
+    ok(split_is("0123456789ab\nx\n", 12, "0123456789ab|x|"),
+       "a line as long as the buffer");
+
+    // more than one read of the real size
+    TMMDB_buffer_s text = { 0 }, expect = { 0 };
+    for (int i = 0; text.len <= BULK_READ_SIZE + 4096; i++) {
+        char line[32];
+        int len = snprintf(line, sizeof(line), "10.%d.%d.%d", i >> 16 & 255,
+                           i >> 8 & 255, i & 255);
+        TMMDB_buffer_append(&text, line, len);
+        TMMDB_buffer_append(&text, "\n", 1);
+        TMMDB_buffer_append(&expect, line, len);
+        TMMDB_buffer_append(&expect, "|", 1);
+    }
+    ok(split_is(text.data, BULK_READ_SIZE, expect.data),
+       "%zu bytes with BULK_READ_SIZE", text.len);
+    TMMDB_free_buffer(&text);
+    TMMDB_free_buffer(&expect);
+}
+
+static void test_escape(void)
+{
+    TMMDB_buffer_s out = { 0 };
+    bulk_put_escaped(&out, "a\tb\nc\\d\re", 9);
+    ok(!strcmp(out.data, "a\\tb\\nc\\\\d\\re"),
+       "TAB, newline, CR and backslash are escaped");
+    TMMDB_free_buffer(&out);
+}
+
+// the output of bulk_lookup for text
+static char *lookup_all(TMMDB_s * mmdb, const char *text, int threads,
+                        size_t size, long *invalid)
+{
+    FILE *in = input(text, strlen(text)), *out = tmpfile();
+    bulk_s *bulk = bulk_new(mmdb, threads, out);
+    *invalid = bulk_lookup(bulk, in, size);
+    bulk_free(bulk);
+    fclose(in);
+    long len = ftell(out);
+    char *data = malloc(len + 1);
+    rewind(out);
+    data[fread(data, 1, len, out)] = '\0';
+    fclose(out);
+    return data;
+}
+
+static void test_lookup(TMMDB_s * mmdb, const char *fname)
+{
+    TMMDB_buffer_s text = { 0 };
+    int lines = 0, bad = 0;
+    for (int i = 0; i < 3000; i++, lines++) {
+        char line[32];
+        int len = i % 5 == 4
+            ? (bad++, snprintf(line, sizeof(line), "no\taddress %d", i))
+            : snprintf(line, sizeof(line), "%d.%d.24.%d", i % 3 ? 24 : 1,
+                       i % 7 ? 24 : 2, i & 255);
+        TMMDB_buffer_append(&text, line, len);
+        TMMDB_buffer_append(&text, "\n", 1);
+    }
+
+    long invalid, invalid_t;
+    char *one = lookup_all(mmdb, text.data, 1, BULK_READ_SIZE, &invalid);
+    char *many = lookup_all(mmdb, text.data, 7, 100, &invalid_t);
+    ok(invalid == bad && invalid_t == bad, "%s: %d invalid lines", fname,
+       bad);
+    ok(!strcmp(one, many), "%s: 7 threads and short reads, same output",
+       fname);
+
+    // one output line per input line, in input order, 6 columns
+    int in_order = 1, found = 0;
+    const char *in = text.data, *out = one;
+    for (int i = 0; i < lines && in_order; i++) {
+        const char *in_eol = strchr(in, '\n'), *out_eol = strchr(out, '\n');
+        const char *tab = strchr(in, '\t');
+        int tabs = 0;
+        for (const char *p = out; p < out_eol; p++)
+            tabs += *p == '\t';
+        // the TAB of the invalid lines is escaped
+        in_order = out_eol && tabs == 5 && (tab && tab < in_eol
+                                             ? !strncmp(out, "no\\taddress ",
+                                                        12)
+                                             : !strncmp(out, in,
+                                                        in_eol - in)
+                                             && out[in_eol - in] == '\t');
+        if (!strncmp(in, "24.24.24.24\n", 12))
+            found = out_eol - out > 14
+                && !strncmp(out_eol - 14, "\tUnited States", 14);
+        in = in_eol + 1;
+        out = out_eol ? out_eol + 1 : out;
+    }
+    ok(in_order && !*out, "%s: %d lines in input order", fname, lines);
+    ok(found, "%s: 24.24.24.24 is in the United States", fname);
+    free(one);
+    free(many);
+    TMMDB_free_buffer(&text);
+}
+
+int main(void)
+{
+    test_split();
+    test_escape();
+
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *mmdb;
+        int status = TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        if (mmdb) {
+            test_lookup(mmdb, fname);
+            TMMDB_close(mmdb);
+        }
+    }
+    done_testing();
+}
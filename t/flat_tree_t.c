@@ -0,0 +1,97 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include "test_helper.h"
+
+// the subtree end of node i from the sizes of the maps and arrays
+static uint32_t subtree_end(TMMDB_flat_node_s * nodes, uint32_t i, int *good)
+{
+    uint32_t j = i + 1;
+    int size = nodes[i].data.data_size;
+    if (nodes[i].data.type == TMMDB_DTYPE_MAP) {
+        while (size-- > 0) {
+            j = subtree_end(nodes, j, good);
+            j = subtree_end(nodes, j, good);
+        }
+    } else if (nodes[i].data.type == TMMDB_DTYPE_ARRAY) {
+        while (size-- > 0)
+            j = subtree_end(nodes, j, good);
+    }
+    if (nodes[i].subtree_end != j)
+        *good = 0;
+    return j;
+}
+
+// the value for key in the map at node i, or 0
+static uint32_t find(TMMDB_flat_node_s * nodes, uint32_t i, const char *key)
+{
+    int len = strlen(key);
+    for (uint32_t k = i + 1; k < nodes[i].subtree_end;) {
+        uint32_t v = nodes[k].subtree_end;
+        if (nodes[k].data.data_size == len
+            && !memcmp(nodes[k].data.ptr, key, len))
+            return v;
+        k = nodes[v].subtree_end;       // skip the value
+    }
+    return 0;
+}
+
+static void compare(TMMDB_entry_s * entry, TMMDB_flat_tree_s * tree,
+                    const char *what)
+{
+    TMMDB_arena_s arena = { 0 };
+    TMMDB_decode_all_s *list;
+    TMMDB_get_tree_arena(entry, &arena, &list);
+
+    int err = TMMDB_get_flat_tree(entry, tree);
+    ok(err == TMMDB_SUCCESS, "TMMDB_get_flat_tree %s", what);
+    ok(tree->used == arena.used, "%d nodes like TMMDB_get_tree",
+       (int)tree->used);
+
+    int same = 0;
+    for (size_t i = 0; i < tree->used && i < arena.used; i++)
+        if (same_return(&tree->nodes[i].data, &arena.nodes[i].decode.data))
+            same++;
+    ok(same == tree->used, "All nodes are the same ( %d )", same);
+
+    int good = 1;
+    ok(subtree_end(tree->nodes, 0, &good) == tree->used && good,
+       "subtree_end is right for every node");
+    TMMDB_free_arena(&arena);
+}
+
+int main(void)
+{
+    TMMDB_flat_tree_s tree = { 0 };
+
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *mmdb;
+        int status = TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        if (!mmdb)
+            continue;
+
+        TMMDB_root_entry_s root;
+        int err = lookup_ip(mmdb, "24.24.24.24", &root);
+        ok(err == TMMDB_SUCCESS && root.entry.offset > 0, "Found 24.24.24.24");
+
+        compare(&mmdb->meta, &tree, "metadata");
+        compare(&root.entry, &tree, "record");
+
+        // skip the subtrees we do not want
+        TMMDB_return_s expect;
+        TMMDB_get_value(&root.entry, &expect, "location", "time_zone", NULL);
+        uint32_t loc = find(tree.nodes, 0, "location");
+        uint32_t tz = loc ? find(tree.nodes, loc, "time_zone") : 0;
+        ok(tz && same_return(&expect, &tree.nodes[tz].data),
+           "location/time_zone by skipping subtrees");
+        ok(find(tree.nodes, 0, "nothing") == 0, "nothing is not found");
+        TMMDB_close(mmdb);
+    }
+    TMMDB_free_flat_tree(&tree);
+    ok(tree.nodes == NULL && tree.capacity == 0, "TMMDB_free_flat_tree");
+    done_testing();
+}
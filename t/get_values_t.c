@@ -0,0 +1,95 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include "test_helper.h"
+
+// shared prefixes, missing keys, array indices and the empty path
+const char *paths[][6] = {
+    {"location", "latitude", NULL},
+    {"location", "longitude", NULL},
+    {"location", NULL},
+    {"city", "names", "en", NULL},
+    {"country", "names", "en", NULL},
+    {"country", "names", "whatever", NULL},
+    {"country", "iso_code", NULL},
+    {"subdivisions", "0", "names", "en", NULL},
+    {"subdivisions", "1", "names", "en", NULL},
+    {"test_data", "max", "float_t", NULL},
+    {"test_data", "tst", "array_ieee754_double_t", "3", NULL},
+    {"test_data", "tst", "array_ieee754_double_t", "0", NULL},
+    {"test_data", "tst", "array_ieee754_double_t", "14", NULL},
+    {"country", "iso_code", NULL},
+    {"location", "latitude", "x", NULL},
+    {NULL},
+    {NULL}
+};
+
+#define NPATHS (sizeof(paths) / sizeof(paths[0]) - 1)
+
+static void get_value(TMMDB_entry_s * entry, TMMDB_return_s * result,
+                      const char *const *k)
+{
+    const char *key[6] = { NULL };
+    for (int i = 0; k[i]; i++)
+        key[i] = k[i];
+    TMMDB_get_value(entry, result, key[0], key[1], key[2], key[3], key[4],
+                    key[5], NULL);
+}
+
+void test_mmdb(TMMDB_s * mmdb, TMMDB_query_s ** queries, const char *ipstr)
+{
+    TMMDB_root_entry_s root;
+    TMMDB_return_s results[NPATHS];
+    int err = lookup_ip(mmdb, ipstr, &root);
+    ok(err == TMMDB_SUCCESS && root.entry.offset > 0, "Found %s", ipstr);
+
+    err = TMMDB_get_values(&root.entry, (TMMDB_query_s const *const *)queries,
+                           NPATHS, results);
+    ok(err == TMMDB_SUCCESS, "TMMDB_get_values SUCCESSFUL");
+
+    int same = 0, found = 0;
+    for (int i = 0; i < NPATHS; i++) {
+        TMMDB_return_s expect;
+        get_value(&root.entry, &expect, paths[i]);
+        if (same_return(&expect, &results[i]))
+            same++;
+        else
+            diag("%s/%s differs", paths[i][0], paths[i][1]);
+        if (results[i].offset)
+            found++;
+    }
+    ok(same == NPATHS, "TMMDB_get_values is the same as TMMDB_get_value "
+       "( %d of %d, %d found )", same, (int)NPATHS, found);
+
+    // a subset, the result order follows the query order
+    TMMDB_query_s const *two[] = { queries[4], queries[0] };
+    err = TMMDB_get_values(&root.entry, two, 2, results);
+    ok(err == TMMDB_SUCCESS && results[0].type == TMMDB_DTYPE_UTF8_STRING
+       && results[1].type == TMMDB_DTYPE_IEEE754_DOUBLE,
+       "country/names/en and location/latitude");
+    ok(TMMDB_get_values(&root.entry, two, 0, results) == TMMDB_SUCCESS,
+       "No queries at all");
+}
+
+int main(void)
+{
+    TMMDB_query_s *queries[NPATHS];
+    for (int i = 0; i < NPATHS; i++)
+        TMMDB_compile_query(&queries[i], paths[i]);
+
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *mmdb;
+        int status = TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        if (mmdb) {
+            test_mmdb(mmdb, queries, "24.24.24.24");
+            TMMDB_close(mmdb);
+        }
+    }
+    for (int i = 0; i < NPATHS; i++)
+        TMMDB_free_query(queries[i]);
+    done_testing();
+}
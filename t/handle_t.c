@@ -0,0 +1,182 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "test_helper.h"
+
+#define FNAME "./handle_t.mmdb"
+#define V4 "./data/v4-24.mmdb"
+#define V6 "./data/v6-24.mmdb"
+#define THREADS (4)
+#define RELOADS (200)
+
+static int copy_file(const char *from, const char *to)
+{
+    char tmp[64], buf[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", to);
+    FILE *in = fopen(from, "rb"), *out = fopen(tmp, "wb");
+    if (!in || !out)
+        return -1;
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        fwrite(buf, 1, n, out);
+    fclose(in);
+    fclose(out);
+    // replaced like on a rollout, a new inode
+    return rename(tmp, to);
+}
+
+static int found(TMMDB_s * mmdb)
+{
+    TMMDB_root_entry_s root;
+    lookup_ip(mmdb, "24.24.24.24", &root);
+    TMMDB_return_s res;
+    TMMDB_get_value(&root.entry, &res, "location", "latitude", NULL);
+    return root.entry.offset && res.offset;
+}
+
+// the mappings of replaced copies of FNAME, -1 without /proc
+static int replaced_mappings(void)
+{
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (!maps)
+        return -1;
+    char line[512];
+    int count = 0;
+    while (fgets(line, sizeof(line), maps))
+        count += strstr(line, FNAME + 2) && strstr(line, "(deleted)");
+    fclose(maps);
+    return count;
+}
+
+// builds the jump table, fails for IPv6 databases if ctx says so
+static int setup(void *ctx, TMMDB_s * mmdb)
+{
+    int *fail_v6 = ctx;
+    if (*fail_v6 && mmdb->depth == 128)
+        return TMMDB_INVALIDARGUMENT;
+    return TMMDB_build_jump_table(mmdb, 8);
+}
+
+static TMMDB_handle_s *handle;
+static int stop;
+
+static void *reader(void *arg)
+{
+    long *failed = arg;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        TMMDB_s *mmdb = TMMDB_handle_acquire(handle);
+        if (!found(mmdb))
+            (*failed)++;
+        TMMDB_handle_release(handle);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    copy_file(V4, FNAME);
+    ok(TMMDB_handle_open(&handle, "./nothere.mmdb", TMMDB_MODE_STANDARD)
+       == TMMDB_OPENFILEERROR && !handle, "no handle for a missing file");
+    int err = TMMDB_handle_open(&handle, FNAME, TMMDB_MODE_STANDARD);
+    ok(err == TMMDB_SUCCESS, "TMMDB_handle_open");
+
+    TMMDB_s *first = TMMDB_handle_acquire(handle);
+    ok(first && first->depth == 32 && found(first), "IPv4 database");
+    ok(TMMDB_handle_check(handle) == 0, "the file did not change");
+
+    copy_file(V6, FNAME);
+    ok(TMMDB_handle_check(handle) == 1, "the file was replaced");
+    ok(TMMDB_handle_acquire(handle) == first, "nested acquire");
+    TMMDB_handle_release(handle);
+    ok(found(first), "the old database is usable until release");
+    TMMDB_handle_release(handle);
+    int mapped = replaced_mappings();
+    ok(mapped <= 0, "the last release closes it (%d mappings left)", mapped);
+
+    TMMDB_s *second = TMMDB_handle_acquire(handle);
+    ok(second != first && second->depth == 128 && found(second),
+       "IPv6 database after the release");
+    TMMDB_handle_release(handle);
+
+    ok(TMMDB_handle_reload(handle, "./nothere.mmdb") == TMMDB_OPENFILEERROR,
+       "a failed reload");
+    second = TMMDB_handle_acquire(handle);
+    ok(second->depth == 128 && found(second), "keeps the database");
+    TMMDB_handle_release(handle);
+    copy_file(V4, FNAME);
+    ok(TMMDB_handle_check(handle) == 1
+       && TMMDB_handle_acquire(handle)->depth == 32,
+       "and still checks its own file");
+    TMMDB_handle_release(handle);
+
+    // a broken file is tried again until it is fixed
+    FILE *fh = fopen(FNAME ".tmp", "wb");
+    fputs("not a database", fh);
+    fclose(fh);
+    rename(FNAME ".tmp", FNAME);
+    ok(TMMDB_handle_check(handle) == TMMDB_INVALIDDATABASE,
+       "a broken file is an error");
+    ok(TMMDB_handle_check(handle) == TMMDB_INVALIDDATABASE,
+       "the next check tries again");
+    copy_file(V6, FNAME);
+    ok(TMMDB_handle_check(handle) == 1
+       && TMMDB_handle_acquire(handle)->depth == 128,
+       "the fixed file is loaded");
+    TMMDB_handle_release(handle);
+
+    // the setup runs again on every reloaded database
+    int fail_v6 = 0;
+    ok(TMMDB_handle_setup(handle, setup, &fail_v6) == TMMDB_SUCCESS
+       && TMMDB_handle_acquire(handle)->jump_table, "TMMDB_handle_setup");
+    TMMDB_handle_release(handle);
+    ok(TMMDB_handle_reload(handle, V4) == TMMDB_SUCCESS
+       && TMMDB_handle_acquire(handle)->jump_table,
+       "the reloaded database is set up");
+    TMMDB_handle_release(handle);
+    fail_v6 = 1;
+    ok(TMMDB_handle_reload(handle, V6) == TMMDB_INVALIDARGUMENT
+       && TMMDB_handle_acquire(handle)->depth == 32,
+       "a failed setup fails the reload");
+    TMMDB_handle_release(handle);
+    TMMDB_handle_setup(handle, NULL, NULL);
+
+    // readers never see a closed database
+    pthread_t tid[THREADS];
+    long failed[THREADS] = { 0 };
+    for (int t = 0; t < THREADS; t++)
+        pthread_create(&tid[t], NULL, reader, &failed[t]);
+    err = TMMDB_SUCCESS;
+    for (int i = 0; i < RELOADS && err == TMMDB_SUCCESS; i++)
+        err = TMMDB_handle_reload(handle, i % 2 ? V6 : V4);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    long failures = 0;
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(tid[t], NULL);
+        failures += failed[t];
+    }
+    ok(err == TMMDB_SUCCESS && failures == 0,
+       "%d reloads with %d readers, %ld failed lookups", RELOADS, THREADS,
+       failures);
+
+    // the watcher notices the replaced file
+    TMMDB_handle_reload(handle, FNAME);
+    ok(TMMDB_handle_watch(handle, 0) == TMMDB_INVALIDARGUMENT,
+       "interval 0 is invalid");
+    ok(TMMDB_handle_watch(handle, 10) == TMMDB_SUCCESS, "TMMDB_handle_watch");
+    copy_file(V4, FNAME);
+    int depth = 0;
+    for (int i = 0; i < 500 && depth != 32; i++) {
+        usleep(10000);
+        depth = TMMDB_handle_acquire(handle)->depth;
+        TMMDB_handle_release(handle);
+    }
+    ok(depth == 32, "the watcher reloaded the file");
+    TMMDB_handle_close(handle);
+    unlink(FNAME);
+    done_testing();
+}
@@ -0,0 +1,129 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "test_helper.h"
+
+#define SIDECAR "./hot_fields_t.hot"
+#define COUNT (4)
+
+const char *paths[COUNT][4] = {
+    {"country", "iso_code", NULL},
+    {"country", "names", "en", NULL},
+    {"location", "latitude", NULL},
+    {"city", "names", "whatever", NULL}
+};
+
+typedef struct {
+    TMMDB_s *mmdb;
+    TMMDB_query_s **queries;
+    int networks;
+    int same;
+} check_s;
+
+// every network has its row, the same as TMMDB_get_values
+static int check_network(void *ctx, TMMDB_network_s const *network)
+{
+    check_s *c = ctx;
+    TMMDB_entry_s entry = {.mmdb = c->mmdb,.offset = network->offset };
+    TMMDB_return_s expect[COUNT];
+    TMMDB_get_values(&entry, (TMMDB_query_s const *const *)c->queries, COUNT,
+                     expect);
+    const TMMDB_return_s *row = TMMDB_hot_fields(&entry);
+    int same = row != NULL;
+    for (int i = 0; same && i < COUNT; i++)
+        same = same_return(&expect[i], (TMMDB_return_s *) & row[i]);
+    c->networks++;
+    c->same += same;
+    return TMMDB_SUCCESS;
+}
+
+static void check_rows(TMMDB_s * mmdb, TMMDB_query_s ** queries,
+                       const char *what)
+{
+    check_s c = {.mmdb = mmdb,.queries = queries };
+    TMMDB_foreach_network(mmdb, check_network, &c);
+    ok(c.networks > 0 && c.same == c.networks,
+       "%s: %d of %d networks have the values of TMMDB_get_values", what,
+       c.same, c.networks);
+}
+
+void test_mmdb(TMMDB_s * mmdb, TMMDB_s * other, TMMDB_query_s ** queries)
+{
+    TMMDB_query_s const *const *q = (TMMDB_query_s const *const *)queries;
+    TMMDB_entry_s entry = {.mmdb = mmdb,.offset = 1 };
+    ok(TMMDB_hot_fields(&entry) == NULL, "no table, no row");
+
+    size_t before = TMMDB_index_memory(mmdb);
+    ok(TMMDB_build_hot_fields(mmdb, q, COUNT) == TMMDB_SUCCESS,
+       "TMMDB_build_hot_fields");
+    ok(TMMDB_index_memory(mmdb) > before, "%zu bytes for the table",
+       TMMDB_index_memory(mmdb) - before);
+    check_rows(mmdb, queries, "built");
+    ok(TMMDB_hot_fields(&entry) == NULL, "offset 1 is no record");
+
+    TMMDB_root_entry_s root;
+    lookup_ip(mmdb, "24.24.24.24", &root);
+    const TMMDB_return_s *row = TMMDB_hot_fields(&root.entry);
+    ok(row && TMMDB_strcmp_result(mmdb, &row[0], "US") == 0
+       && row[2].offset && !row[3].offset,
+       "24.24.24.24 is in the US, has a latitude and no city/names/whatever");
+
+    ok(TMMDB_save_hot_fields(mmdb, SIDECAR) == TMMDB_SUCCESS,
+       "TMMDB_save_hot_fields");
+    TMMDB_build_hot_fields(mmdb, q, 0);
+    ok(TMMDB_hot_fields(&root.entry) == NULL, "count 0 removes the table");
+    ok(TMMDB_load_hot_fields(mmdb, q, COUNT, SIDECAR) == TMMDB_SUCCESS,
+       "TMMDB_load_hot_fields");
+    check_rows(mmdb, queries, "loaded");
+    ok(TMMDB_load_hot_fields(mmdb, q, COUNT - 1, SIDECAR)
+       == TMMDB_INVALIDDATABASE, "other queries");
+    ok(TMMDB_load_hot_fields(other, q, COUNT, SIDECAR)
+       == TMMDB_INVALIDDATABASE, "other database");
+    ok(TMMDB_load_hot_fields(mmdb, q, COUNT, "./nothere.hot")
+       == TMMDB_OPENFILEERROR, "no sidecar file");
+
+    // a corrupt row count must not size the allocations
+    uint32_t rows = 0xfffffff0;
+    FILE *fh = fopen(SIDECAR, "r+b");
+    fseek(fh, 36, SEEK_SET);
+    fwrite(&rows, sizeof(rows), 1, fh);
+    fclose(fh);
+    ok(TMMDB_load_hot_fields(mmdb, q, COUNT, SIDECAR)
+       == TMMDB_INVALIDDATABASE, "a corrupt row count");
+    ok(TMMDB_hot_fields(&root.entry) != NULL, "keeps the loaded table");
+    TMMDB_save_hot_fields(mmdb, SIDECAR);
+    fh = fopen(SIDECAR, "rb");
+    fseek(fh, 0, SEEK_END);
+    long size = ftell(fh);
+    fclose(fh);
+    ok(truncate(SIDECAR, size - 1) == 0
+       && TMMDB_load_hot_fields(mmdb, q, COUNT, SIDECAR)
+       == TMMDB_INVALIDDATABASE, "a truncated file");
+    unlink(SIDECAR);
+}
+
+int main(void)
+{
+    TMMDB_query_s *queries[COUNT];
+    for (int i = 0; i < COUNT; i++)
+        TMMDB_compile_query(&queries[i], paths[i]);
+
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *mmdb, *other;
+        int status = TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        TMMDB_open(&other, test_databases[ptr == test_databases + 1],
+                   TMMDB_MODE_STANDARD);
+        if (mmdb && other)
+            test_mmdb(mmdb, other, queries);
+        TMMDB_close(mmdb);
+        TMMDB_close(other);
+    }
+    for (int i = 0; i < COUNT; i++)
+        TMMDB_free_query(queries[i]);
+    done_testing();
+}
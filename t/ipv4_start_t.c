@@ -0,0 +1,105 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include "test_helper.h"
+
+#define CNT (2000)
+
+static int same(TMMDB_root_entry_s * a, TMMDB_root_entry_s * b)
+{
+    return a->entry.offset == b->entry.offset && a->netmask == b->netmask;
+}
+
+void test_mmdb(TMMDB_s * mmdb)
+{
+    static struct in6_addr v6[CNT];
+    static TMMDB_root_entry_s many[CNT];
+    int v4_ok = 0, v6_ok = 0, mapped_ok = 0, many_ok = 0, found = 0;
+
+    if (mmdb->depth == 128) {
+        ok(mmdb->ipv4_start_bits > 0, "IPv4 subtree starts at bit %d",
+           mmdb->ipv4_start_bits);
+        ok(mmdb->ipv4_mapped_alias,
+           "::ffff:0:0/96 points to the IPv4 subtree");
+    } else {
+        ok(mmdb->ipv4_start_bits == 0 && mmdb->ipv4_start_node == 0,
+           "IPv4 database starts at the root");
+    }
+
+    for (int i = 0; i < CNT; i++) {
+        uint32_t ipnum = i & 1 ? (uint32_t)rand() : 0x18181800U + (i & 0x3ff);
+        TMMDB_root_entry_s expect, got = {.entry.mmdb = mmdb };
+        uint8_t ip[16] = { 0 };
+        ip[12] = ipnum >> 24;
+        ip[13] = ipnum >> 16;
+        ip[14] = ipnum >> 8;
+        ip[15] = ipnum;
+
+        if (mmdb->depth == 32) {
+            walk_tree_32(mmdb, ipnum, &expect);
+        } else {
+            walk_tree(mmdb, ip, 128, &expect);
+            // the IPv4 lookup reports the IPv4 netmask
+            expect.netmask = expect.netmask > 96 ? expect.netmask - 96 : 0;
+        }
+        if (TMMDB_lookup_by_ipnum_v4(ipnum, &got) == TMMDB_SUCCESS
+            && same(&expect, &got))
+            v4_ok++;
+        if (got.entry.offset > 0)
+            found++;
+
+        memcpy(&v6[i], ip, 16);
+        if (i & 2)
+            v6[i].s6_addr[10] = v6[i].s6_addr[11] = 0xff;
+        if (mmdb->depth == 128) {
+            walk_tree(mmdb, v6[i].s6_addr, 128, &expect);
+            if (TMMDB_lookup_by_ipnum_128(v6[i], &got) == TMMDB_SUCCESS
+                && same(&expect, &got))
+                i & 2 ? mapped_ok++ : v6_ok++;
+        }
+    }
+
+    ok(v4_ok == CNT, "TMMDB_lookup_by_ipnum_v4 matches the tree ( %d of %d )",
+       v4_ok, CNT);
+    ok(found > 0, "TMMDB_lookup_by_ipnum_v4 found something");
+
+    if (mmdb->depth == 128) {
+        ok(v6_ok == CNT / 2, "::/96 lookups match the tree ( %d )", v6_ok);
+        ok(mapped_ok == CNT / 2, "::ffff:0:0/96 lookups match the tree ( %d )",
+           mapped_ok);
+
+        int err = TMMDB_lookup_many_ipnum_128(mmdb, v6, CNT, many);
+        ok(err == TMMDB_SUCCESS, "Batch search SUCCESSFUL");
+        for (int i = 0; i < CNT; i++) {
+            TMMDB_root_entry_s expect;
+            walk_tree(mmdb, v6[i].s6_addr, 128, &expect);
+            if (same(&expect, &many[i]))
+                many_ok++;
+        }
+        ok(many_ok == CNT, "Batch lookups match the tree ( %d of %d )",
+           many_ok, CNT);
+    }
+}
+
+int main(void)
+{
+    uint32_t flags[] =
+        { TMMDB_MODE_STANDARD, TMMDB_MODE_STANDARD | TMMDB_OPT_JUMP_TABLE };
+
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        for (int i = 0; i < sizeof(flags) / sizeof(uint32_t); i++) {
+            TMMDB_s *mmdb;
+            int status = TMMDB_open(&mmdb, fname, flags[i]);
+            ok(status == TMMDB_SUCCESS, "TMMDB_open %s ( flags %u )", fname,
+               flags[i]);
+            if (mmdb) {
+                test_mmdb(mmdb);
+                TMMDB_close(mmdb);
+            }
+        }
+    }
+    done_testing();
+}
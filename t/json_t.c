@@ -0,0 +1,94 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <locale.h>
+#include "test_helper.h"
+
+const char *expect[] = {
+    "\"iso_code\":\"US\"",
+    "\"location\":{\"latitude\":40.6763,",
+    "\"uint64_t\":18446744073709551615,",
+    "\"uint128_t\":340282366920938463463374607431768211455,",
+    "\"uint128_t\":0,",
+    "\"int32_t\":-2147483648,",
+    "\"int32_t\":2147483647,",
+    "\"uint32_t\":4294967295,",
+    "\"boolean_t\":true,",
+    "\"boolean_t\":false,",
+    "\"bytes_t\":\"74657374\",",
+    "\"double_t\":999999999.9999,",
+    "\"utf8_string_t\":\"\"}",
+    "\"names\":{\"en\":\"United States\",",
+    NULL
+};
+
+// brackets balance outside of strings
+static int balanced(const char *json)
+{
+    int depth = 0, in_string = 0;
+    for (const char *p = json; *p; p++) {
+        if (in_string) {
+            if (*p == '\\')
+                p++;
+            else if (*p == '"')
+                in_string = 0;
+        } else if (*p == '"') {
+            in_string = 1;
+        } else if (*p == '{' || *p == '[') {
+            depth++;
+        } else if (*p == '}' || *p == ']') {
+            if (--depth < 0)
+                return 0;
+        } else if (*p < 0x20 && *p > 0) {
+            return 0;
+        }
+    }
+    return depth == 0 && !in_string;
+}
+
+void test_mmdb(TMMDB_s * mmdb)
+{
+    TMMDB_root_entry_s root;
+    int err = lookup_ip(mmdb, "24.24.24.24", &root);
+    ok(err == TMMDB_SUCCESS && root.entry.offset > 0, "Found 24.24.24.24");
+
+    TMMDB_buffer_s buf = { 0 };
+    err = TMMDB_record_to_json(&root.entry, &buf);
+    ok(err == TMMDB_SUCCESS, "TMMDB_record_to_json SUCCESSFUL");
+    ok(buf.len == strlen(buf.data), "NUL terminated, %d bytes", (int)buf.len);
+    ok(buf.data[0] == '{' && buf.data[buf.len - 1] == '}', "One object");
+    ok(balanced(buf.data), "Brackets balance");
+    for (int i = 0; expect[i]; i++)
+        ok(strstr(buf.data, expect[i]) != NULL, "Contains %s", expect[i]);
+
+    // appends to the buffer
+    size_t len = buf.len;
+    err = TMMDB_record_to_json(&mmdb->meta, &buf);
+    ok(err == TMMDB_SUCCESS && buf.len > len
+       && !memcmp(buf.data + len, "{", 1), "Metadata appended");
+    ok(strstr(buf.data + len, "\"record_size\":") != NULL,
+       "Metadata contains record_size");
+    ok(balanced(buf.data + len), "Metadata brackets balance");
+    TMMDB_free_buffer(&buf);
+    ok(buf.data == NULL && buf.capacity == 0, "TMMDB_free_buffer");
+}
+
+int main(void)
+{
+    // where the host has it, a comma decimal point must not reach the JSON
+    setlocale(LC_NUMERIC, "de_DE.UTF-8");
+
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *mmdb;
+        int status = TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        if (mmdb) {
+            test_mmdb(mmdb);
+            TMMDB_close(mmdb);
+        }
+    }
+    done_testing();
+}
@@ -0,0 +1,98 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include "test_helper.h"
+
+#define CNT (2000)
+
+static uint32_t ipnums[CNT];
+static struct in6_addr ipnums_128[CNT];
+
+static int lookup(TMMDB_s * mmdb, int i, TMMDB_root_entry_s * root)
+{
+    root->entry.mmdb = mmdb;
+    return mmdb->depth == 32 ? TMMDB_lookup_by_ipnum(ipnums[i], root)
+        : TMMDB_lookup_by_ipnum_128(ipnums_128[i], root);
+}
+
+// compare every lookup in mmdb against the plain tree walk in plain
+static void compare(TMMDB_s * plain, TMMDB_s * mmdb, const char *what)
+{
+    static TMMDB_root_entry_s many[CNT];
+    int same = 0, same_many = 0;
+    int err = mmdb->depth == 32
+        ? TMMDB_lookup_many_ipnum(mmdb, ipnums, CNT, many)
+        : TMMDB_lookup_many_ipnum_128(mmdb, ipnums_128, CNT, many);
+    ok(err == TMMDB_SUCCESS, "Batch search SUCCESSFUL ( %s )", what);
+
+    for (int i = 0; i < CNT; i++) {
+        TMMDB_root_entry_s a, b;
+        if (lookup(plain, i, &a) != TMMDB_SUCCESS
+            || lookup(mmdb, i, &b) != TMMDB_SUCCESS)
+            continue;
+        if (a.entry.offset == b.entry.offset && a.netmask == b.netmask)
+            same++;
+        if (a.entry.offset == many[i].entry.offset
+            && a.netmask == many[i].netmask)
+            same_many++;
+    }
+    ok(same == CNT, "Lookups match the tree walk ( %s, %d of %d )", what,
+       same, CNT);
+    ok(same_many == CNT, "Batch lookups match the tree walk ( %s, %d of %d )",
+       what, same_many, CNT);
+}
+
+int main(void)
+{
+    // mostly addresses close to the ones in the test databases
+    for (int n = 0; n < CNT; n++) {
+        ipnums[n] = n & 1 ? (uint32_t)rand() : 0x18181800U + (n & 0x3ff);
+        for (int i = 0; i < 16; i++)
+            ipnums_128[n].s6_addr[i] = rand();
+        if (n % 3 == 0)
+            memset(&ipnums_128[n], 0, 12);
+        else if (n % 3 == 1)
+            memcpy(&ipnums_128[n], "\x20\x01\x48\x60\xb0\x02", 6);
+    }
+
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *plain, *mmdb;
+        int status = TMMDB_open(&plain, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        status = TMMDB_open(&mmdb, fname,
+                            TMMDB_MODE_STANDARD | TMMDB_OPT_JUMP_TABLE);
+        ok(status == TMMDB_SUCCESS,
+           "TMMDB_open %s with TMMDB_OPT_JUMP_TABLE successful", fname);
+        if (!plain || !mmdb)
+            continue;
+
+        ok(plain->jump_table == NULL && TMMDB_index_memory(plain) == 0,
+           "No jump table without TMMDB_OPT_JUMP_TABLE");
+        ok(mmdb->jump_bits == TMMDB_JUMP_TABLE_DEFAULT_BITS,
+           "jump_bits is %d", mmdb->jump_bits);
+        ok(TMMDB_index_memory(mmdb) == mmdb->jump_table_size
+           && mmdb->jump_table_size > 0, "jump table uses %u bytes",
+           (unsigned int)mmdb->jump_table_size);
+        compare(plain, mmdb, "default");
+
+        int bits[] = { 1, 5, 8, 24, 0 };
+        for (int i = 0; i < sizeof(bits) / sizeof(int); i++) {
+            char what[32];
+            snprintf(what, sizeof(what), "%d bits", bits[i]);
+            status = TMMDB_build_jump_table(mmdb, bits[i]);
+            ok(status == TMMDB_SUCCESS, "TMMDB_build_jump_table %s", what);
+            compare(plain, mmdb, what);
+        }
+        ok(mmdb->jump_table == NULL && TMMDB_index_memory(mmdb) == 0,
+           "0 bits removes the jump table");
+        ok(TMMDB_build_jump_table(mmdb, TMMDB_JUMP_TABLE_MAX_BITS + 1)
+           == TMMDB_INVALIDARGUMENT, "too many bits are rejected");
+
+        TMMDB_close(plain);
+        TMMDB_close(mmdb);
+    }
+    done_testing();
+}
@@ -0,0 +1,84 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include "test_helper.h"
+
+#define CNT (1000)
+
+char *ip_string[] = {
+    "127.0.0.1", "24.24.24.24", "::24.24.24.24", "::ffff:24.24.24.24",
+    "2222::", "2001:4860:b002::68", NULL
+};
+
+void test_mmdb(TMMDB_s * mmdb)
+{
+    static uint32_t ipnums[CNT];
+    static struct in6_addr ipnums_128[CNT];
+    static TMMDB_root_entry_s many[CNT];
+    int i, n = 0;
+
+    // the known addresses first, followed by random ones
+    for (i = 0; ip_string[i]; i++) {
+        in_addrX ipnum;
+        if (mmdb->depth == 32 && strchr(ip_string[i], ':'))
+            continue;
+        ip_to_num(mmdb, ip_string[i], &ipnum);
+        ipnums[n] = ntohl(ipnum.v4.s_addr);
+        ipnums_128[n++] = ipnum.v6;
+    }
+    for (; n < CNT; n++) {
+        ipnums[n] = rand();
+        for (i = 0; i < 16; i++)
+            ipnums_128[n].s6_addr[i] = rand();
+        // keep some in the IPv4 part of the tree
+        if (n & 1)
+            memset(&ipnums_128[n], 0, 12);
+    }
+
+    int err = mmdb->depth == 32
+        ? TMMDB_lookup_many_ipnum(mmdb, ipnums, CNT, many)
+        : TMMDB_lookup_many_ipnum_128(mmdb, ipnums_128, CNT, many);
+    ok(err == TMMDB_SUCCESS, "Batch search for %d addresses SUCCESSFUL", CNT);
+
+    int same = 0, found = 0;
+    for (i = 0; i < CNT; i++) {
+        TMMDB_root_entry_s root = {.entry.mmdb = mmdb };
+        err = mmdb->depth == 32 ? TMMDB_lookup_by_ipnum(ipnums[i], &root)
+            : TMMDB_lookup_by_ipnum_128(ipnums_128[i], &root);
+        if (err == TMMDB_SUCCESS && many[i].entry.mmdb == mmdb
+            && many[i].entry.offset == root.entry.offset
+            && many[i].netmask == root.netmask)
+            same++;
+        if (root.entry.offset > 0)
+            found++;
+    }
+    ok(same == CNT, "Batch results match single lookups ( %d of %d )", same,
+       CNT);
+    ok(found > 0, "Batch found something ( %d of %d )", found, CNT);
+
+    err = mmdb->depth == 32
+        ? TMMDB_lookup_many_ipnum(mmdb, ipnums, 0, many)
+        : TMMDB_lookup_many_ipnum_128(mmdb, ipnums_128, 0, many);
+    ok(err == TMMDB_SUCCESS, "Batch search for 0 addresses SUCCESSFUL");
+}
+
+int main(void)
+{
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        struct stat sstat;
+        int err = stat(fname, &sstat);
+        ok(err == 0, "%s exists", fname);
+
+        TMMDB_s *mmdb;
+        int status = TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        if (mmdb) {
+            test_mmdb(mmdb);
+            TMMDB_close(mmdb);
+        }
+    }
+    done_testing();
+}
@@ -0,0 +1,148 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdlib.h>
+#include "test_helper.h"
+
+typedef struct {
+    TMMDB_network_s *nets;
+    int count;
+    int capacity;
+} collect_s;
+
+static int collect(void *ctx, TMMDB_network_s const *network)
+{
+    collect_s *c = ctx;
+    if (c->count == c->capacity) {
+        c->capacity = c->capacity ? c->capacity * 2 : 1024;
+        c->nets = realloc(c->nets, c->capacity * sizeof(TMMDB_network_s));
+    }
+    c->nets[c->count++] = *network;
+    return TMMDB_SUCCESS;
+}
+
+static int format(void *ctx, TMMDB_network_s const *network,
+                  TMMDB_buffer_s * out)
+{
+    char line[128];
+    int len = snprintf(line, sizeof(line), "%02x%02x%02x%02x%02x%02x/%d %u\n",
+                       network->ip[0], network->ip[1], network->ip[2],
+                       network->ip[3], network->ip[12], network->ip[15],
+                       network->netmask, network->offset);
+    TMMDB_buffer_append(out, line, len);
+    return TMMDB_SUCCESS;
+}
+
+static int flush(void *ctx, TMMDB_buffer_s * out)
+{
+    TMMDB_buffer_append(ctx, out->data, out->len);
+    return TMMDB_SUCCESS;
+}
+
+static int fail_flush(void *ctx, TMMDB_buffer_s * out)
+{
+    return ++*(int *)ctx == 1 ? TMMDB_IOERROR : TMMDB_SUCCESS;
+}
+
+// the first and the last address of the network
+static void range(TMMDB_network_s * n, int bytes, uint8_t * last)
+{
+    memcpy(last, n->ip, 16);
+    for (int bit = n->netmask; bit < bytes * 8; bit++)
+        last[bit >> 3] |= 0x80 >> (bit & 7);
+}
+
+static int lookup(TMMDB_s * mmdb, const uint8_t * ip, TMMDB_root_entry_s * res)
+{
+    res->entry.mmdb = mmdb;
+    if (mmdb->depth == 32)
+        return TMMDB_lookup_by_ipnum((uint32_t)ip[0] << 24 | ip[1] << 16
+                                     | ip[2] << 8 | ip[3], res);
+    struct in6_addr v6;
+    memcpy(&v6, ip, 16);
+    return TMMDB_lookup_by_ipnum_128(v6, res);
+}
+
+void test_mmdb(TMMDB_s * mmdb)
+{
+    collect_s c = { 0 };
+    int bytes = mmdb->depth / 8;
+    int err = TMMDB_foreach_network(mmdb, collect, &c);
+    ok(err == TMMDB_SUCCESS && c.count > 0, "TMMDB_foreach_network found %d "
+       "networks", c.count);
+
+    int sorted = 1, found = 0, first_v4 = -1;
+    uint8_t prev_last[16] = { 0 };
+    for (int i = 0; i < c.count; i++) {
+        TMMDB_network_s *n = &c.nets[i];
+        uint8_t last[16];
+        TMMDB_root_entry_s a, b;
+        range(n, bytes, last);
+        if (i && memcmp(n->ip, prev_last, bytes) <= 0)
+            sorted = 0;
+        memcpy(prev_last, last, 16);
+        if (lookup(mmdb, n->ip, &a) == TMMDB_SUCCESS
+            && lookup(mmdb, last, &b) == TMMDB_SUCCESS
+            && a.entry.offset == n->offset && b.entry.offset == n->offset
+            && a.netmask == n->netmask && b.netmask == n->netmask)
+            found++;
+        if (first_v4 < 0 && n->ip[12] == 24 && n->ip[13] == 24)
+            first_v4 = i;
+    }
+    ok(sorted, "Networks are sorted and do not overlap");
+    ok(found == c.count, "Lookups at both ends of every network agree ( %d )",
+       found);
+    ok(first_v4 >= 0 || mmdb->depth == 32, "24.24/16 is part of ::/96");
+
+    int aliased = 0;
+    for (int i = 0; i < c.count; i++)
+        if (!memcmp(c.nets[i].ip, "\0\0\0\0\0\0\0\0\0\0\xff\xff", 12)
+            && c.nets[i].netmask >= 96)
+            aliased++;
+    ok(aliased == 0 || !mmdb->ipv4_mapped_alias,
+       "::ffff:0:0/96 is not reported twice");
+
+    // the parallel version writes the same in the same order
+    TMMDB_buffer_s expect = { 0 };
+    for (int i = 0; i < c.count; i++)
+        format(NULL, &c.nets[i], &expect);
+    int threads[] = { 1, 2, 4, 8 };
+    int split[] = { 0, 1, 8, 16 };
+    for (int t = 0; t < 4; t++) {
+        for (int s = 0; s < 4; s++) {
+            TMMDB_buffer_s got = { 0 };
+            err = TMMDB_foreach_network_parallel(mmdb, threads[t], split[s],
+                                                 format, flush, &got);
+            ok(err == TMMDB_SUCCESS && got.len == expect.len
+               && !memcmp(got.data, expect.data, got.len),
+               "%d threads, split at %d bits", threads[t], split[s]);
+            TMMDB_free_buffer(&got);
+        }
+    }
+    int calls = 0;
+    err = TMMDB_foreach_network_parallel(mmdb, 4, 16, format, fail_flush,
+                                         &calls);
+    ok(err == TMMDB_IOERROR && calls == 1, "flush errors stop the export");
+    ok(TMMDB_foreach_network_parallel(mmdb, 0, 8, format, flush, NULL)
+       == TMMDB_INVALIDARGUMENT, "0 threads are rejected");
+
+    TMMDB_free_buffer(&expect);
+    free(c.nets);
+}
+
+int main(void)
+{
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *mmdb;
+        int status = TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        if (mmdb) {
+            test_mmdb(mmdb);
+            TMMDB_close(mmdb);
+        }
+    }
+    done_testing();
+}
@@ -0,0 +1,85 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "test_helper.h"
+
+static void *slurp(const char *fname, size_t * size)
+{
+    FILE *f = fopen(fname, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    rewind(f);
+    void *buffer = malloc(*size);
+    if (fread(buffer, 1, *size, f) != *size) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(f);
+    return buffer;
+}
+
+static uint32_t lookup(TMMDB_s * mmdb, const char *ip)
+{
+    TMMDB_root_entry_s root;
+    lookup_ip(mmdb, ip, &root);
+    return root.entry.offset;
+}
+
+static void test_buffer(const char *fname, uint8_t * buffer, size_t size)
+{
+    TMMDB_s *file, *mmdb;
+    TMMDB_open(&file, fname, TMMDB_MODE_STANDARD);
+    uint32_t expect = lookup(file, "24.24.24.24");
+
+    int status = TMMDB_open_from_buffer(&mmdb, buffer, size,
+                                        TMMDB_MODE_STANDARD);
+    ok(status == TMMDB_SUCCESS && mmdb->file_in_mem_ptr == buffer,
+       "TMMDB_open_from_buffer %s uses the buffer", fname);
+    if (mmdb) {
+        ok(mmdb->node_count == file->node_count
+           && lookup(mmdb, "24.24.24.24") == expect && expect,
+           "24.24.24.24 is found");
+        TMMDB_close(mmdb);
+    }
+
+    status = TMMDB_open_from_buffer(&mmdb, buffer, size,
+                                    TMMDB_MODE_MEMORY_CACHE);
+    ok(status == TMMDB_SUCCESS && mmdb->file_in_mem_ptr != buffer,
+       "TMMDB_MODE_MEMORY_CACHE copies the buffer");
+    if (mmdb) {
+        // the copy does not need the buffer
+        memset(buffer, 0, size);
+        ok(lookup(mmdb, "24.24.24.24") == expect, "24.24.24.24 is found");
+        TMMDB_close(mmdb);
+    }
+    TMMDB_close(file);
+}
+
+int main(void)
+{
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        size_t size;
+        uint8_t *buffer = slurp(fname, &size);
+        ok(buffer != NULL, "read %s", fname);
+        if (!buffer)
+            continue;
+        uint8_t *copy = malloc(size);
+        memcpy(copy, buffer, size);
+        test_buffer(fname, copy, size);
+        free(copy);
+
+        TMMDB_s *mmdb;
+        ok(TMMDB_open_from_buffer(&mmdb, buffer, 0, TMMDB_MODE_STANDARD)
+           == TMMDB_INVALIDDATABASE && !mmdb, "an empty buffer is invalid");
+        ok(TMMDB_open_from_buffer(&mmdb, buffer, size / 2, TMMDB_MODE_STANDARD)
+           == TMMDB_INVALIDDATABASE, "half a database is invalid");
+        free(buffer);
+    }
+    done_testing();
+}
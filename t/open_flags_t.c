@@ -0,0 +1,59 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdint.h>
+#include "test_helper.h"
+
+static const int flags[] = {
+    TMMDB_OPT_POPULATE, TMMDB_OPT_ADVISE, TMMDB_OPT_HUGE_PAGES,
+    TMMDB_OPT_POPULATE | TMMDB_OPT_ADVISE | TMMDB_OPT_HUGE_PAGES,
+    TMMDB_OPT_HUGE_PAGES | TMMDB_OPT_JUMP_TABLE | TMMDB_OPT_PREFIX_CACHE,
+    TMMDB_MODE_MEMORY_CACHE, TMMDB_MODE_MEMORY_CACHE | TMMDB_OPT_HUGE_PAGES
+};
+
+int main(void)
+{
+    const char *ips[] = { "24.24.24.24", "1.2.3.4", "173.194.69.94", NULL };
+
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *plain;
+        int status = TMMDB_open(&plain, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        for (int f = 0; f < sizeof(flags) / sizeof(flags[0]); f++) {
+            TMMDB_s *mmdb;
+            status = TMMDB_open(&mmdb, fname, flags[f]);
+            ok(status == TMMDB_SUCCESS, "TMMDB_open with flags %d", flags[f]);
+            if (status != TMMDB_SUCCESS)
+                continue;
+            if (flags[f] & TMMDB_OPT_HUGE_PAGES)
+                ok(((uintptr_t) mmdb->file_in_mem_ptr & ((2 << 20) - 1)) == 0
+                   && mmdb->file_in_mem_ptr != plain->file_in_mem_ptr,
+                   "a copy aligned to 2MB");
+            if (flags[f] & TMMDB_MODE_MEMORY_CACHE)
+                ok(mmdb->file_in_mem_ptr != plain->file_in_mem_ptr
+                   && memcmp(mmdb->file_in_mem_ptr, plain->file_in_mem_ptr,
+                             plain->size) == 0, "the file is in memory");
+            ok(mmdb->node_count == plain->node_count
+               && mmdb->ipv4_start_node == plain->ipv4_start_node,
+               "the same metadata");
+            for (int i = 0; ips[i]; i++) {
+                TMMDB_root_entry_s expect, got;
+                lookup_ip(plain, ips[i], &expect);
+                lookup_ip(mmdb, ips[i], &got);
+                ok(got.entry.offset == expect.entry.offset
+                   && got.netmask == expect.netmask, "%s is the same", ips[i]);
+                if (!got.entry.offset)
+                    continue;
+                TMMDB_return_s res;
+                TMMDB_get_value(&got.entry, &res, "country", "iso_code", NULL);
+                ok(res.offset && TMMDB_strcmp_result(mmdb, &res, "US") == 0,
+                   "country/iso_code is US");
+            }
+            TMMDB_close(mmdb);
+        }
+        TMMDB_close(plain);
+    }
+    done_testing();
+}
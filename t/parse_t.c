@@ -0,0 +1,92 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdlib.h>
+#include "test_helper.h"
+
+const char *addresses[] = {
+    "0.0.0.0", "1.2.3.4", "24.24.24.24", "255.255.255.255", "256.1.1.1",
+    "1.2.3", "1.2.3.4.5", "01.2.3.4", "1.2.3.04", "1..2.3", ".1.2.3",
+    "1.2.3.", "1234.1.1.1", "1.2.3.4x", "a.b.c.d", "", " 1.2.3.4",
+    "::", "::1", "1::", "1::2", "::ffff:1.2.3.4", "::1.2.3.4",
+    "2001:db8::8a2e:370:7334", "2001:DB8:0:0:0:0:0:1",
+    "1:2:3:4:5:6:7:8", "1:2:3:4:5:6:7::", "::2:3:4:5:6:7:8",
+    "1:2:3:4:5:6:1.2.3.4", "1:2:3:4:5:6:7:1.2.3.4", "1:2:3:4:5:6:7:8:9",
+    "1::2::3", ":::", ":1::", "1:::2", "1:2", "12345::", "1:2:3:4:5:6:7:8::",
+    "::ffff:1.2.3", "::ffff:1.2.3.256", "::1.2.3.4:1", "fffff::", "g::",
+    "1:", ":", "::ffff:01.2.3.4", "ffff:1.2.3.4::",
+    NULL
+};
+
+int main(void)
+{
+    for (const char **a = addresses; *a; a++) {
+        uint32_t v4;
+        struct in_addr expect4;
+        int ok4 = inet_pton(AF_INET, *a, &expect4) == 1;
+        int err = TMMDB_parse_ipv4(*a, strlen(*a), &v4);
+        ok(ok4 ? err == TMMDB_SUCCESS && v4 == ntohl(expect4.s_addr)
+           : err == TMMDB_INVALIDARGUMENT, "TMMDB_parse_ipv4 '%s' %s", *a,
+           ok4 ? "is valid" : "is invalid");
+
+        struct in6_addr v6, expect6;
+        int ok6 = inet_pton(AF_INET6, *a, &expect6) == 1;
+        err = TMMDB_parse_ipv6(*a, strlen(*a), &v6);
+        ok(ok6 ? err == TMMDB_SUCCESS && !memcmp(&v6, &expect6, 16)
+           : err == TMMDB_INVALIDARGUMENT, "TMMDB_parse_ipv6 '%s' %s", *a,
+           ok6 ? "is valid" : "is invalid");
+    }
+
+    // the length counts, not the NUL
+    uint32_t v4;
+    const char *line = "10.1.2.3\t1.1.1.1\n";
+    ok(TMMDB_parse_ipv4(line, 8, &v4) == TMMDB_SUCCESS && v4 == 0x0a010203,
+       "TMMDB_parse_ipv4 stops at len");
+    ok(TMMDB_parse_ipv4(line, 7, &v4) == TMMDB_INVALIDARGUMENT,
+       "TMMDB_parse_ipv4 10.1.2.3 with len 7 is invalid");
+    struct in6_addr v6;
+    ok(TMMDB_parse_ipv6("::1:2", 3, &v6) == TMMDB_SUCCESS
+       && v6.s6_addr[15] == 1 && v6.s6_addr[13] == 0,
+       "TMMDB_parse_ipv6 stops at len");
+
+    // random addresses survive inet_ntop
+    srand(42);
+    int same = 1;
+    for (int i = 0; i < 10000; i++) {
+        char buf[INET6_ADDRSTRLEN];
+        uint8_t ip[16] = { 0 };
+        int zeros = rand() % 8;
+        for (int k = 0; k < 16; k++)
+            ip[k] = k / 2 < zeros ? 0 : rand();
+        inet_ntop(AF_INET6, ip, buf, sizeof(buf));
+        same &= TMMDB_parse_ipv6(buf, strlen(buf), &v6) == TMMDB_SUCCESS
+            && !memcmp(v6.s6_addr, ip, 16);
+        inet_ntop(AF_INET, ip + 12, buf, sizeof(buf));
+        same &= TMMDB_parse_ipv4(buf, strlen(buf), &v4) == TMMDB_SUCCESS
+            && v4 == ((uint32_t) ip[12] << 24 | ip[13] << 16 | ip[14] << 8
+                      | ip[15]);
+    }
+    ok(same, "10000 random addresses parse like inet_ntop prints them");
+
+    char *fnames[] = { "./data/v4-24.mmdb", "./data/v6-24.mmdb", NULL };
+    for (char **fname = fnames; *fname; fname++) {
+        TMMDB_s *mmdb;
+        int status = TMMDB_open(&mmdb, *fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", *fname);
+        if (!mmdb)
+            continue;
+        in_addrX expect, ip;
+        ip_to_num(mmdb, "24.24.24.24", &expect);
+        int err = TMMDB_parse_ip(mmdb, "24.24.24.24", 11, &ip);
+        ok(err == TMMDB_SUCCESS && (mmdb->depth == 32
+                                    ? ip.v4.s_addr == ntohl(expect.v4.s_addr)
+                                    : !memcmp(&ip.v6, &expect.v6, 16)),
+           "TMMDB_parse_ip 24.24.24.24 is what the lookups expect");
+        err = TMMDB_parse_ip(mmdb, "::1", 3, &ip);
+        ok(mmdb->depth == 32 ? err == TMMDB_INVALIDARGUMENT
+           : err == TMMDB_SUCCESS, "TMMDB_parse_ip ::1");
+        TMMDB_close(mmdb);
+    }
+    done_testing();
+}
@@ -0,0 +1,115 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include "test_helper.h"
+
+#define CNT (4000)
+
+static uint32_t ipnums[CNT];
+static struct in6_addr ipnums_128[CNT];
+
+static int same(TMMDB_root_entry_s * a, TMMDB_root_entry_s * b)
+{
+    return a->entry.offset == b->entry.offset && a->netmask == b->netmask;
+}
+
+// every lookup twice, the second one is usually answered by the cache
+static void compare(TMMDB_s * mmdb, const char *what)
+{
+    int ok32 = 0, ok128 = 0, okv4 = 0;
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < CNT; i++) {
+            TMMDB_root_entry_s expect, got = {.entry.mmdb = mmdb };
+            uint8_t ip[16] = { 0 };
+            ip[12] = ipnums[i] >> 24;
+            ip[13] = ipnums[i] >> 16;
+            ip[14] = ipnums[i] >> 8;
+            ip[15] = ipnums[i];
+
+            if (mmdb->depth == 32) {
+                walk_tree_32(mmdb, ipnums[i], &expect);
+                if (TMMDB_lookup_by_ipnum(ipnums[i], &got) == TMMDB_SUCCESS
+                    && same(&expect, &got))
+                    ok32++;
+            } else {
+                walk_tree(mmdb, ip, 128, &expect);
+                expect.netmask = expect.netmask > 96 ? expect.netmask - 96 : 0;
+                if (TMMDB_lookup_by_ipnum_v4(ipnums[i], &got) == TMMDB_SUCCESS
+                    && same(&expect, &got))
+                    okv4++;
+            }
+            walk_tree(mmdb, ipnums_128[i].s6_addr, 128, &expect);
+            if (TMMDB_lookup_by_ipnum_128(ipnums_128[i], &got) == TMMDB_SUCCESS
+                && same(&expect, &got))
+                ok128++;
+        }
+    }
+    if (mmdb->depth == 32)
+        ok(ok32 == 2 * CNT, "TMMDB_lookup_by_ipnum matches ( %s, %d )", what,
+           ok32);
+    else
+        ok(okv4 == 2 * CNT, "TMMDB_lookup_by_ipnum_v4 matches ( %s, %d )",
+           what, okv4);
+    ok(ok128 == 2 * CNT, "TMMDB_lookup_by_ipnum_128 matches ( %s, %d )", what,
+       ok128);
+}
+
+int main(void)
+{
+    // a few networks with many addresses each, like NAT gateways do
+    for (int n = 0; n < CNT; n++) {
+        uint32_t net = (n % 7) * 0x01020300U + 0x18181800U;
+        ipnums[n] = n & 1 ? (uint32_t)rand() : net + (rand() & 0x3ff);
+        for (int i = 0; i < 16; i++)
+            ipnums_128[n].s6_addr[i] = rand();
+        if (n % 3 == 0) {
+            memset(&ipnums_128[n], 0, 12);
+            memcpy(&ipnums_128[n].s6_addr[12], "\x18\x18", 2);
+        } else if (n % 3 == 1) {
+            memcpy(&ipnums_128[n], "\x20\x01\x48\x60\xb0\x02", 6);
+        } else if (n & 4) {
+            memcpy(&ipnums_128[n], "\0\0\0\0\0\0\0\0\0\0\xff\xff\x18\x18", 14);
+        }
+    }
+
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *mmdb;
+        int status = TMMDB_open(&mmdb, fname,
+                                TMMDB_MODE_STANDARD | TMMDB_OPT_PREFIX_CACHE);
+        ok(status == TMMDB_SUCCESS,
+           "TMMDB_open %s with TMMDB_OPT_PREFIX_CACHE successful", fname);
+        if (!mmdb)
+            continue;
+        ok(mmdb->prefix_cache != NULL
+           && TMMDB_index_memory(mmdb) == mmdb->prefix_cache_size
+           && mmdb->prefix_cache_size > 0, "prefix cache uses %u bytes",
+           (unsigned int)mmdb->prefix_cache_size);
+        compare(mmdb, "default");
+
+        int bits[] = { 1, 4, 20 };
+        for (int i = 0; i < sizeof(bits) / sizeof(int); i++) {
+            char what[32];
+            snprintf(what, sizeof(what), "%d bits", bits[i]);
+            status = TMMDB_enable_prefix_cache(mmdb, bits[i]);
+            ok(status == TMMDB_SUCCESS, "TMMDB_enable_prefix_cache %s", what);
+            compare(mmdb, what);
+        }
+
+        TMMDB_build_jump_table(mmdb, TMMDB_JUMP_TABLE_DEFAULT_BITS);
+        compare(mmdb, "with jump table");
+
+        ok(TMMDB_enable_prefix_cache(mmdb, TMMDB_PREFIX_CACHE_MAX_BITS + 1)
+           == TMMDB_INVALIDARGUMENT, "too many bits are rejected");
+        ok(TMMDB_enable_prefix_cache(mmdb, 0) == TMMDB_SUCCESS
+           && mmdb->prefix_cache == NULL && mmdb->prefix_cache_size == 0,
+           "0 bits removes the prefix cache");
+        compare(mmdb, "no cache");
+
+        TMMDB_enable_prefix_cache(mmdb, 8);
+        TMMDB_close(mmdb);
+    }
+    done_testing();
+}
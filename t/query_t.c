@@ -0,0 +1,94 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include "test_helper.h"
+
+const char *paths[][6] = {
+    {"country", "iso_code", NULL},
+    {"country", "names", "en", NULL},
+    {"country", "names", "whatever", NULL},
+    {"city", "names", "en", NULL},
+    {"location", "latitude", NULL},
+    {"subdivisions", "0", "names", "en", NULL},
+    {"subdivisions", "1", "names", "en", NULL},
+    {"traits", "is_military", NULL},
+    {"test_data", "max", "float_t", NULL},
+    {"test_data", "tst", "array_ieee754_double_t", "3", NULL},
+    {"test_data", "tst", "array_ieee754_double_t", "13", NULL},
+    {"test_data", "tst", "array_ieee754_double_t", "14", NULL},
+    {"test_data", "tst", "array_ieee754_double_t", "-1", NULL},
+    {"test_data", NULL},
+    {"", NULL},
+    {NULL}
+};
+
+// the same as TMMDB_get_value, but with the keys from an array
+static void get_value(TMMDB_entry_s * entry, TMMDB_return_s * result,
+                      const char *const *k)
+{
+    const char *key[6] = { NULL };
+    for (int i = 0; k[i]; i++)
+        key[i] = k[i];
+    TMMDB_get_value(entry, result, key[0], key[1], key[2], key[3], key[4],
+                    key[5], NULL);
+}
+
+void test_mmdb(TMMDB_s * mmdb)
+{
+    TMMDB_root_entry_s root;
+    int err = lookup_ip(mmdb, "24.24.24.24", &root);
+    ok(err == TMMDB_SUCCESS && root.entry.offset > 0, "Found 24.24.24.24");
+
+    for (int i = 0; paths[i][0]; i++) {
+        TMMDB_query_s *query;
+        TMMDB_return_s expect, got;
+        err = TMMDB_compile_query(&query, paths[i]);
+        ok(err == TMMDB_SUCCESS, "TMMDB_compile_query %s/%s", paths[i][0],
+           paths[i][1] ? paths[i][1] : "");
+        get_value(&root.entry, &expect, paths[i]);
+        err = TMMDB_query_value(&root.entry, query, &got);
+        ok(err == TMMDB_SUCCESS, "TMMDB_query_value SUCCESSFUL");
+        ok(same_return(&expect, &got),
+           "TMMDB_query_value is the same as TMMDB_get_value ( %s )",
+           got.offset ? "found" : "not found");
+        // compiled queries are reusable
+        err = TMMDB_query_value(&root.entry, query, &got);
+        ok(same_return(&expect, &got), "Second TMMDB_query_value is the same");
+        TMMDB_free_query(query);
+    }
+
+    TMMDB_query_s *query;
+    TMMDB_return_s result;
+    const char *not_a_number[] =
+        { "test_data", "tst", "array_ieee754_double_t", "x", NULL };
+    TMMDB_compile_query(&query, not_a_number);
+    ok(query->count == 4 && query->keys[3].idx == -1,
+       "x is not an array index");
+    TMMDB_query_value(&root.entry, query, &result);
+    ok(result.offset == 0, "x is not found in the array");
+    TMMDB_free_query(query);
+
+    const char *found[] = { "country", "iso_code", NULL };
+    TMMDB_compile_query(&query, found);
+    TMMDB_query_value(&root.entry, query, &result);
+    ok(result.offset > 0 && TMMDB_strcmp_result(mmdb, &result, "US") == 0,
+       "country/iso_code is US");
+    TMMDB_free_query(query);
+}
+
+int main(void)
+{
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *mmdb;
+        int status = TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        if (mmdb) {
+            test_mmdb(mmdb);
+            TMMDB_close(mmdb);
+        }
+    }
+    done_testing();
+}
@@ -0,0 +1,146 @@
+#include "tinymmdb.h"
+#include "tinymmdb_writer.h"
+#include "tap.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "test_helper.h"
+
+#define FNAME "./range_table_t.mmdb"
+#define NETWORKS (5000)
+#define SAMPLES (100000)
+
+static uint32_t seed = 42;
+
+static uint32_t next_random(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+typedef struct {
+    TMMDB_s *plain;
+    TMMDB_s *mmdb;
+    int checked;
+    int same;
+} check_s;
+
+static int same_lookup(check_s * c, uint32_t ipnum)
+{
+    TMMDB_root_entry_s expect = {.entry.mmdb = c->plain };
+    TMMDB_root_entry_s got = {.entry.mmdb = c->mmdb };
+    TMMDB_lookup_by_ipnum_v4(ipnum, &expect);
+    TMMDB_lookup_by_ipnum_v4(ipnum, &got);
+    c->checked++;
+    return got.entry.offset == expect.entry.offset
+        && got.netmask == expect.netmask;
+}
+
+// the first and the last address of every network and their neighbours
+static int check_network(void *ctx, TMMDB_network_s const *network)
+{
+    check_s *c = ctx;
+    static const uint8_t zero[12];
+    int netmask = network->netmask - (c->mmdb->depth == 32 ? 0 : 96);
+    // the IPv4 networks of IPv6 databases are in ::/96
+    if (netmask < 0
+        || (c->mmdb->depth == 128 && memcmp(network->ip, zero, 12)))
+        return TMMDB_SUCCESS;
+    const uint8_t *ip = network->ip + (c->mmdb->depth == 32 ? 0 : 12);
+    uint32_t first = (uint32_t) ip[0] << 24 | ip[1] << 16 | ip[2] << 8 | ip[3];
+    uint32_t last = first | (netmask ? ~0U >> netmask : ~0U);
+    int same = same_lookup(c, first) && same_lookup(c, last)
+        && same_lookup(c, first - 1) && same_lookup(c, last + 1);
+    c->same += same ? 4 : 0;
+    return TMMDB_SUCCESS;
+}
+
+static void test_mmdb(const char *fname)
+{
+    TMMDB_s *plain, *mmdb;
+    TMMDB_open(&plain, fname, TMMDB_MODE_STANDARD);
+    int err = TMMDB_open(&mmdb, fname, TMMDB_OPT_RANGE_TABLE);
+    ok(err == TMMDB_SUCCESS && mmdb->range_table,
+       "TMMDB_open %s with TMMDB_OPT_RANGE_TABLE", fname);
+    if (err != TMMDB_SUCCESS)
+        return;
+    ok(TMMDB_index_memory(mmdb) > 0, "%zu bytes for the table",
+       TMMDB_index_memory(mmdb));
+
+    check_s c = {.plain = plain,.mmdb = mmdb };
+    TMMDB_foreach_network(mmdb, check_network, &c);
+    ok(c.checked > 0 && c.same == c.checked,
+       "%d of %d network bounds are the same", c.same, c.checked);
+
+    c.checked = c.same = 0;
+    for (int i = 0; i < SAMPLES; i++)
+        c.same += same_lookup(&c, next_random());
+    ok(c.same == SAMPLES, "%d of %d random addresses are the same", c.same,
+       SAMPLES);
+
+    if (mmdb->depth == 32) {
+        uint32_t ipnums[64];
+        TMMDB_root_entry_s expect[64], got[64];
+        for (int i = 0; i < 64; i++)
+            ipnums[i] = next_random();
+        TMMDB_lookup_many_ipnum(plain, ipnums, 64, expect);
+        TMMDB_lookup_many_ipnum(mmdb, ipnums, 64, got);
+        int same = 0;
+        for (int i = 0; i < 64; i++)
+            same += got[i].entry.offset == expect[i].entry.offset
+                && got[i].netmask == expect[i].netmask;
+        ok(same == 64, "TMMDB_lookup_many_ipnum uses the table");
+    }
+
+    err = TMMDB_build_range_table(mmdb, 1);
+    ok(err == TMMDB_OUTOFMEMORY ? !mmdb->range_table : err == TMMDB_SUCCESS,
+       "no table for more ranges than max_ranges");
+    ok(TMMDB_build_range_table(mmdb, 0) == TMMDB_SUCCESS
+       && !mmdb->range_table && TMMDB_index_memory(mmdb) == 0,
+       "max_ranges 0 removes the table");
+    TMMDB_close(mmdb);
+    TMMDB_close(plain);
+}
+
+// many random networks of every size, some nested
+static void write_db(int ip_version)
+{
+    TMMDB_writer_s *w;
+    TMMDB_writer_new(&w, ip_version, 28);
+    uint32_t records[16];
+    for (int i = 0; i < 16; i++) {
+        records[i] = TMMDB_writer_map(w, 1);
+        TMMDB_writer_key(w, "id");
+        TMMDB_writer_uint(w, TMMDB_DTYPE_UINT32, i);
+    }
+    int v4 = ip_version == 4 ? 0 : 12, bits = ip_version == 4 ? 0 : 96;
+    for (int i = 0; i < NETWORKS; i++) {
+        uint8_t ip[16] = { 0 };
+        uint32_t ipnum = next_random();
+        int netmask = 8 + next_random() % 25;
+        ipnum &= ~0U << (32 - netmask);
+        for (int b = 0; b < 4; b++)
+            ip[v4 + b] = ipnum >> (24 - 8 * b);
+        TMMDB_writer_insert(w, ip, bits + netmask, records[i % 16]);
+    }
+    if (ip_version == 6)
+        TMMDB_writer_alias_ipv4(w);
+    TMMDB_writer_write(w, FNAME, "Test", "range_table_t");
+    TMMDB_writer_free(w);
+}
+
+int main(void)
+{
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);)
+        test_mmdb(fname);
+    write_db(4);
+    test_mmdb(FNAME);
+    write_db(6);
+    test_mmdb(FNAME);
+    unlink(FNAME);
+    done_testing();
+}
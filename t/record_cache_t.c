@@ -0,0 +1,142 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include "test_helper.h"
+
+const char *paths[][5] = {
+    {"location", "latitude", NULL},
+    {"city", "names", "en", NULL},
+    {"country", "iso_code", NULL},
+    {"subdivisions", "0", "names", "en", NULL},
+    {"en", NULL},
+    {"iso_code", NULL},
+};
+
+#define NPATHS (sizeof(paths) / sizeof(paths[0]))
+#define NENTRIES (8)
+
+// compare the cache with TMMDB_get_values for all entries, round after round
+static void compare(TMMDB_s * mmdb, TMMDB_query_s ** queries,
+                    TMMDB_entry_s * entries, int n, int rounds,
+                    const char *what)
+{
+    int same = 0;
+    for (int r = 0; r < rounds; r++) {
+        for (int e = 0; e < n; e++) {
+            TMMDB_return_s expect[NPATHS], got[NPATHS];
+            TMMDB_get_values(&entries[e], (TMMDB_query_s const *const *)queries,
+                             NPATHS, expect);
+            if (TMMDB_cached_values(&entries[e], got) != TMMDB_SUCCESS)
+                continue;
+            int i;
+            for (i = 0; i < NPATHS && same_return(&expect[i], &got[i]); i++) ;
+            if (i == NPATHS)
+                same++;
+        }
+    }
+    ok(same == n * rounds, "Cached values match ( %s, %d of %d )", what, same,
+       n * rounds);
+}
+
+void test_mmdb(TMMDB_s * mmdb, TMMDB_query_s ** queries)
+{
+    TMMDB_root_entry_s root;
+    TMMDB_entry_s entries[NENTRIES];
+    uint64_t hits, misses;
+    int n = 0;
+
+    int err = lookup_ip(mmdb, "24.24.24.24", &root);
+    ok(err == TMMDB_SUCCESS && root.entry.offset > 0, "Found 24.24.24.24");
+
+    // the record and some maps inside of it are our distinct entries
+    const char *inner[][4] = {
+        {"city", NULL}, {"country", NULL}, {"location", NULL},
+        {"city", "names", NULL}, {"country", "names", NULL},
+        {"registered_country", NULL}, {"continent", NULL}
+    };
+    entries[n++] = root.entry;
+    for (int i = 0; i < sizeof(inner) / sizeof(inner[0]); i++) {
+        TMMDB_return_s res;
+        TMMDB_get_value(&root.entry, &res, inner[i][0], inner[i][1], NULL);
+        int seen = 0;
+        for (int e = 0; e < n; e++)
+            seen |= entries[e].offset == res.offset;
+        if (res.offset && res.type == TMMDB_DTYPE_MAP && !seen) {
+            entries[n].mmdb = mmdb;
+            entries[n++].offset = res.offset;
+        }
+    }
+    ok(n > 4, "%d distinct entries", n);
+
+    TMMDB_return_s results[NPATHS];
+    ok(TMMDB_cached_values(&root.entry, results) == TMMDB_INVALIDARGUMENT,
+       "No cache without TMMDB_enable_record_cache");
+    ok(TMMDB_enable_record_cache(mmdb, (TMMDB_query_s const *const *)queries,
+                                 NPATHS, 16, 42) == TMMDB_INVALIDARGUMENT,
+       "Unknown policy is rejected");
+    ok(TMMDB_enable_record_cache(mmdb, (TMMDB_query_s const *const *)queries,
+                                 NPATHS, (1 << 30) + 1, TMMDB_CACHE_LRU)
+       == TMMDB_INVALIDARGUMENT, "A capacity above the maximum is rejected");
+
+    int policies[] = { TMMDB_CACHE_LRU, TMMDB_CACHE_CLOCK };
+    for (int p = 0; p < 2; p++) {
+        int capacity[] = { 1, 3, NENTRIES };
+        for (int c = 0; c < 3; c++) {
+            char what[64];
+            snprintf(what, sizeof(what), "%s, capacity %d",
+                     policies[p] == TMMDB_CACHE_LRU ? "LRU" : "CLOCK",
+                     capacity[c]);
+            err = TMMDB_enable_record_cache(mmdb,
+                                            (TMMDB_query_s const *const *)
+                                            queries, NPATHS, capacity[c],
+                                            policies[p]);
+            ok(err == TMMDB_SUCCESS, "TMMDB_enable_record_cache %s", what);
+            compare(mmdb, queries, entries, n, 5, what);
+            TMMDB_record_cache_stats(mmdb, &hits, &misses);
+            ok(hits + misses == 5 * n, "%u hits and %u misses",
+               (unsigned int)hits, (unsigned int)misses);
+            if (capacity[c] >= n)
+                ok(misses == n, "Every entry missed once");
+        }
+    }
+
+    // the same record over and over
+    for (int i = 0; i < 100; i++)
+        TMMDB_cached_values(&root.entry, results);
+    TMMDB_record_cache_stats(mmdb, &hits, &misses);
+    ok(hits >= 100, "Repeated record hits the cache");
+
+    ok(TMMDB_enable_record_cache(mmdb, NULL, 0, 0, TMMDB_CACHE_LRU)
+       == TMMDB_SUCCESS && mmdb->record_cache == NULL,
+       "Capacity 0 removes the cache");
+    TMMDB_record_cache_stats(mmdb, &hits, &misses);
+    ok(hits == 0 && misses == 0, "No stats without a cache");
+
+    // leave a cache for TMMDB_close
+    TMMDB_enable_record_cache(mmdb, (TMMDB_query_s const *const *)queries,
+                              NPATHS, 4, TMMDB_CACHE_CLOCK);
+}
+
+int main(void)
+{
+    TMMDB_query_s *queries[NPATHS];
+    for (int i = 0; i < NPATHS; i++)
+        TMMDB_compile_query(&queries[i], paths[i]);
+
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *mmdb;
+        int status = TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        if (mmdb) {
+            test_mmdb(mmdb, queries);
+            TMMDB_close(mmdb);
+        }
+    }
+    // the cache keeps its own copy of the queries
+    for (int i = 0; i < NPATHS; i++)
+        TMMDB_free_query(queries[i]);
+    done_testing();
+}
@@ -0,0 +1,99 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <pthread.h>
+#include "test_helper.h"
+
+#define THREADS (4)
+#define LOOKUPS (1000)
+
+static uint64_t sum(const uint64_t * v, int n)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < n; i++)
+        total += v[i];
+    return total;
+}
+
+static void *lookups(void *arg)
+{
+    TMMDB_s *mmdb = arg;
+    for (int i = 0; i < LOOKUPS; i++) {
+        TMMDB_root_entry_s root = {.entry.mmdb = mmdb };
+        lookup_ip(mmdb, "24.24.24.24", &root);
+    }
+    return NULL;
+}
+
+void test_mmdb(TMMDB_s * mmdb)
+{
+    TMMDB_stats_s stats;
+    ok(TMMDB_stats_snapshot(mmdb, &stats) == TMMDB_INVALIDARGUMENT
+       && stats.lookups == 0, "no stats before TMMDB_enable_stats");
+    ok(TMMDB_enable_stats(mmdb) == TMMDB_SUCCESS, "TMMDB_enable_stats");
+
+    TMMDB_root_entry_s root = {.entry.mmdb = mmdb };
+    lookup_ip(mmdb, "24.24.24.24", &root);
+    TMMDB_stats_snapshot(mmdb, &stats);
+    ok(stats.lookups == 1, "1 lookup");
+    ok(stats.depth[root.netmask] == 1, "at depth %d", root.netmask);
+    ok(sum(stats.latency, TMMDB_STATS_LATENCY_BUCKETS) == 1,
+       "1 latency sample");
+
+    TMMDB_return_s res;
+    TMMDB_get_value(&root.entry, &res, "location", "longitude", NULL);
+    TMMDB_stats_s after;
+    TMMDB_stats_snapshot(mmdb, &after);
+    ok(after.keys_compared > stats.keys_compared,
+       "%llu keys compared for location/longitude",
+       (unsigned long long)(after.keys_compared - stats.keys_compared));
+    ok(after.bytes_skipped > stats.bytes_skipped,
+       "%llu bytes skipped",
+       (unsigned long long)(after.bytes_skipped - stats.bytes_skipped));
+    ok(after.lookups == 1, "get_value is no lookup");
+
+    uint32_t ipnums[16] = { 0 };
+    TMMDB_root_entry_s many[16];
+    TMMDB_lookup_many_ipnum(mmdb, ipnums, 16, many);
+    TMMDB_stats_snapshot(mmdb, &stats);
+    ok(stats.lookups == 17
+       && sum(stats.depth, 129) == 17
+       && sum(stats.latency, TMMDB_STATS_LATENCY_BUCKETS) == 17,
+       "TMMDB_lookup_many_ipnum counts 16 lookups");
+
+    pthread_t tid[THREADS];
+    for (int t = 0; t < THREADS; t++)
+        pthread_create(&tid[t], NULL, lookups, mmdb);
+    for (int t = 0; t < THREADS; t++)
+        pthread_join(tid[t], NULL);
+    TMMDB_stats_snapshot(mmdb, &stats);
+    ok(stats.lookups == 17 + THREADS * LOOKUPS,
+       "every thread counts its own lookups");
+}
+
+int main(void)
+{
+    TMMDB_s *mmdb;
+    int status = TMMDB_open(&mmdb, test_databases[0], TMMDB_MODE_STANDARD);
+    ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", test_databases[0]);
+    if (TMMDB_enable_stats(mmdb) != TMMDB_SUCCESS) {
+        TMMDB_stats_s stats;
+        ok(TMMDB_stats_snapshot(mmdb, &stats) == TMMDB_INVALIDARGUMENT,
+           "built without --enable-stats, no stats");
+        TMMDB_close(mmdb);
+        done_testing();
+    }
+    TMMDB_close(mmdb);
+
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        status = TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        if (mmdb) {
+            test_mmdb(mmdb);
+            TMMDB_close(mmdb);
+        }
+    }
+    done_testing();
+}
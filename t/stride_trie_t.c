@@ -0,0 +1,214 @@
+#include "tinymmdb.h"
+#include "tinymmdb_writer.h"
+#include "tap.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "test_helper.h"
+
+#define FNAME "./stride_trie_t.mmdb"
+#define NETWORKS (5000)
+#define SAMPLES (100000)
+
+static uint32_t seed = 42;
+
+static uint32_t next_random(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+typedef struct {
+    TMMDB_s *plain;
+    TMMDB_s *mmdb;
+    int checked;
+    int same;
+} check_s;
+
+static int same_result(TMMDB_root_entry_s * expect, TMMDB_root_entry_s * got)
+{
+    return got->entry.offset == expect->entry.offset
+        && got->netmask == expect->netmask;
+}
+
+static int same_lookup(check_s * c, const uint8_t * ip)
+{
+    TMMDB_root_entry_s expect = {.entry.mmdb = c->plain };
+    TMMDB_root_entry_s got = {.entry.mmdb = c->mmdb };
+    c->checked++;
+    if (c->mmdb->depth == 32) {
+        uint32_t ipnum = (uint32_t) ip[0] << 24 | ip[1] << 16 | ip[2] << 8
+            | ip[3];
+        TMMDB_lookup_by_ipnum(ipnum, &expect);
+        TMMDB_lookup_by_ipnum(ipnum, &got);
+    } else {
+        struct in6_addr a;
+        memcpy(a.s6_addr, ip, 16);
+        TMMDB_lookup_by_ipnum_128(a, &expect);
+        TMMDB_lookup_by_ipnum_128(a, &got);
+    }
+    return same_result(&expect, &got);
+}
+
+static void random_ip(uint8_t * ip)
+{
+    for (int i = 0; i < 16; i += 4) {
+        uint32_t r = next_random();
+        memcpy(ip + i, &r, 4);
+    }
+}
+
+// the first and the last address of every network
+static int check_network(void *ctx, TMMDB_network_s const *network)
+{
+    check_s *c = ctx;
+    int bytes = c->mmdb->depth / 8;
+    uint8_t last[16];
+    memcpy(last, network->ip, bytes);
+    for (int bit = network->netmask; bit < c->mmdb->depth; bit++)
+        last[bit / 8] |= 0x80 >> bit % 8;
+    c->same += same_lookup(c, network->ip) + same_lookup(c, last);
+    return TMMDB_SUCCESS;
+}
+
+static void test_mmdb(const char *fname, int top_bits)
+{
+    TMMDB_s *plain, *mmdb;
+    TMMDB_open(&plain, fname, TMMDB_MODE_STANDARD);
+    int err = top_bits == TMMDB_STRIDE_TRIE_DEFAULT_TOP_BITS
+        ? TMMDB_open(&mmdb, fname, TMMDB_OPT_STRIDE_TRIE)
+        : TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+    if (err == TMMDB_SUCCESS
+        && top_bits != TMMDB_STRIDE_TRIE_DEFAULT_TOP_BITS)
+        err = TMMDB_build_stride_trie(mmdb, top_bits);
+    ok(err == TMMDB_SUCCESS && mmdb->stride_trie,
+       "%s with a %d bit top table", fname, top_bits);
+    if (err != TMMDB_SUCCESS)
+        return;
+    ok(TMMDB_index_memory(mmdb) > 0, "%zu bytes for the trie",
+       TMMDB_index_memory(mmdb));
+
+    check_s c = {.plain = plain,.mmdb = mmdb };
+    TMMDB_foreach_network(mmdb, check_network, &c);
+    ok(c.checked > 0 && c.same == c.checked,
+       "%d of %d network bounds are the same", c.same, c.checked);
+
+    c.checked = c.same = 0;
+    for (int i = 0; i < SAMPLES; i++) {
+        uint8_t ip[16];
+        random_ip(ip);
+        if (mmdb->depth == 128) {
+            // IPv4 in ::/96, ::ffff:0:0/96 and 2002::/16 as well
+            switch (i % 4) {
+            case 1:
+                memset(ip, 0, 12);
+                break;
+            case 2:
+                memset(ip, 0, 10);
+                ip[10] = ip[11] = 0xff;
+                break;
+            case 3:
+                ip[0] = 0x20;
+                ip[1] = 0x02;
+                break;
+            }
+        }
+        c.same += same_lookup(&c, ip);
+    }
+    ok(c.same == SAMPLES, "%d of %d random addresses are the same", c.same,
+       SAMPLES);
+
+    int same = 0;
+    for (int i = 0; i < SAMPLES; i++) {
+        uint32_t ipnum = next_random();
+        TMMDB_root_entry_s expect = {.entry.mmdb = plain };
+        TMMDB_root_entry_s got = {.entry.mmdb = mmdb };
+        TMMDB_lookup_by_ipnum_v4(ipnum, &expect);
+        TMMDB_lookup_by_ipnum_v4(ipnum, &got);
+        same += same_result(&expect, &got);
+    }
+    ok(same == SAMPLES, "TMMDB_lookup_by_ipnum_v4 is the same");
+
+    TMMDB_root_entry_s expect[64], got[64];
+    same = 0;
+    if (mmdb->depth == 32) {
+        uint32_t ipnums[64];
+        for (int i = 0; i < 64; i++)
+            ipnums[i] = next_random();
+        TMMDB_lookup_many_ipnum(plain, ipnums, 64, expect);
+        TMMDB_lookup_many_ipnum(mmdb, ipnums, 64, got);
+    } else {
+        struct in6_addr ipnums[64];
+        for (int i = 0; i < 64; i++)
+            random_ip(ipnums[i].s6_addr);
+        TMMDB_lookup_many_ipnum_128(plain, ipnums, 64, expect);
+        TMMDB_lookup_many_ipnum_128(mmdb, ipnums, 64, got);
+    }
+    for (int i = 0; i < 64; i++)
+        same += same_result(&expect[i], &got[i]);
+    ok(same == 64, "the many lookups use the trie");
+
+    ok(TMMDB_build_stride_trie(mmdb, 5) == TMMDB_INVALIDARGUMENT
+       && TMMDB_build_stride_trie(mmdb, 25) == TMMDB_INVALIDARGUMENT,
+       "top tables of 5 and 25 bits are invalid");
+    ok(TMMDB_build_stride_trie(mmdb, 0) == TMMDB_SUCCESS
+       && !mmdb->stride_trie && TMMDB_index_memory(mmdb) == 0,
+       "top_bits 0 removes the trie");
+    TMMDB_close(mmdb);
+    TMMDB_close(plain);
+}
+
+// many random networks of every size, some nested
+static void write_db(int ip_version)
+{
+    TMMDB_writer_s *w;
+    TMMDB_writer_new(&w, ip_version, 28);
+    uint32_t records[16];
+    for (int i = 0; i < 16; i++) {
+        records[i] = TMMDB_writer_map(w, 1);
+        TMMDB_writer_key(w, "id");
+        TMMDB_writer_uint(w, TMMDB_DTYPE_UINT32, i);
+    }
+    for (int i = 0; i < NETWORKS; i++) {
+        uint8_t ip[16] = { 0 };
+        int netmask;
+        if (ip_version == 4 || i % 2) {
+            netmask = 8 + next_random() % 25;
+            uint32_t ipnum = next_random() & ~0U << (32 - netmask);
+            int v4 = ip_version == 4 ? 0 : 12;
+            for (int b = 0; b < 4; b++)
+                ip[v4 + b] = ipnum >> (24 - 8 * b);
+            netmask += ip_version == 4 ? 0 : 96;
+        } else {
+            // in 2000::/3, but not in 2002::/16
+            random_ip(ip);
+            ip[0] = 0x20 | (ip[0] & 0x1f);
+            if (ip[0] == 0x20 && ip[1] == 0x02)
+                ip[1] = 0x03;
+            netmask = 16 + next_random() % 113;
+        }
+        TMMDB_writer_insert(w, ip, netmask, records[i % 16]);
+    }
+    if (ip_version == 6)
+        TMMDB_writer_alias_ipv4(w);
+    TMMDB_writer_write(w, FNAME, "Test", "stride_trie_t");
+    TMMDB_writer_free(w);
+}
+
+int main(void)
+{
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);)
+        test_mmdb(fname, TMMDB_STRIDE_TRIE_DEFAULT_TOP_BITS);
+    for (int v = 4; v <= 6; v += 2) {
+        write_db(v);
+        test_mmdb(FNAME, TMMDB_STRIDE_TRIE_DEFAULT_TOP_BITS);
+        test_mmdb(FNAME, 6);
+        test_mmdb(FNAME, 20);
+    }
+    unlink(FNAME);
+    done_testing();
+}
@@ -2,8 +2,15 @@
 #include "tinymmdb.h"
 #include <netdb.h>
 #include <stdio.h>
+#include <string.h>
 #include "test_helper.h"
 #include <math.h>
+#include <arpa/inet.h>
+
+const char *const test_databases[] = {
+    "./data/v4-24.mmdb", "./data/v4-28.mmdb", "./data/v4-32.mmdb",
+    "./data/v6-24.mmdb", "./data/v6-28.mmdb", "./data/v6-32.mmdb", NULL
+};
 
 // 0 == equal
 int dbl_cmp(double a, double b)
@@ -32,3 +39,89 @@ void ip_to_num(TMMDB_s * mmdb, char *ipstr, in_addrX * dest_ipnum)
         exit(1);
     }
 }
+
+// looks ipnum up with TMMDB_lookup_by_ipnum or TMMDB_lookup_by_ipnum_128,
+// whatever fits the database. Sets root->entry.mmdb.
+int lookup_ipnum(TMMDB_s * mmdb, const in_addrX * ipnum,
+                 TMMDB_root_entry_s * root)
+{
+    root->entry.mmdb = mmdb;
+    return mmdb->depth == 32
+        ? TMMDB_lookup_by_ipnum(ntohl(ipnum->v4.s_addr), root)
+        : TMMDB_lookup_by_ipnum_128(ipnum->v6, root);
+}
+
+int lookup_ip(TMMDB_s * mmdb, const char *ipstr, TMMDB_root_entry_s * root)
+{
+    in_addrX ipnum;
+    ip_to_num(mmdb, (char *)ipstr, &ipnum);
+    return lookup_ipnum(mmdb, &ipnum, root);
+}
+
+// reference search, one bit after the other from the root of the tree.
+// ip contains bits / 8 bytes in network order.
+int walk_tree(TMMDB_s * mmdb, const uint8_t * ip, int bits,
+              TMMDB_root_entry_s * res)
+{
+    const uint8_t *mem = mmdb->file_in_mem_ptr;
+    int rl = mmdb->full_record_size_bytes;
+    // a 128 bit search in an IPv4 database uses the last 32 bits
+    int start = bits == 128 ? 128 - mmdb->depth : 0;
+    uint32_t node = 0;
+    for (int i = start; i < bits; i++) {
+        const uint8_t *p = &mem[node * rl];
+        int bit = (ip[i >> 3] >> (7 - (i & 7))) & 1;
+        if (rl == 6)
+            node = bit ? p[3] << 16 | p[4] << 8 | p[5]
+                : p[0] << 16 | p[1] << 8 | p[2];
+        else if (rl == 7)
+            node = bit ? (p[3] & 0xfU) << 24 | p[4] << 16 | p[5] << 8 | p[6]
+                : (p[3] & 0xf0U) << 20 | p[0] << 16 | p[1] << 8 | p[2];
+        else
+            node = bit ? (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7]
+                : (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+        if (node >= mmdb->node_count) {
+            res->entry.mmdb = mmdb;
+            res->entry.offset = node - mmdb->node_count;
+            res->netmask = i + 1;
+            return TMMDB_SUCCESS;
+        }
+    }
+    return TMMDB_CORRUPTDATABASE;
+}
+
+int walk_tree_32(TMMDB_s * mmdb, uint32_t ipnum, TMMDB_root_entry_s * res)
+{
+    uint8_t ip[4] = { ipnum >> 24, ipnum >> 16, ipnum >> 8, ipnum };
+    return walk_tree(mmdb, ip, 32, res);
+}
+
+// compare two results by the value of their type
+int same_return(TMMDB_return_s * a, TMMDB_return_s * b)
+{
+    if (a->offset != b->offset)
+        return 0;
+    if (a->offset == 0)
+        return 1;
+    if (a->type != b->type)
+        return 0;
+    // data_size is only set for strings, bytes, maps and arrays
+    switch (a->type) {
+    case TMMDB_DTYPE_UTF8_STRING:
+    case TMMDB_DTYPE_BYTES:
+        return a->ptr == b->ptr && a->data_size == b->data_size;
+    case TMMDB_DTYPE_IEEE754_DOUBLE:
+        return a->double_value == b->double_value;
+    case TMMDB_DTYPE_IEEE754_FLOAT:
+        return a->float_value == b->float_value;
+    case TMMDB_DTYPE_UINT64:
+        return !memcmp(a->c8, b->c8, 8);
+    case TMMDB_DTYPE_UINT128:
+        return !memcmp(a->c16, b->c16, 16);
+    case TMMDB_DTYPE_MAP:
+    case TMMDB_DTYPE_ARRAY:
+        return a->data_size == b->data_size;
+    default:
+        return a->uinteger == b->uinteger;
+    }
+}
@@ -12,4 +12,14 @@ typedef union {
 char *get_test_db_fname(void);
 void ip_to_num(TMMDB_s * mmdb, char *ipstr, in_addrX * dest_ipnum);
 int dbl_cmp(double a, double b);
+int walk_tree(TMMDB_s * mmdb, const uint8_t * ip, int bits,
+              TMMDB_root_entry_s * res);
+int walk_tree_32(TMMDB_s * mmdb, uint32_t ipnum, TMMDB_root_entry_s * res);
+int same_return(TMMDB_return_s * a, TMMDB_return_s * b);
+int lookup_ipnum(TMMDB_s * mmdb, const in_addrX * ipnum,
+                 TMMDB_root_entry_s * root);
+int lookup_ip(TMMDB_s * mmdb, const char *ipstr, TMMDB_root_entry_s * root);
+
+// the databases in t/data, NULL terminated
+extern const char *const test_databases[];
 #endif
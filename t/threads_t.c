@@ -0,0 +1,227 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include "test_helper.h"
+
+// many readers on one shared TMMDB_s. Every thread checks its results
+// against the ones computed before the threads started. Run it with
+// ./configure --enable-tsan to check for data races as well.
+
+#define THREADS (8)
+#define ADDRESSES (2048)
+#define ROUNDS (4)
+
+static uint32_t seed = 42;
+
+static uint32_t next_random(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+typedef struct {
+    in_addrX ip;                /* IPv4 databases use v4 */
+    uint32_t ipnum;
+    TMMDB_root_entry_s root;
+    TMMDB_root_entry_s v4;      /* of TMMDB_lookup_by_ipnum_v4 */
+    double latitude;
+    int has_latitude;
+} expect_s;
+
+typedef struct {
+    TMMDB_s *mmdb;
+    TMMDB_query_s *query;
+    expect_s *expect;
+    int first;
+    int failed;
+} reader_s;
+
+static TMMDB_network_s networks[ADDRESSES];
+static int network_count;
+
+static int add_network(void *ctx, TMMDB_network_s const *network)
+{
+    if (network_count < ADDRESSES)
+        networks[network_count++] = *network;
+    return TMMDB_SUCCESS;
+}
+
+static int latitude(TMMDB_entry_s * entry, double *v)
+{
+    TMMDB_return_s res;
+    TMMDB_get_value(entry, &res, "location", "latitude", NULL);
+    *v = res.double_value;
+    return res.offset != 0;
+}
+
+// TMMDB_get_value by hand, the readers use it
+static int vget_value(TMMDB_entry_s * entry, TMMDB_return_s * res, ...)
+{
+    va_list keys;
+    va_start(keys, res);
+    int err = TMMDB_vget_value(entry, res, keys);
+    va_end(keys);
+    return err;
+}
+
+// an address inside a network of the database or a random one
+static void random_address(TMMDB_s * mmdb, expect_s * e)
+{
+    uint8_t *ip = e->ip.v6.s6_addr;
+    int bits = mmdb->depth;
+    for (int i = 0; i < 16; i++)
+        ip[i] = next_random();
+    if (network_count && next_random() % 4) {
+        TMMDB_network_s *n = &networks[next_random() % network_count];
+        for (int bit = 0; bit < n->netmask; bit++) {
+            int mask = 0x80 >> bit % 8;
+            ip[bit / 8] = (ip[bit / 8] & ~mask) | (n->ip[bit / 8] & mask);
+        }
+    }
+    for (int bit = bits; bit < 128; bit++)
+        ip[bit / 8] &= ~(0x80 >> bit % 8);
+    e->ipnum = (uint32_t) ip[0] << 24 | ip[1] << 16 | ip[2] << 8 | ip[3];
+}
+
+static void *reader(void *arg)
+{
+    reader_s *r = arg;
+    TMMDB_s *mmdb = r->mmdb;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int k = 0; k < ADDRESSES; k++) {
+            expect_s *e = &r->expect[(r->first + k) % ADDRESSES];
+            TMMDB_root_entry_s root, v4 = {.entry.mmdb = mmdb };
+            lookup_ipnum(mmdb, &e->ip, &root);
+            TMMDB_lookup_by_ipnum_v4(e->ipnum, &v4);
+            double v = 0;
+            int has = root.entry.offset ? latitude(&root.entry, &v) : 0;
+            if (root.entry.offset != e->root.entry.offset
+                || root.netmask != e->root.netmask
+                || v4.entry.offset != e->v4.entry.offset
+                || v4.netmask != e->v4.netmask
+                || has != e->has_latitude || v != e->latitude)
+                r->failed++;
+            if (!root.entry.offset)
+                continue;
+
+            TMMDB_return_s res;
+            TMMDB_get_values(&root.entry,
+                             (TMMDB_query_s const *const *)&r->query, 1,
+                             &res);
+            if (res.offset ? res.double_value != e->latitude
+                : e->has_latitude)
+                r->failed++;
+            vget_value(&root.entry, &res, "location", "latitude", NULL);
+            if (res.offset ? res.double_value != e->latitude
+                : e->has_latitude)
+                r->failed++;
+            const TMMDB_return_s *hot = TMMDB_hot_fields(&root.entry);
+            if (!hot || (hot[0].offset ? hot[0].double_value != e->latitude
+                         : e->has_latitude))
+                r->failed++;
+            TMMDB_decode_all_s *decode_all;
+            if (TMMDB_get_tree(&root.entry, &decode_all) != TMMDB_SUCCESS)
+                r->failed++;
+            TMMDB_free_decode_all(decode_all);
+        }
+
+        // the batch lookups
+        uint32_t ipnums[16];
+        struct in6_addr ips[16];
+        TMMDB_root_entry_s many[16];
+        for (int i = 0; i < 16; i++) {
+            ipnums[i] = r->expect[(r->first + i) % ADDRESSES].ipnum;
+            ips[i] = r->expect[(r->first + i) % ADDRESSES].ip.v6;
+        }
+        if (mmdb->depth == 32)
+            TMMDB_lookup_many_ipnum(mmdb, ipnums, 16, many);
+        else
+            TMMDB_lookup_many_ipnum_128(mmdb, ips, 16, many);
+        for (int i = 0; i < 16; i++) {
+            expect_s *e = &r->expect[(r->first + i) % ADDRESSES];
+            if (many[i].entry.offset != e->root.entry.offset
+                || many[i].netmask != e->root.netmask)
+                r->failed++;
+        }
+    }
+    return NULL;
+}
+
+static void test_mmdb(const char *fname, uint32_t flags, const char *name)
+{
+    TMMDB_s *mmdb;
+    int err = TMMDB_open(&mmdb, fname, flags);
+    ok(err == TMMDB_SUCCESS, "TMMDB_open %s with %s", fname, name);
+    if (err != TMMDB_SUCCESS)
+        return;
+    const char *keys[] = { "location", "latitude", NULL };
+    TMMDB_query_s *query;
+    TMMDB_compile_query(&query, keys);
+    TMMDB_build_hot_fields(mmdb, (TMMDB_query_s const *const *)&query, 1);
+    TMMDB_enable_stats(mmdb);
+
+    network_count = 0;
+    TMMDB_foreach_network(mmdb, add_network, NULL);
+    static expect_s expect[ADDRESSES];
+    for (int i = 0; i < ADDRESSES; i++) {
+        expect_s *e = &expect[i];
+        random_address(mmdb, e);
+        lookup_ipnum(mmdb, &e->ip, &e->root);
+        e->v4.entry.mmdb = mmdb;
+        TMMDB_lookup_by_ipnum_v4(e->ipnum, &e->v4);
+        e->latitude = 0;
+        e->has_latitude = e->root.entry.offset
+            ? latitude(&e->root.entry, &e->latitude) : 0;
+    }
+
+    pthread_t tid[THREADS];
+    reader_s r[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        r[t] = (reader_s) {.mmdb = mmdb,.query = query,.expect = expect,
+            .first = t * ADDRESSES / THREADS
+        };
+        pthread_create(&tid[t], NULL, reader, &r[t]);
+    }
+    int failed = 0;
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(tid[t], NULL);
+        failed += r[t].failed;
+    }
+    ok(failed == 0, "%d threads, %d wrong results", THREADS, failed);
+
+    TMMDB_stats_s stats;
+    if (TMMDB_stats_snapshot(mmdb, &stats) == TMMDB_SUCCESS)
+        ok(stats.lookups >= (uint64_t)THREADS * ROUNDS * ADDRESSES,
+           "%llu lookups counted", (unsigned long long)stats.lookups);
+    TMMDB_free_query(query);
+    TMMDB_close(mmdb);
+}
+
+int main(void)
+{
+    char *fnames[] = { "./data/v4-24.mmdb", "./data/v6-28.mmdb", NULL };
+    struct {
+        uint32_t flags;
+        const char *name;
+    } modes[] = {
+        {TMMDB_MODE_STANDARD, "TMMDB_MODE_STANDARD"},
+        {TMMDB_MODE_MEMORY_CACHE, "TMMDB_MODE_MEMORY_CACHE"},
+        {TMMDB_OPT_JUMP_TABLE | TMMDB_OPT_PREFIX_CACHE,
+         "the jump table and the prefix cache"},
+        {TMMDB_OPT_RANGE_TABLE, "TMMDB_OPT_RANGE_TABLE"},
+        {TMMDB_OPT_STRIDE_TRIE, "TMMDB_OPT_STRIDE_TRIE"},
+        {0, NULL}
+    };
+
+    char *fname;
+    for (char **ptr = fnames; (fname = *ptr++);)
+        for (int i = 0; modes[i].name; i++)
+            test_mmdb(fname, modes[i].flags, modes[i].name);
+    done_testing();
+}
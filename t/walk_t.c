@@ -0,0 +1,121 @@
+#include "tinymmdb.h"
+#include "tap.h"
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include "test_helper.h"
+
+// replays the flat tree while TMMDB_walk runs
+typedef struct {
+    TMMDB_flat_node_s *nodes;
+    size_t next;                /* the node we expect next */
+    size_t used;
+    int errors;
+    int depth;
+    int ends;
+    int stop_after;             /* stop the walk after so many events */
+} replay_s;
+
+static int expect(replay_s * r, int type, TMMDB_return_s const *value)
+{
+    if (r->next >= r->used || r->nodes[r->next].data.type != type
+        || (value && !same_return((TMMDB_return_s *) value,
+                                  &r->nodes[r->next].data)))
+        r->errors++;
+    r->next++;
+    return --r->stop_after ? TMMDB_SUCCESS : TMMDB_INVALIDARGUMENT;
+}
+
+static int begin_map(void *ctx, int size)
+{
+    replay_s *r = ctx;
+    r->depth++;
+    if (r->next < r->used && r->nodes[r->next].data.data_size != size)
+        r->errors++;
+    return expect(r, TMMDB_DTYPE_MAP, NULL);
+}
+
+static int begin_array(void *ctx, int size)
+{
+    replay_s *r = ctx;
+    r->depth++;
+    if (r->next < r->used && r->nodes[r->next].data.data_size != size)
+        r->errors++;
+    return expect(r, TMMDB_DTYPE_ARRAY, NULL);
+}
+
+static int end(void *ctx)
+{
+    replay_s *r = ctx;
+    r->depth--;
+    r->ends++;
+    return TMMDB_SUCCESS;
+}
+
+static int key(void *ctx, const char *key, int len)
+{
+    replay_s *r = ctx;
+    TMMDB_flat_node_s *n = &r->nodes[r->next];
+    if (r->next >= r->used || n->data.data_size != len
+        || memcmp(n->data.ptr, key, len))
+        r->errors++;
+    r->next++;
+    return TMMDB_SUCCESS;
+}
+
+static int value(void *ctx, TMMDB_return_s const *value)
+{
+    return expect(ctx, value->type, value);
+}
+
+static const TMMDB_visitor_s visitor = {
+    .begin_map = begin_map,.end_map = end,
+    .begin_array = begin_array,.end_array = end,
+    .key = key,.value = value
+};
+
+static void compare(TMMDB_entry_s * entry, const char *what)
+{
+    TMMDB_flat_tree_s tree = { 0 };
+    TMMDB_get_flat_tree(entry, &tree);
+    replay_s r = {.nodes = tree.nodes,.used = tree.used,.stop_after = -1 };
+
+    int err = TMMDB_walk(entry, &visitor, &r);
+    ok(err == TMMDB_SUCCESS, "TMMDB_walk %s", what);
+    ok(r.errors == 0 && r.next == tree.used,
+       "Events match the flat tree ( %d nodes, %d errors )", (int)r.next,
+       r.errors);
+    ok(r.depth == 0 && r.ends > 0, "Every map and array ends ( %d )", r.ends);
+
+    // stop early
+    replay_s stop = {.nodes = tree.nodes,.used = tree.used,.stop_after = 3 };
+    err = TMMDB_walk(entry, &visitor, &stop);
+    ok(err == TMMDB_INVALIDARGUMENT && stop.errors == 0,
+       "The visitor stops the walk");
+
+    // no callbacks at all
+    TMMDB_visitor_s none = { 0 };
+    ok(TMMDB_walk(entry, &none, NULL) == TMMDB_SUCCESS, "Empty visitor");
+    TMMDB_free_flat_tree(&tree);
+}
+
+int main(void)
+{
+    const char *fname;
+    for (const char *const *ptr = test_databases; (fname = *ptr++);) {
+        TMMDB_s *mmdb;
+        int status = TMMDB_open(&mmdb, fname, TMMDB_MODE_STANDARD);
+        ok(status == TMMDB_SUCCESS, "TMMDB_open %s successful", fname);
+        if (!mmdb)
+            continue;
+
+        TMMDB_root_entry_s root;
+        int err = lookup_ip(mmdb, "24.24.24.24", &root);
+        ok(err == TMMDB_SUCCESS && root.entry.offset > 0, "Found 24.24.24.24");
+
+        compare(&mmdb->meta, "metadata");
+        compare(&root.entry, "record");
+        TMMDB_close(mmdb);
+    }
+    done_testing();
+}
@@ -0,0 +1,204 @@
+#include "tinymmdb.h"
+#include "tinymmdb_writer.h"
+#include "tap.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "test_helper.h"
+
+#define FNAME "./writer_t.mmdb"
+
+static uint32_t record, other, far;
+
+static uint32_t write_country(TMMDB_writer_s * w, const char *code)
+{
+    uint32_t offset = TMMDB_writer_map(w, 1);
+    TMMDB_writer_key(w, "code");
+    TMMDB_writer_string(w, code);
+    return offset;
+}
+
+static void write_filler(TMMDB_writer_s * w, size_t size)
+{
+    void *filler = calloc(1, 1 << 20);
+    for (; size > 1 << 20; size -= 1 << 20)
+        TMMDB_writer_bytes(w, filler, 1 << 20);
+    TMMDB_writer_bytes(w, filler, size);
+    free(filler);
+}
+
+// the pointers to the countries need 2, 4 and with far_away 5 bytes
+static void write_data(TMMDB_writer_s * w, int far_away)
+{
+    uint32_t country = write_country(w, "XX");
+    record = TMMDB_writer_map(w, 8);
+    TMMDB_writer_key(w, "name");
+    TMMDB_writer_string(w, "first");
+    TMMDB_writer_key(w, "latitude");
+    TMMDB_writer_double(w, 52.5);
+    TMMDB_writer_key(w, "small");
+    TMMDB_writer_uint(w, TMMDB_DTYPE_UINT16, 0);
+    TMMDB_writer_key(w, "big");
+    TMMDB_writer_uint(w, TMMDB_DTYPE_UINT32, 4000000000U);
+    TMMDB_writer_key(w, "negative");
+    TMMDB_writer_int32(w, -42);
+    TMMDB_writer_key(w, "flag");
+    TMMDB_writer_bool(w, 1);
+    TMMDB_writer_key(w, "list");
+    TMMDB_writer_array(w, 2);
+    TMMDB_writer_float(w, 1.5);
+    TMMDB_writer_string(w, "a string longer than 29 bytes, so the size needs "
+                        "an extra byte");
+    TMMDB_writer_key(w, "country");
+    TMMDB_writer_pointer(w, country);
+
+    write_filler(w, 600000);
+    country = write_country(w, "YY");
+    other = TMMDB_writer_map(w, 2);
+    TMMDB_writer_key(w, "name");
+    TMMDB_writer_string(w, "second");
+    TMMDB_writer_key(w, "country");
+    TMMDB_writer_pointer(w, country);
+
+    if (far_away)
+        write_filler(w, 135000000);
+    country = write_country(w, "ZZ");
+    far = TMMDB_writer_map(w, 2);
+    TMMDB_writer_key(w, "name");
+    TMMDB_writer_string(w, "far");
+    TMMDB_writer_key(w, "country");
+    TMMDB_writer_pointer(w, country);
+}
+
+static int count_network(void *ctx, TMMDB_network_s const *network)
+{
+    (*(int *)ctx)++;
+    return TMMDB_SUCCESS;
+}
+
+static void check_db(int ip_version, int record_size, int far_away)
+{
+    TMMDB_writer_s *w;
+    int err = TMMDB_writer_new(&w, ip_version, record_size);
+    ok(err == TMMDB_SUCCESS, "TMMDB_writer_new IPv%d %d bit records%s",
+       ip_version, record_size, far_away ? ", far away data" : "");
+    write_data(w, far_away);
+
+    uint8_t ip[16] = { 0 };
+    int v4 = ip_version == 4 ? 0 : 12, bits = ip_version == 4 ? 0 : 96;
+    ip[v4] = 10;
+    TMMDB_writer_insert(w, ip, bits + 8, record);
+    // a more specific network inside 10.0.0.0/8
+    ip[v4 + 1] = 1;
+    TMMDB_writer_insert(w, ip, bits + 16, other);
+    ip[v4] = 192;
+    ip[v4 + 1] = 168;
+    err = TMMDB_writer_insert(w, ip, bits + 24, far);
+    ok(err == TMMDB_SUCCESS, "TMMDB_writer_insert 192.168.0.0/24");
+    ok(TMMDB_writer_insert(w, ip, 0, far) == TMMDB_INVALIDARGUMENT,
+       "netmask 0 is invalid");
+    if (ip_version == 6)
+        ok(TMMDB_writer_alias_ipv4(w) == TMMDB_SUCCESS,
+           "TMMDB_writer_alias_ipv4");
+
+    err = TMMDB_writer_write(w, FNAME, "Test", "writer_t");
+    TMMDB_writer_free(w);
+    ok(err == TMMDB_SUCCESS, "TMMDB_writer_write");
+
+    TMMDB_s *mmdb;
+    err = TMMDB_open(&mmdb, FNAME, TMMDB_MODE_STANDARD);
+    ok(err == TMMDB_SUCCESS, "TMMDB_open the written database");
+    if (err != TMMDB_SUCCESS)
+        return;
+    ok(mmdb->depth == (ip_version == 4 ? 32 : 128)
+       && mmdb->full_record_size_bytes == record_size * 2 / 8,
+       "depth and record size");
+
+    const char *addresses[] = { "10.2.3.4", "10.1.2.3", "192.168.0.77",
+        "11.0.0.1", "::ffff:10.1.0.1", NULL
+    };
+    uint32_t expect[] = { record, other, far, 0, other };
+    const char *codes[] = { "XX", "YY", "ZZ", NULL, "YY" };
+    for (int i = 0; addresses[i]; i++) {
+        if (ip_version == 4 && strchr(addresses[i], ':'))
+            continue;
+        TMMDB_root_entry_s root;
+        err = lookup_ip(mmdb, addresses[i], &root);
+        ok(err == TMMDB_SUCCESS && root.entry.offset == (expect[i]
+                                                         ? expect[i] +
+                                                         TMMDB_DATASECTION_NOOP_SIZE
+                                                         : 0),
+           "%s is at the right offset", addresses[i]);
+        if (!root.entry.offset)
+            continue;
+        TMMDB_return_s res;
+        TMMDB_get_value(&root.entry, &res, "country", "code", NULL);
+        ok(res.offset && TMMDB_strcmp_result(mmdb, &res, (char *)codes[i]) == 0,
+           "country/code through the pointer is %s", codes[i]);
+    }
+
+    TMMDB_root_entry_s root = {.entry.mmdb = mmdb };
+    if (ip_version == 4) {
+        TMMDB_lookup_by_ipnum(0x0a020304, &root);
+    } else {
+        struct in6_addr a = {.s6_addr = {[12] = 10,[13] = 2 } };
+        TMMDB_lookup_by_ipnum_128(a, &root);
+    }
+    TMMDB_return_s res;
+    TMMDB_get_value(&root.entry, &res, "name", NULL);
+    ok(TMMDB_strcmp_result(mmdb, &res, "first") == 0, "name is first");
+    TMMDB_get_value(&root.entry, &res, "latitude", NULL);
+    ok(res.offset && res.double_value == 52.5, "latitude is 52.5");
+    TMMDB_get_value(&root.entry, &res, "small", NULL);
+    ok(res.offset && res.uinteger == 0, "small is 0");
+    TMMDB_get_value(&root.entry, &res, "big", NULL);
+    ok(res.offset && res.uinteger == 4000000000U, "big is 4000000000");
+    TMMDB_get_value(&root.entry, &res, "negative", NULL);
+    ok(res.offset && res.sinteger == -42, "negative is -42");
+    TMMDB_get_value(&root.entry, &res, "flag", NULL);
+    ok(res.offset && res.uinteger == 1, "flag is true");
+    TMMDB_get_value(&root.entry, &res, "list", "0", NULL);
+    ok(res.offset && res.float_value == 1.5, "list/0 is 1.5");
+    TMMDB_get_value(&root.entry, &res, "list", "1", NULL);
+    ok(res.offset && res.data_size == 62, "list/1 is 62 bytes long");
+
+    int count = 0;
+    TMMDB_foreach_network(mmdb, count_network, &count);
+    ok(count == 10, "10 networks, 10.0.0.0/8 is split around 10.1.0.0/16");
+    TMMDB_close(mmdb);
+    unlink(FNAME);
+}
+
+int main(void)
+{
+    TMMDB_writer_s *w;
+    ok(TMMDB_writer_new(&w, 5, 24) == TMMDB_INVALIDARGUMENT && !w,
+       "IPv5 is invalid");
+    ok(TMMDB_writer_new(&w, 4, 20) == TMMDB_INVALIDARGUMENT,
+       "20 bit records are invalid");
+
+    // the keys are written once
+    TMMDB_writer_new(&w, 4, 32);
+    uint32_t first = TMMDB_writer_key(w, "latitude");
+    uint32_t second = TMMDB_writer_key(w, "latitude");
+    uint32_t third = TMMDB_writer_key(w, "x");
+    uint32_t end = TMMDB_writer_key(w, "x");
+    ok(first == 0 && second == 9 && third == 11 && end == 13,
+       "the second latitude is a 2 byte pointer, x is not worth one");
+    TMMDB_writer_free(w);
+
+    // 16MB of data do not fit 24 bit records
+    TMMDB_writer_new(&w, 4, 24);
+    write_filler(w, 1 << 24);
+    ok(TMMDB_writer_write(w, FNAME, "Test", "writer_t")
+       == TMMDB_INVALIDARGUMENT, "16MB of data need more than 24 bit");
+    TMMDB_writer_free(w);
+
+    int sizes[] = { 24, 28, 32 };
+    for (int v = 4; v <= 6; v += 2)
+        for (int i = 0; i < 3; i++)
+            check_db(v, sizes[i], 0);
+    check_db(6, 32, 1);
+    done_testing();
+}